@@ -0,0 +1,64 @@
+#include "Allocations.h"
+#include <atomic>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> frees(0);
+
+// the allocator of glibc under its internal names, so the public ones can count calls
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+extern "C" void __libc_free(void *pointer);
+
+extern "C" void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size) {
+    allocations++;
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void *pointer) {
+    if (pointer != nullptr) {
+        frees++;
+    }
+    __libc_free(pointer);
+}
+
+HeapStats heapStats() {
+    struct mallinfo2 info = mallinfo2();
+    HeapStats stats = {};
+    stats.allocations = allocations;
+    stats.frees = frees;
+    stats.inUse = info.uordblks;
+    stats.free = info.fordblks;
+    stats.freeChunks = info.ordblks;
+    stats.topChunk = info.keepcost;
+    return stats;
+}
+
+bool heapStatsAvailable() {
+    return true;
+}
+
+#else
+
+HeapStats heapStats() {
+    return HeapStats();
+}
+
+bool heapStatsAvailable() {
+    return false;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef ESP32_LIGHT_ALLOCATIONS_H
+#define ESP32_LIGHT_ALLOCATIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Heap statistics of the host tools.  With glibc every malloc/calloc/realloc/free of the process is counted (see
+ * Allocations.cpp), elsewhere the counters stay at zero.
+ */
+struct HeapStats {
+    uint64_t allocations;
+    uint64_t frees;
+    // bytes handed out by malloc and still in use
+    size_t inUse;
+    // bytes the allocator holds but are free, and in how many chunks
+    size_t free;
+    size_t freeChunks;
+    // the free chunk at the top of the heap, glibc does not report the largest free chunk but this is usually it
+    size_t topChunk;
+
+    // share of the free heap that is not in the top chunk, i.e. scattered between allocations
+    double fragmentation() const {
+        return free > 0 ? 1.0 - (double) topChunk / free : 0;
+    }
+};
+
+HeapStats heapStats();
+
+// false when the counters are not available on this platform
+bool heapStatsAvailable();
+
+#endif //ESP32_LIGHT_ALLOCATIONS_H
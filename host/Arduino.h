@@ -0,0 +1,7 @@
+#ifndef ESP32_LIGHT_ARDUINO_H
+#define ESP32_LIGHT_ARDUINO_H
+
+// `#include <Arduino.h>` in the shared sources resolves to this in the host build
+#include "HostArduino.h"
+
+#endif //ESP32_LIGHT_ARDUINO_H
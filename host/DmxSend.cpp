@@ -0,0 +1,131 @@
+#include "DmxSend.h"
+#include "Options.h"
+#include "DmxProtocol.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+// E1.31 6.2.6, a stream is terminated with three packets
+#define SACN_TERMINATE_PACKETS 3
+// one full fade up and down
+#define DMX_SEND_FADE_PERIOD_US 4000000
+
+static std::atomic<bool> sending(true);
+
+static uint64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int runDmxSend(int argc, char **argv) {
+    const char *host = option(argc, argv, "host", (const char *) nullptr);
+    bool sacn = strcmp(option(argc, argv, "protocol", "artnet"), "sacn") == 0;
+    auto universe = (uint16_t) option(argc, argv, "universe", 1L);
+    long channel = option(argc, argv, "channel", 1L);
+    long rate = std::max(option(argc, argv, "rate", 40L), 1L);
+    long seconds = option(argc, argv, "seconds", 10L);
+    long jitterMs = option(argc, argv, "jitter", 0L);
+    auto temperature = (uint8_t) option(argc, argv, "temperature", 128L);
+
+    if (channel < 1 || channel > DMX_UNIVERSE_SIZE - 2) {
+        fprintf(stderr, "The channel has to be within 1-%u\n", DMX_UNIVERSE_SIZE - 2);
+        return 1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+
+    sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(sacn ? SACN_PORT : ARTNET_PORT);
+    if (host != nullptr) {
+        inet_pton(AF_INET, host, &to.sin_addr);
+    } else {
+        to.sin_addr.s_addr = sacn ? htonl(sacnMulticastGroup(universe)) : htonl(INADDR_BROADCAST);
+    }
+
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &to.sin_addr, address, sizeof(address));
+    printf("Sending %s universe %u, channels %ld-%ld to %s:%u at %ld frames/s\n", sacn ? "sACN" : "Art-Net", universe,
+           channel, channel + 2, address, ntohs(to.sin_port), rate);
+
+    signal(SIGINT, [](int) {
+        sending = false;
+    });
+
+    // a fixed source, so the device sees the same sender every run
+    const uint8_t cid[SACN_CID_LENGTH] = {0x45, 0x53, 0x50, 0x33, 0x32, 0x2D, 0x66, 0x61,
+                                          0x6B, 0x65, 0x2D, 0x6C, 0x69, 0x67, 0x68, 0x74};
+    uint8_t slots[DMX_UNIVERSE_SIZE] = {};
+    auto slotCount = (uint16_t) (channel + 2);
+    uint8_t packet[SACN_HEADER_SIZE + DMX_UNIVERSE_SIZE];
+    uint8_t sequence = 0;
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<long> jitter(0, jitterMs * 1000);
+
+    uint64_t intervalUs = 1000000 / rate;
+    uint64_t start = nowUs();
+    uint64_t frames = 0;
+    uint64_t failed = 0;
+    uint64_t lastReport = start;
+
+    while (sending && (seconds <= 0 || nowUs() - start < (uint64_t) seconds * 1000000)) {
+        // the frame is due on the fixed schedule, plus the simulated delay
+        uint64_t due = start + frames * intervalUs + jitter(random);
+        uint64_t now = nowUs();
+        if (due > now) {
+            std::this_thread::sleep_for(std::chrono::microseconds(due - now));
+        }
+
+        // fade up and down, on for the whole stream
+        uint64_t phase = (nowUs() - start) % DMX_SEND_FADE_PERIOD_US;
+        uint64_t half = DMX_SEND_FADE_PERIOD_US / 2;
+        slots[channel - 1] = 255;
+        slots[channel] = (uint8_t) ((phase < half ? phase : DMX_SEND_FADE_PERIOD_US - phase) * 255 / half);
+        slots[channel + 1] = temperature;
+
+        // 0 is skipped when it wraps, for Art-Net it means the packets are not numbered
+        sequence = sequence == 255 ? 1 : sequence + 1;
+        size_t length = sacn
+                ? writeSacn(packet, sizeof(packet), cid, "esp32-fake-light dmx-send", universe, sequence, slots,
+                            slotCount, false)
+                : writeArtNet(packet, sizeof(packet), universe, sequence, slots, slotCount);
+        if (sendto(fd, packet, length, 0, (sockaddr *) &to, sizeof(to)) < 0) {
+            failed++;
+        }
+        frames++;
+
+        if (nowUs() - lastReport >= 1000000) {
+            lastReport = nowUs();
+            printf("%llu frames, level %u\n", (unsigned long long) frames, slots[channel]);
+        }
+    }
+
+    if (sacn) {
+        for (uint8_t i = 0; i < SACN_TERMINATE_PACKETS; i++) {
+            sequence = sequence == 255 ? 1 : sequence + 1;
+            size_t length = writeSacn(packet, sizeof(packet), cid, "esp32-fake-light dmx-send", universe, sequence,
+                                      slots, slotCount, true);
+            sendto(fd, packet, length, 0, (sockaddr *) &to, sizeof(to));
+        }
+    }
+    ::close(fd);
+
+    double elapsed = (nowUs() - start) / 1e6;
+    printf("Sent %llu frames in %.1fs (%.1f frames/s), %llu failed\n", (unsigned long long) frames, elapsed,
+           elapsed > 0 ? frames / elapsed : 0, (unsigned long long) failed);
+    return failed == 0 ? 0 : 1;
+}
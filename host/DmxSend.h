@@ -0,0 +1,16 @@
+#ifndef ESP32_LIGHT_DMXSEND_H
+#define ESP32_LIGHT_DMXSEND_H
+
+/*
+ * Stands in for a lighting console: streams Art-Net or sACN frames that fade the patched light up and down.
+ *
+ *   dmx-send [-host <address>] [-protocol artnet] [-universe 1] [-channel 1] [-rate 40] [-seconds 10] [-jitter 0]
+ *            [-temperature 128]
+ *
+ * Without `-host` Art-Net is broadcast and sACN sent to the multicast group of the universe.  `-jitter <ms>` delays
+ * every frame by up to that long (so frames bunch up like on a busy WiFi network), `-rate` is in frames per second.
+ * sACN streams end with the terminated option, so the light stops streaming right away.
+ */
+int runDmxSend(int argc, char **argv);
+
+#endif //ESP32_LIGHT_DMXSEND_H
@@ -0,0 +1,117 @@
+#include "EmulatedFlash.h"
+#include <string.h>
+#include <algorithm>
+
+EmulatedFlash::EmulatedFlash(size_t size, uint32_t seed)
+        : memory(size - size % FLASH_SECTOR_SIZE, 0xFF),
+          sectorErases(size / FLASH_SECTOR_SIZE, 0),
+          random(seed) {
+}
+
+EmulatedFlash::Power EmulatedFlash::powerCheck() {
+    if (poweredOff) {
+        return POWER_OFF;
+    }
+    if (operationsToPowerLoss == 0) {
+        poweredOff = true;
+        operationsToPowerLoss = -1;
+        return POWER_CUT;
+    }
+    if (operationsToPowerLoss > 0) {
+        operationsToPowerLoss--;
+    }
+    return POWER_ON;
+}
+
+bool EmulatedFlash::read(size_t offset, void *data, size_t length) {
+    if (poweredOff || offset + length > memory.size()) {
+        return false;
+    }
+    memcpy(data, memory.data() + offset, length);
+    reads++;
+    elapsedNs += EMULATED_FLASH_CALL_NS + length * EMULATED_FLASH_READ_NS_PER_BYTE;
+    return true;
+}
+
+bool EmulatedFlash::write(size_t offset, const void *data, size_t length) {
+    if (offset + length > memory.size()) {
+        return false;
+    }
+    const uint8_t *bytes = (const uint8_t *) data;
+
+    size_t programmed = length;
+    uint8_t partialMask = 0xFF;
+    Power power = powerCheck();
+    if (power == POWER_OFF) {
+        return false;
+    }
+    if (power == POWER_CUT) {
+        // torn: the bytes are programmed in order, the one being programmed gets some of its bits
+        programmed = random() % (length + 1);
+        partialMask = random();
+    }
+
+    for (size_t i = 0; i < programmed; i++) {
+        memory[offset + i] &= bytes[i];
+    }
+    if (power == POWER_CUT) {
+        if (programmed < length) {
+            memory[offset + programmed] &= bytes[programmed] | partialMask;
+        }
+        return false;
+    }
+
+    writes++;
+    elapsedNs += EMULATED_FLASH_CALL_NS;
+    // one program operation per page the write touches
+    size_t position = offset;
+    while (position < offset + length) {
+        size_t pageEnd = std::min((position / EMULATED_FLASH_PAGE_SIZE + 1) * EMULATED_FLASH_PAGE_SIZE, offset + length);
+        elapsedNs += EMULATED_FLASH_PROGRAM_FIRST_NS + (pageEnd - position - 1) * EMULATED_FLASH_PROGRAM_BYTE_NS;
+        position = pageEnd;
+    }
+    return true;
+}
+
+bool EmulatedFlash::eraseSector(size_t offset) {
+    if (offset % FLASH_SECTOR_SIZE != 0 || offset >= memory.size()) {
+        return false;
+    }
+
+    Power power = powerCheck();
+    if (power == POWER_OFF) {
+        return false;
+    }
+    if (power == POWER_CUT) {
+        // torn: part of the sector is erased, the rest still has its old contents
+        size_t erased = random() % FLASH_SECTOR_SIZE;
+        memset(memory.data() + offset, 0xFF, erased);
+        return false;
+    }
+
+    memset(memory.data() + offset, 0xFF, FLASH_SECTOR_SIZE);
+    sectorErases[offset / FLASH_SECTOR_SIZE]++;
+    elapsedNs += EMULATED_FLASH_CALL_NS + EMULATED_FLASH_ERASE_NS;
+    return true;
+}
+
+void EmulatedFlash::cutPowerAfter(uint64_t operations) {
+    operationsToPowerLoss = (int64_t) operations;
+}
+
+void EmulatedFlash::powerOn() {
+    poweredOff = false;
+    operationsToPowerLoss = -1;
+}
+
+uint64_t EmulatedFlash::getErases() const {
+    uint64_t erases = 0;
+    for (uint32_t count : sectorErases) {
+        erases += count;
+    }
+    return erases;
+}
+
+uint32_t EmulatedFlash::getMaxSectorErases() const {
+    return sectorErases.empty() ? 0 : *std::max_element(sectorErases.begin(), sectorErases.end());
+}
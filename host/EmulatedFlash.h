@@ -0,0 +1,67 @@
+#ifndef ESP32_LIGHT_EMULATEDFLASH_H
+#define ESP32_LIGHT_EMULATEDFLASH_H
+
+#include <stdint.h>
+#include <random>
+#include <vector>
+#include "FlashBackend.h"
+
+// typical figures from the datasheet of the ESP32-WROOM's 4 MB SPI NOR flash (W25Q32JV class) at 40 MHz QIO, plus the
+// overhead of the esp_partition API (disabling the cache, sending the command)
+#define EMULATED_FLASH_CALL_NS 4000
+#define EMULATED_FLASH_READ_NS_PER_BYTE 50
+// page program: the first byte, then each following one, writes are split at 256 byte pages
+#define EMULATED_FLASH_PROGRAM_FIRST_NS 30000
+#define EMULATED_FLASH_PROGRAM_BYTE_NS 2500
+#define EMULATED_FLASH_PAGE_SIZE 256
+#define EMULATED_FLASH_ERASE_NS 45000000
+
+/*
+ * NOR flash in memory for the host tools: writes only clear bits, erases set a sector to 0xFF, and every operation
+ * adds its typical duration to a simulated clock.  Counts the erases of every sector for wear projections, and can cut
+ * the power part way through a write or erase to test recovery.
+ */
+class EmulatedFlash : public FlashBackend {
+
+private:
+    std::vector<uint8_t> memory;
+    std::vector<uint32_t> sectorErases;
+    uint64_t elapsedNs = 0;
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+
+    // operations (writes and erases) until the power is cut, negative never
+    int64_t operationsToPowerLoss = -1;
+    bool poweredOff = false;
+    std::mt19937 random;
+
+    enum Power {
+        POWER_ON,
+        // the power is cut during this operation, it is done in part
+        POWER_CUT,
+        POWER_OFF
+    };
+
+    Power powerCheck();
+
+public:
+    explicit EmulatedFlash(size_t size, uint32_t seed = 1);
+
+    size_t size() const override { return memory.size(); }
+    bool read(size_t offset, void *data, size_t length) override;
+    bool write(size_t offset, const void *data, size_t length) override;
+    bool eraseSector(size_t offset) override;
+
+    // the write or erase after the next `operations` ones is torn, everything after it fails until `powerOn()`
+    void cutPowerAfter(uint64_t operations);
+    void powerOn();
+    bool isPoweredOff() const { return poweredOff; }
+
+    uint64_t getElapsedNs() const { return elapsedNs; }
+    uint64_t getReads() const { return reads; }
+    uint64_t getWrites() const { return writes; }
+    uint64_t getErases() const;
+    uint32_t getMaxSectorErases() const;
+};
+
+#endif //ESP32_LIGHT_EMULATEDFLASH_H
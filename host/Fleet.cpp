@@ -0,0 +1,590 @@
+#include "Fleet.h"
+#include "Allocations.h"
+#include "LatencyHistogram.h"
+#include "Options.h"
+#include "ElgatoApi.h"
+#include "HttpProtocol.h"
+#include "FakeLight.h"
+#include "TrafficCapture.h"
+#include "MdnsResponder.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FLEET_REQUEST_BUFFER_SIZE 1024
+#define FLEET_RESPONSE_BUFFER_SIZE 2048
+// mDNS messages can be up to 9000 bytes (RFC 6762 17)
+#define FLEET_DISCOVERY_BUFFER_SIZE 9000
+
+static std::atomic<bool> running(true);
+
+static uint64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+enum EndpointType {
+    ENDPOINT_LISTEN,
+    ENDPOINT_CONNECTION,
+    ENDPOINT_DISCOVERY
+};
+
+struct Endpoint {
+    EndpointType type;
+    int fd = -1;
+
+    explicit Endpoint(EndpointType type) : type(type) {}
+};
+
+// one emulated light, the same state and routes as the firmware
+struct VirtualLight : Endpoint {
+    AccessoryInfo info;
+    Lights lights;
+    Settings settings;
+    ElgatoApi api;
+
+    uint16_t port;
+    char serviceName[64];
+    char deviceId[18];
+    // every light is a device of its own, with its own host name
+    MdnsResponder responder;
+
+    uint64_t requests = 0;
+    // time spent parsing, handling and writing a request (server side)
+    LatencyHistogram serverLatency;
+    // round trip as seen by the built in load client
+    LatencyHistogram clientLatency;
+
+    VirtualLight(uint32_t index, uint16_t port) : Endpoint(ENDPOINT_LISTEN), api(info, lights, settings), port(port) {
+        snprintf(serviceName, sizeof(serviceName), "Elgato Key Light Air %04u", index);
+        snprintf(deviceId, sizeof(deviceId), "3C:6A:9D:%02X:%02X:%02X",
+                 (index >> 16) & 0xFF, (index >> 8) & 0xFF, index & 0xFF);
+
+        char name[32];
+        snprintf(name, sizeof(name), "%s %u", DEFAULT_DISPLAY_NAME, index);
+        info.displayName = name;
+
+        char serial[16];
+        snprintf(serial, sizeof(serial), "CW31J1A%05u", index);
+        info.serialNumber = serial;
+
+        char host[24];
+        snprintf(host, sizeof(host), "fleet-light-%04u", index);
+        responder.setHost(host, INADDR_LOOPBACK);
+        responder.setService(0, serviceName, deviceId, port);
+    }
+};
+
+struct Connection : Endpoint {
+    VirtualLight *light;
+    char request[FLEET_REQUEST_BUFFER_SIZE];
+    size_t requestLength = 0;
+    std::string pending;
+    bool closing = false;
+
+    Connection(int connectionFd, VirtualLight *light) : Endpoint(ENDPOINT_CONNECTION), light(light) {
+        fd = connectionFd;
+    }
+};
+
+struct Fleet {
+    int epollFd = -1;
+    std::vector<std::unique_ptr<VirtualLight>> lights;
+    Endpoint discovery{ENDPOINT_DISCOVERY};
+    MdnsQuery query;
+
+    std::atomic<uint64_t> requests{0};
+    uint64_t discoveryQueries = 0;
+    uint64_t discoveryAnswers = 0;
+
+    bool listen(VirtualLight &light, const char *bindAddress);
+    bool listenDiscovery(const char *bindAddress, uint16_t discoveryPort);
+    void accept(VirtualLight &light);
+    void read(Connection *connection);
+    void flush(Connection *connection);
+    void close(Connection *connection);
+    void answerDiscovery();
+    void serve(uint64_t untilUs, uint32_t reportIntervalS);
+};
+
+static bool setNonBlocking(int fd) {
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == 0;
+}
+
+bool Fleet::listen(VirtualLight &light, const char *bindAddress) {
+    light.fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(light.fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(light.port);
+    inet_pton(AF_INET, bindAddress, &address.sin_addr);
+
+    if (bind(light.fd, (sockaddr *) &address, sizeof(address)) != 0 || ::listen(light.fd, 64) != 0) {
+        fprintf(stderr, "Failed to listen on %s:%u: %s\n", bindAddress, light.port, strerror(errno));
+        return false;
+    }
+    setNonBlocking(light.fd);
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = (Endpoint *) &light;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, light.fd, &event) == 0;
+}
+
+bool Fleet::listenDiscovery(const char *bindAddress, uint16_t discoveryPort) {
+    discovery.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int reuse = 1;
+    setsockopt(discovery.fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(discoveryPort);
+    inet_pton(AF_INET, bindAddress, &address.sin_addr);
+
+    if (bind(discovery.fd, (sockaddr *) &address, sizeof(address)) != 0) {
+        fprintf(stderr, "Failed to bind discovery to %s:%u: %s\n", bindAddress, discoveryPort, strerror(errno));
+        return false;
+    }
+    setNonBlocking(discovery.fd);
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &discovery;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, discovery.fd, &event) == 0;
+}
+
+void Fleet::accept(VirtualLight &light) {
+    while (true) {
+        int fd = ::accept(light.fd, nullptr, nullptr);
+        if (fd < 0) {
+            return;
+        }
+
+        setNonBlocking(fd);
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        auto *connection = new Connection(fd, &light);
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = (Endpoint *) connection;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void Fleet::read(Connection *connection) {
+    while (!connection->closing) {
+        size_t space = sizeof(connection->request) - connection->requestLength;
+        ssize_t received = ::read(connection->fd, connection->request + connection->requestLength, space);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close(connection);
+            return;
+        }
+        if (received < 0) {
+            break;
+        }
+        connection->requestLength += received;
+
+        // the same request path as KeepAliveServer on the device
+        while (connection->requestLength > 0 && !connection->closing) {
+            uint64_t start = nowUs();
+
+            HttpRequest request;
+            HttpParseResult result = parseHttpRequest(connection->request, connection->requestLength,
+                                                      sizeof(connection->request), request);
+            if (result == HTTP_PARSE_INCOMPLETE) {
+                break;
+            }
+
+            StaticJsonDocument<1024> requestDoc;
+            StaticJsonDocument<1024> responseDoc;
+            int status = result == HTTP_PARSE_OK
+                    ? handleHttpRequest(connection->light->api, request, requestDoc, responseDoc)
+                    : request.status;
+
+            char response[FLEET_RESPONSE_BUFFER_SIZE];
+            size_t length = writeHttpResponse(status, responseDoc, request.keepAlive, response, sizeof(response));
+            connection->pending.append(response, length);
+
+            memmove(connection->request, connection->request + request.length,
+                    connection->requestLength - request.length);
+            connection->requestLength -= request.length;
+            connection->closing = !request.keepAlive;
+
+            connection->light->requests++;
+            connection->light->serverLatency.record(nowUs() - start);
+            requests++;
+        }
+    }
+
+    flush(connection);
+}
+
+void Fleet::flush(Connection *connection) {
+    while (!connection->pending.empty()) {
+        ssize_t sent = ::write(connection->fd, connection->pending.data(), connection->pending.size());
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close(connection);
+                return;
+            }
+            break;
+        }
+        connection->pending.erase(0, sent);
+    }
+
+    if (connection->pending.empty() && connection->closing) {
+        close(connection);
+        return;
+    }
+
+    // wait for the socket to drain before writing the rest
+    epoll_event event = {};
+    event.events = connection->pending.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+    event.data.ptr = (Endpoint *) connection;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+void Fleet::close(Connection *connection) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    ::close(connection->fd);
+    delete connection;
+}
+
+// the responders of the lights on one socket, a query is answered by every light it is for.  Without a multicast group
+// the responses that would be multicast go to the querier too.
+void Fleet::answerDiscovery() {
+    uint8_t packet[FLEET_DISCOVERY_BUFFER_SIZE];
+    sockaddr_in from = {};
+    socklen_t fromLength = sizeof(from);
+
+    ssize_t received;
+    while ((received = recvfrom(discovery.fd, packet, sizeof(packet), 0, (sockaddr *) &from, &fromLength)) > 0) {
+        discoveryQueries++;
+        if (parseMdnsQuery(packet, received, query) != MDNS_PARSE_QUERY) {
+            continue;
+        }
+
+        bool legacy = ntohs(from.sin_port) != MDNS_PORT;
+        auto nowMs = (uint32_t) (nowUs() / 1000);
+        for (auto &light : lights) {
+            uint8_t answer[MDNS_PACKET_SIZE];
+            bool unicast;
+            size_t length = light->responder.respond(query, legacy, nowMs, answer, sizeof(answer), unicast);
+            if (length > 0) {
+                sendto(discovery.fd, answer, length, 0, (sockaddr *) &from, fromLength);
+                discoveryAnswers++;
+            }
+        }
+    }
+}
+
+void Fleet::serve(uint64_t untilUs, uint32_t reportIntervalS) {
+    epoll_event events[256];
+    uint64_t lastReportUs = nowUs();
+    uint64_t lastReportRequests = 0;
+
+    while (running && (untilUs == 0 || nowUs() < untilUs)) {
+        int count = epoll_wait(epollFd, events, 256, 100);
+
+        for (int i = 0; i < count; i++) {
+            auto *endpoint = (Endpoint *) events[i].data.ptr;
+            switch (endpoint->type) {
+                case ENDPOINT_LISTEN:
+                    accept(*(VirtualLight *) endpoint);
+                    break;
+                case ENDPOINT_CONNECTION:
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        close((Connection *) endpoint);
+                    } else if (events[i].events & EPOLLIN) {
+                        read((Connection *) endpoint);
+                    } else {
+                        flush((Connection *) endpoint);
+                    }
+                    break;
+                case ENDPOINT_DISCOVERY:
+                    answerDiscovery();
+                    break;
+            }
+        }
+
+        uint64_t now = nowUs();
+        if (now - lastReportUs >= reportIntervalS * 1000000ULL) {
+            uint64_t total = requests;
+            printf("%.0f requests/s\n", (total - lastReportRequests) * 1e6 / (now - lastReportUs));
+            fflush(stdout);
+            lastReportUs = now;
+            lastReportRequests = total;
+        }
+    }
+}
+
+// built in client: one keep-alive connection per light, alternating GET and PUT /elgato/lights
+static void runLoad(Fleet &fleet, const char *address, size_t first, size_t step, uint64_t untilUs) {
+    struct Client {
+        VirtualLight *light;
+        int fd;
+    };
+    std::vector<Client> clients;
+
+    for (size_t i = first; i < fleet.lights.size(); i += step) {
+        VirtualLight *light = fleet.lights[i].get();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        sockaddr_in server = {};
+        server.sin_family = AF_INET;
+        server.sin_port = htons(light->port);
+        inet_pton(AF_INET, address, &server.sin_addr);
+        if (connect(fd, (sockaddr *) &server, sizeof(server)) != 0) {
+            fprintf(stderr, "Failed to connect to port %u: %s\n", light->port, strerror(errno));
+            ::close(fd);
+            continue;
+        }
+        clients.push_back({light, fd});
+    }
+
+    uint32_t iteration = 0;
+    char request[256];
+    char response[FLEET_RESPONSE_BUFFER_SIZE];
+
+    while (running && nowUs() < untilUs && !clients.empty()) {
+        iteration++;
+        for (Client &client : clients) {
+            int length;
+            if (iteration % 2 == 0) {
+                char body[64];
+                int bodyLength = snprintf(body, sizeof(body), "{\"lights\":[{\"brightness\":%u,\"on\":1}]}",
+                                          iteration % 100);
+                // like the Elgato Control Center, no Content-Type
+                length = snprintf(request, sizeof(request),
+                                  "PUT /elgato/lights HTTP/1.1\r\nContent-Length: %d\r\n\r\n%s", bodyLength, body);
+            } else {
+                length = snprintf(request, sizeof(request), "GET /elgato/lights HTTP/1.1\r\n\r\n");
+            }
+
+            uint64_t start = nowUs();
+            if (::write(client.fd, request, length) != length) {
+                continue;
+            }
+
+            // read until the whole response (headers and Content-Length bytes of body) has arrived
+            size_t received = 0;
+            while (received < sizeof(response) - 1) {
+                ssize_t n = ::read(client.fd, response + received, sizeof(response) - 1 - received);
+                if (n <= 0) {
+                    break;
+                }
+                received += n;
+                response[received] = '\0';
+
+                const char *headersEnd = strstr(response, "\r\n\r\n");
+                const char *contentLength = strstr(response, "Content-Length: ");
+                if (headersEnd != nullptr && contentLength != nullptr
+                    && received >= (size_t) (headersEnd + 4 - response) + strtoul(contentLength + 16, nullptr, 10)) {
+                    break;
+                }
+            }
+            client.light->clientLatency.record(nowUs() - start);
+        }
+    }
+
+    for (Client &client : clients) {
+        ::close(client.fd);
+    }
+}
+
+// browses for the service like a controller would (a one-shot query, RFC 6762 5.1), and returns the number of
+// instances found
+static size_t discover(const char *address, uint16_t discoveryPort) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    timeval timeout = {0, 500000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in responder = {};
+    responder.sin_family = AF_INET;
+    responder.sin_port = htons(discoveryPort);
+    inet_pton(AF_INET, address, &responder.sin_addr);
+
+    uint8_t query[MDNS_PACKET_SIZE];
+    size_t length = writeMdnsHeader(query, sizeof(query), 0x1234, 0, 1, 0, 0);
+    length += writeMdnsQuestion(query + length, sizeof(query) - length, MDNS_SERVICE_TYPE, DNS_TYPE_PTR, false);
+    sendto(fd, query, length, 0, (sockaddr *) &responder, sizeof(responder));
+
+    std::set<std::string> instances;
+    uint8_t answer[FLEET_DISCOVERY_BUFFER_SIZE];
+    ssize_t received;
+    while ((received = recv(fd, answer, sizeof(answer), 0)) > 0) {
+        size_t offset = skipMdnsQuestions(answer, received);
+        uint16_t records = offset > 0 ? (answer[6] << 8 | answer[7]) + (answer[10] << 8 | answer[11]) : 0;
+        MdnsRecord record;
+        for (uint16_t i = 0; i < records && readMdnsRecord(answer, received, offset, record); i++) {
+            if (record.type == DNS_TYPE_PTR && mdnsNameEquals(record.name, MDNS_SERVICE_TYPE)) {
+                instances.insert(record.target);
+            }
+        }
+    }
+    ::close(fd);
+    return instances.size();
+}
+
+// stops the capture of the first light and writes it to `path`, for `replay`
+static void saveCapture(Fleet &fleet, TrafficCapture &capture, const char *path) {
+    if (path == nullptr) {
+        return;
+    }
+
+    capture.stop(fleet.lights[0]->api);
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr || fwrite(capture.data(), 1, capture.size(), file) != capture.size()) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+    } else {
+        printf("Captured %u requests (%u dropped) of %s to %s\n", capture.requestCount(), capture.droppedCount(),
+               fleet.lights[0]->serviceName, path);
+    }
+    if (file != nullptr) {
+        fclose(file);
+    }
+}
+
+static void printLatencyDistribution(const char *name, std::vector<uint64_t> values) {
+    if (values.empty()) {
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    printf("  %-18s min %6lluus  median %6lluus  p90 %6lluus  max %6lluus\n", name,
+           (unsigned long long) values.front(),
+           (unsigned long long) values[values.size() / 2],
+           (unsigned long long) values[values.size() * 9 / 10],
+           (unsigned long long) values.back());
+}
+
+int runFleet(int argc, char **argv) {
+    long count = option(argc, argv, "count", 200L);
+    long firstPort = option(argc, argv, "port", 19123L);
+    const char *bindAddress = option(argc, argv, "bind", "127.0.0.1");
+    long discoveryPort = option(argc, argv, "discovery_port", 5354L);
+    long loadSeconds = option(argc, argv, "load", 0L);
+    long threads = std::max(option(argc, argv, "threads", 4L), 1L);
+    long reportSeconds = std::max(option(argc, argv, "report", 5L), 1L);
+    const char *capturePath = option(argc, argv, "capture", (const char *) nullptr);
+
+    signal(SIGINT, [](int) {
+        running = false;
+    });
+    signal(SIGPIPE, SIG_IGN);
+
+    Fleet fleet;
+    fleet.epollFd = epoll_create1(0);
+
+    size_t heapBefore = heapStats().inUse;
+    for (long i = 0; i < count; i++) {
+        fleet.lights.emplace_back(new VirtualLight(i, firstPort + i));
+    }
+    size_t heapPerLight = (heapStats().inUse - heapBefore) / std::max(count, 1L);
+
+    for (auto &light : fleet.lights) {
+        if (!fleet.listen(*light, bindAddress)) {
+            return 1;
+        }
+    }
+    if (!fleet.listenDiscovery(bindAddress, discoveryPort)) {
+        return 1;
+    }
+
+    printf("%ld lights on %s:%ld-%ld, discovery on udp %s:%ld\n", count, bindAddress, firstPort,
+           firstPort + count - 1, bindAddress, discoveryPort);
+    // the lights are heap allocated, so the delta covers the object itself and whatever its strings allocate
+    printf("Memory per light: %zu bytes (%zu for the object), %zu bytes per open connection\n",
+           heapPerLight, sizeof(VirtualLight), sizeof(Connection));
+    fflush(stdout);
+
+    TrafficCapture capture;
+    if (capturePath != nullptr && count > 0) {
+        fleet.lights[0]->api.capture = &capture;
+        capture.start(fleet.lights[0]->api, CAPTURE_MAX_SIZE);
+    } else {
+        capturePath = nullptr;
+    }
+
+    if (loadSeconds <= 0) {
+        fleet.serve(0, reportSeconds);
+        saveCapture(fleet, capture, capturePath);
+        return 0;
+    }
+
+    // the load runs in its own threads, the event loop stays single threaded like the AsyncTCP task on the device
+    std::thread discovery([&]() {
+        size_t found = discover(strcmp(bindAddress, "0.0.0.0") == 0 ? "127.0.0.1" : bindAddress, discoveryPort);
+        printf("Discovered %zu of %ld lights\n", found, count);
+    });
+
+    uint64_t untilUs = nowUs() + loadSeconds * 1000000ULL;
+    const char *loadAddress = strcmp(bindAddress, "0.0.0.0") == 0 ? "127.0.0.1" : bindAddress;
+    std::vector<std::thread> clients;
+    for (long t = 0; t < threads; t++) {
+        clients.emplace_back(runLoad, std::ref(fleet), loadAddress, t, threads, untilUs);
+    }
+
+    uint64_t start = nowUs();
+    fleet.serve(untilUs + 500000, reportSeconds);
+    double elapsedS = (nowUs() - start) / 1e6;
+
+    discovery.join();
+    for (auto &client : clients) {
+        client.join();
+    }
+    saveCapture(fleet, capture, capturePath);
+
+    LatencyHistogram server;
+    LatencyHistogram client;
+    std::vector<uint64_t> serverP50, serverP99, clientP50, clientP99, perLightRequests;
+    for (auto &light : fleet.lights) {
+        server.add(light->serverLatency);
+        client.add(light->clientLatency);
+        serverP50.push_back(light->serverLatency.percentile(50));
+        serverP99.push_back(light->serverLatency.percentile(99));
+        clientP50.push_back(light->clientLatency.percentile(50));
+        clientP99.push_back(light->clientLatency.percentile(99));
+        perLightRequests.push_back(light->requests);
+    }
+
+    printf("\n%llu requests in %.1fs, %.0f requests/s\n", (unsigned long long) fleet.requests.load(), elapsedS,
+           fleet.requests / elapsedS);
+    printf("Discovery: %llu queries, %llu responses\n", (unsigned long long) fleet.discoveryQueries,
+           (unsigned long long) fleet.discoveryAnswers);
+    printf("Server latency p50 < %lluus, p99 < %lluus\n", (unsigned long long) server.percentile(50),
+           (unsigned long long) server.percentile(99));
+    printf("Client latency p50 < %lluus, p99 < %lluus\n", (unsigned long long) client.percentile(50),
+           (unsigned long long) client.percentile(99));
+    printf("Distribution across lights:\n");
+    printLatencyDistribution("server p50", serverP50);
+    printLatencyDistribution("server p99", serverP99);
+    printLatencyDistribution("client p50", clientP50);
+    printLatencyDistribution("client p99", clientP99);
+    printf("  %-18s min %6llu  median %6llu  max %6llu\n", "requests",
+           (unsigned long long) *std::min_element(perLightRequests.begin(), perLightRequests.end()),
+           (unsigned long long) perLightRequests[perLightRequests.size() / 2],
+           (unsigned long long) *std::max_element(perLightRequests.begin(), perLightRequests.end()));
+    return 0;
+}
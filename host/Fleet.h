@@ -0,0 +1,18 @@
+#ifndef ESP32_LIGHT_FLEET_H
+#define ESP32_LIGHT_FLEET_H
+
+/*
+ * Runs many virtual fake lights in one process, each with its own `ElgatoApi` state, HTTP port and mDNS responder.
+ * The responders answer on `-discovery_port` (not 5353, which the host's own responder usually has) as they would a
+ * one-shot query, e.g. `dig -p 5354 @127.0.0.1 _elg._tcp.local PTR`.
+ *
+ *   fleet [-count 200] [-port 19123] [-bind 127.0.0.1] [-discovery_port 5354] [-load <seconds>] [-threads 4]
+ *         [-capture <file>]
+ *
+ * Without `-load` the fleet serves until interrupted, e.g. for a controller under test.  With `-load` a built in
+ * client drives every light over keep-alive connections and the latency per light is reported at the end.  With
+ * `-capture` the requests to the first light are recorded for `replay`.
+ */
+int runFleet(int argc, char **argv);
+
+#endif //ESP32_LIGHT_FLEET_H
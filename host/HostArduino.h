@@ -0,0 +1,25 @@
+#ifndef ESP32_LIGHT_HOSTARDUINO_H
+#define ESP32_LIGHT_HOSTARDUINO_H
+
+/*
+ * Force included into the host build (see [env:native] in platformio.ini), stands in for the parts of the Arduino core
+ * the shared sources in src/ use.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+
+typedef std::string String;
+
+inline unsigned long micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned long millis() {
+    return micros() / 1000;
+}
+
+#endif //ESP32_LIGHT_HOSTARDUINO_H
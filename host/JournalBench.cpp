@@ -0,0 +1,237 @@
+#include "JournalBench.h"
+#include "EmulatedFlash.h"
+#include "LatencyHistogram.h"
+#include "NvsModel.h"
+#include "Options.h"
+#include "StateJournal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+
+struct WriteStats {
+    LatencyHistogram histogram;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+
+    void record(uint64_t ns) {
+        histogram.record(ns / 1000);
+        totalNs += ns;
+        maxNs = std::max(maxNs, ns);
+    }
+};
+
+// a slider drag, now and then switching on or off or changing the temperature
+static void nextState(std::mt19937 &random, JournalLight &light, uint32_t save) {
+    light.brightness = random() % 101;
+    if (save % 25 == 0) {
+        light.on = !light.on;
+        light.switchCycles++;
+    }
+    if (save % 50 == 0) {
+        light.temperature = 143 + random() % 113;
+    }
+    if (light.on) {
+        light.onSeconds += random() % 600;
+    }
+}
+
+static bool sameLights(StateJournal &journal, const JournalRecord &expected, uint8_t lightCount) {
+    for (uint8_t i = 0; i < lightCount; i++) {
+        const JournalLight *light = journal.getLight(i);
+        const JournalLight &want = expected.lights[i];
+        if ((want.flags & JOURNAL_LIGHT_VALID) == 0) {
+            if (light != nullptr) {
+                return false;
+            }
+            continue;
+        }
+        if (light == nullptr || memcmp(light, &want, sizeof(want)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void printRow(const char *label, const WriteStats &writes, uint32_t saves, const EmulatedFlash &flash,
+                     uint64_t bootNs, uint64_t bootReads, long perDay) {
+    printf("%-8s %8.1f %7llu %7llu %9.1f %9llu %8u %8llu %9.2f ", label,
+           saves > 0 ? writes.totalNs / 1000.0 / saves : 0.0,
+           (unsigned long long) writes.histogram.percentile(50), (unsigned long long) writes.histogram.percentile(99),
+           writes.maxNs / 1000000.0, (unsigned long long) flash.getErases(), flash.getMaxSectorErases(),
+           (unsigned long long) bootReads, bootNs / 1000000.0);
+    if (flash.getMaxSectorErases() == 0 || perDay <= 0) {
+        printf("%10s\n", "-");
+        return;
+    }
+    double savesPerCycle = (double) saves / flash.getMaxSectorErases();
+    printf("%10.1f\n", FLASH_ENDURANCE_CYCLES * savesPerCycle / perDay / 365);
+}
+
+// power cuts at random points of the commits and erases, returns the recoveries that lost committed state
+static uint32_t powerCuts(long cuts, uint8_t lightCount, uint32_t sectors, uint32_t seed) {
+    EmulatedFlash flash((size_t) sectors * FLASH_SECTOR_SIZE, seed);
+    std::mt19937 random(seed);
+    StateJournal journal;
+    journal.begin(flash);
+
+    JournalRecord acknowledged = {};
+    uint32_t save = 0;
+    uint32_t failures = 0;
+    uint32_t skipped = 0;
+    for (long cut = 0; cut < cuts; cut++) {
+        flash.cutPowerAfter(random() % 300);
+
+        // the record being written when the power went
+        JournalRecord pending = {};
+        bool hasPending = false;
+        while (!flash.isPoweredOff()) {
+            JournalLight light = journal.getLight(save % lightCount) != nullptr
+                    ? *journal.getLight(save % lightCount) : JournalLight{};
+            nextState(random, light, save);
+            journal.setLight(save % lightCount, light);
+
+            pending = acknowledged;
+            pending.sequence = journal.getSequence() + 1;
+            pending.lights[save % lightCount] = light;
+            pending.lights[save % lightCount].flags |= JOURNAL_LIGHT_VALID;
+            save++;
+
+            if (!journal.commit()) {
+                hasPending = true;
+                break;
+            }
+            acknowledged = pending;
+            // idle between saves, the power can go while erasing too
+            journal.prepare();
+        }
+
+        flash.powerOn();
+        journal.begin(flash);
+        skipped += journal.getStats().recoverySkipped;
+
+        if (journal.getSequence() == acknowledged.sequence && sameLights(journal, acknowledged, lightCount)) {
+            continue;
+        }
+        if (hasPending && journal.getSequence() == pending.sequence && sameLights(journal, pending, lightCount)) {
+            // the torn write was complete after all
+            acknowledged = pending;
+            continue;
+        }
+        failures++;
+        printf("power cut %ld: recovered record %u, the last committed one is %u\n", cut, journal.getSequence(),
+               acknowledged.sequence);
+        // carry on from what was recovered
+        for (uint8_t i = 0; i < lightCount; i++) {
+            const JournalLight *light = journal.getLight(i);
+            acknowledged.lights[i] = light != nullptr ? *light : JournalLight{};
+        }
+        acknowledged.sequence = journal.getSequence();
+    }
+
+    printf("%ld power cuts during %u saves, %u torn records skipped, %u recoveries lost committed state\n", cuts, save,
+           skipped, failures);
+    return failures;
+}
+
+int runJournalBench(int argc, char **argv) {
+    long saves = std::max(option(argc, argv, "saves", 100000L), 1L);
+    long lightCount = std::min(std::max(option(argc, argv, "lights", 1L), 1L), (long) JOURNAL_LIGHTS);
+    long sectors = std::max(option(argc, argv, "sectors", 16L), (long) JOURNAL_MIN_SECTORS);
+    long nvsPages = std::max(option(argc, argv, "nvs_pages", 5L), 3L);
+    long nvsKeys = option(argc, argv, "nvs_keys", 24L);
+    long perDay = option(argc, argv, "per_day", 500L);
+    long cuts = option(argc, argv, "power_cuts", 2000L);
+    uint32_t seed = option(argc, argv, "seed", 1L);
+
+    printf("%ld saves of %ld light(s): journal of %ld sectors (%ld KB), NVS of %ld pages (%ld KB) with %ld other keys\n",
+           saves, lightCount, sectors, sectors * FLASH_SECTOR_SIZE / 1024, nvsPages,
+           nvsPages * FLASH_SECTOR_SIZE / 1024, nvsKeys);
+    printf("simulated flash timings, write latencies in us (p50/p99 are log2 bucket bounds), lifetime at %ld saves a day\n\n",
+           perDay);
+
+    EmulatedFlash journalFlash((size_t) sectors * FLASH_SECTOR_SIZE, seed);
+    EmulatedFlash nvsFlash((size_t) nvsPages * FLASH_SECTOR_SIZE, seed);
+
+    StateJournal journal;
+    journal.begin(journalFlash);
+    // the first sector is erased while idle after booting
+    journal.prepare();
+    NvsModel nvs(nvsFlash);
+    nvs.format();
+    nvs.begin();
+    // the accessory info, WiFi and MQTT settings and such, garbage collection has to move them
+    for (long i = 0; i < nvsKeys; i++) {
+        nvs.setU8(1, ("key-" + std::to_string(i)).c_str(), 0);
+    }
+    uint64_t nvsSetupErases = nvsFlash.getErases();
+
+    std::mt19937 random(seed);
+    JournalLight lights[JOURNAL_LIGHTS] = {};
+    WriteStats journalWrites;
+    WriteStats nvsWrites;
+    uint64_t prepareNs = 0;
+    uint32_t prepares = 0;
+    for (uint32_t save = 0; save < (uint32_t) saves; save++) {
+        uint8_t index = save % lightCount;
+        JournalLight &light = lights[index];
+        nextState(random, light, save);
+
+        uint64_t start = journalFlash.getElapsedNs();
+        journal.setLight(index, light);
+        journal.commit();
+        journalWrites.record(journalFlash.getElapsedNs() - start);
+
+        // housekeeping erases the next sector while idle
+        start = journalFlash.getElapsedNs();
+        if (journal.prepare()) {
+            prepares++;
+        }
+        prepareNs += journalFlash.getElapsedNs() - start;
+
+        // LightInstance::writeSettings() before the journal, one namespace per light
+        start = nvsFlash.getElapsedNs();
+        nvs.setU8(2 + index, "light-0-on", light.on);
+        nvs.setU8(2 + index, "light-0-temp", light.temperature);
+        nvs.setU8(2 + index, "light-0-bright", light.brightness);
+        nvsWrites.record(nvsFlash.getElapsedNs() - start);
+    }
+
+    // boot: find the newest record / load every page
+    StateJournal recovered;
+    uint64_t start = journalFlash.getElapsedNs();
+    recovered.begin(journalFlash);
+    uint64_t journalBootNs = journalFlash.getElapsedNs() - start;
+    start = nvsFlash.getElapsedNs();
+    uint64_t nvsReads = nvsFlash.getReads();
+    nvs.begin();
+    uint64_t nvsBootNs = nvsFlash.getElapsedNs() - start;
+    nvsReads = nvsFlash.getReads() - nvsReads;
+
+    printf("%-8s %8s %7s %7s %9s %9s %8s %8s %9s %10s\n", "", "mean us", "p50", "p99", "max ms", "erases", "/sector",
+           "boot rd", "boot ms", "years");
+    printRow("journal", journalWrites, saves, journalFlash, journalBootNs, recovered.getStats().recoveryReads, perDay);
+    printRow("nvs", nvsWrites, saves, nvsFlash, nvsBootNs, nvsReads, perDay);
+    printf("\njournal: %u erases ahead of time by prepare() (%.1f ms each), %u inline, %u erase cycles per sector\n",
+           prepares, prepares > 0 ? prepareNs / 1000000.0 / prepares : 0.0, journal.getStats().inlineErases,
+           recovered.getEraseCycles());
+    printf("nvs: %llu garbage collections, %llu erases before the saves\n\n",
+           (unsigned long long) nvs.getGarbageCollections(), (unsigned long long) nvsSetupErases);
+
+    JournalRecord expected = {};
+    expected.sequence = journal.getSequence();
+    for (uint8_t i = 0; i < lightCount; i++) {
+        expected.lights[i] = lights[i];
+        expected.lights[i].flags |= JOURNAL_LIGHT_VALID;
+    }
+    bool recoveredLast = recovered.getSequence() == expected.sequence && sameLights(recovered, expected, lightCount);
+    if (!recoveredLast) {
+        printf("recovery found record %u instead of %u\n", recovered.getSequence(), expected.sequence);
+    }
+
+    uint32_t failures = cuts > 0 ? powerCuts(cuts, lightCount, sectors, seed) : 0;
+    return recoveredLast && failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+#ifndef ESP32_LIGHT_JOURNALBENCH_H
+#define ESP32_LIGHT_JOURNALBENCH_H
+
+/*
+ * Compares the state journal (StateJournal) with how the light state used to be saved to NVS (three putUChar per
+ * save, see NvsModel) on an emulated flash with datasheet timings: write latency, boot recovery time and flash wear,
+ * projected to a lifetime at `-per_day` saves a day.  Then cuts the power at random points of the journal's writes and
+ * erases and checks every recovery finds the last committed (or the torn, if it completed) record.
+ *
+ *   journal-bench [-saves 100000] [-lights 1] [-sectors 16] [-nvs_pages 5] [-nvs_keys 24] [-per_day 500]
+ *                 [-power_cuts 2000] [-seed 1]
+ *
+ * Returns non zero when a recovery loses committed state.
+ */
+int runJournalBench(int argc, char **argv);
+
+#endif //ESP32_LIGHT_JOURNALBENCH_H
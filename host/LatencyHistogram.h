@@ -0,0 +1,43 @@
+#ifndef ESP32_LIGHT_LATENCYHISTOGRAM_H
+#define ESP32_LIGHT_LATENCYHISTOGRAM_H
+
+#include <stdint.h>
+
+#define LATENCY_BUCKETS 24
+
+// log2 latency histogram, bucket n counts latencies below 2^(n+1) microseconds
+struct LatencyHistogram {
+    uint64_t buckets[LATENCY_BUCKETS] = {};
+    uint64_t count = 0;
+
+    void record(uint64_t us) {
+        uint8_t bucket = 0;
+        while (bucket < LATENCY_BUCKETS - 1 && (us >> (bucket + 1)) > 0) {
+            bucket++;
+        }
+        buckets[bucket]++;
+        count++;
+    }
+
+    void add(const LatencyHistogram &other) {
+        for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+    }
+
+    // upper bound of the bucket holding the percentile, 0 without samples
+    uint64_t percentile(uint8_t percentile) const {
+        uint64_t target = (count * percentile + 99) / 100;
+        uint64_t seen = 0;
+        for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= target && seen > 0) {
+                return 1ULL << (i + 1);
+            }
+        }
+        return 0;
+    }
+};
+
+#endif //ESP32_LIGHT_LATENCYHISTOGRAM_H
@@ -0,0 +1,473 @@
+#include "MdnsStorm.h"
+#include "MdnsResponder.h"
+#include "Options.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define STORM_STEP_MS 10
+// RFC 6762 5.2, browsing starts at a second and backs off to an hour
+#define STORM_FIRST_INTERVAL_MS 1000
+#define STORM_MAX_INTERVAL_MS 3600000
+// a record is refreshed once 80% of its TTL is gone (RFC 6762 5.2), resolving is retried after a second
+#define STORM_REFRESH_PERCENT 20
+#define STORM_RESOLVE_RETRY_MS 1000
+// how often the cache is looked at for what needs resolving
+#define STORM_RESOLVE_PERIOD_MS 100
+// the Control Centers start within this long of each other
+#define STORM_START_SPREAD_MS 5000
+
+enum NodeType {
+    NODE_RESPONDER,
+    NODE_CONTROLLER,
+    NODE_STORM
+};
+
+struct CachedRecord {
+    uint16_t type;
+    std::string target;
+    uint16_t port;
+    uint32_t address;
+    uint32_t ttl;
+    uint64_t expiresMs;
+};
+
+struct Node {
+    NodeType type;
+    uint32_t address;
+    std::unique_ptr<MdnsResponder> responder;
+
+    // controllers: the records heard since starting, see cacheKey()
+    uint64_t startMs = 0;
+    std::map<std::string, CachedRecord> cache;
+    uint64_t nextQueryMs = 0;
+    uint32_t queryIntervalMs = 0;
+    // when an instance was last resolved
+    std::map<std::string, uint64_t> resolvingMs;
+};
+
+struct Datagram {
+    uint64_t atMs;
+    size_t from;
+    // a node, or -1 for the group
+    long to;
+    std::vector<uint8_t> data;
+};
+
+struct SegmentStats {
+    uint64_t queries = 0;
+    uint64_t responses = 0;
+    uint64_t unicast = 0;
+    uint64_t bytes = 0;
+    // received by the responders, every one wakes the radio
+    uint64_t responderReceived = 0;
+    uint64_t malformed = 0;
+    // browse queries with more known answers than fit
+    uint64_t truncated = 0;
+};
+
+// multicast reaches every node but the sender after a millisecond, unicast only the one it is for
+struct Segment {
+    std::vector<Node> nodes;
+    std::deque<Datagram> inFlight;
+    uint64_t nowMs = 0;
+    uint32_t stormIntervalMs = 0;
+    SegmentStats stats;
+    MdnsQuery query;
+
+    void send(size_t from, long to, const uint8_t *data, size_t length);
+    void deliver(const Datagram &datagram);
+    void receive(size_t node, size_t from, const std::vector<uint8_t> &data);
+    void cacheResponse(Node &node, const uint8_t *packet, size_t length);
+    void browse(size_t node, bool knownAnswers, bool unicastResponse);
+    void resolve(size_t node);
+    void tick(size_t node);
+};
+
+static std::string lowerCase(const char *name) {
+    std::string lower(name);
+    for (char &c : lower) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 32;
+        }
+    }
+    return lower;
+}
+
+// records by name and type, and shared (PTR) records by their target too, a unique record replaces the cached one
+static std::string cacheKey(uint16_t type, const char *name, const char *target) {
+    std::string key = lowerCase(name) + "|" + std::to_string(type);
+    if (type == DNS_TYPE_PTR) {
+        key += "|" + lowerCase(target);
+    }
+    return key;
+}
+
+static bool isFresh(const CachedRecord *record, uint64_t nowMs) {
+    return record != nullptr && record->expiresMs > nowMs
+           && (record->expiresMs - nowMs) * 100 > record->ttl * 1000ULL * STORM_REFRESH_PERCENT;
+}
+
+static const CachedRecord *find(const Node &node, uint16_t type, const char *name) {
+    auto entry = node.cache.find(cacheKey(type, name, ""));
+    return entry != node.cache.end() ? &entry->second : nullptr;
+}
+
+// a PTR known answer compressed like a querier would: the name and the end of the target point to the question
+static size_t writeKnownPtr(uint8_t *out, size_t capacity, const char *target, uint32_t ttl) {
+    uint8_t name[MDNS_NAME_LENGTH * 2];
+    if (writeMdnsName(name, sizeof(name), target) == 0) {
+        return 0;
+    }
+    size_t labelLength = 1 + name[0];
+    size_t length = 2 + 10 + labelLength + 2;
+    if (length > capacity) {
+        return 0;
+    }
+
+    uint8_t *at = out;
+    *at++ = 0xC0;
+    *at++ = MDNS_HEADER_SIZE;
+    *at++ = 0;
+    *at++ = DNS_TYPE_PTR;
+    *at++ = 0;
+    *at++ = DNS_CLASS_IN;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        *at++ = (ttl >> shift) & 0xFF;
+    }
+    *at++ = 0;
+    *at++ = labelLength + 2;
+    memcpy(at, name, labelLength);
+    at += labelLength;
+    *at++ = 0xC0;
+    *at++ = MDNS_HEADER_SIZE;
+    return length;
+}
+
+void Segment::send(size_t from, long to, const uint8_t *data, size_t length) {
+    bool response = (data[2] & (DNS_FLAG_RESPONSE >> 8)) != 0;
+    (response ? stats.responses : stats.queries)++;
+    if (to >= 0) {
+        stats.unicast++;
+    }
+    stats.bytes += length;
+    inFlight.push_back({nowMs + 1, from, to, std::vector<uint8_t>(data, data + length)});
+}
+
+void Segment::deliver(const Datagram &datagram) {
+    if (datagram.to >= 0) {
+        receive(datagram.to, datagram.from, datagram.data);
+        return;
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (i != datagram.from) {
+            receive(i, datagram.from, datagram.data);
+        }
+    }
+}
+
+void Segment::receive(size_t index, size_t from, const std::vector<uint8_t> &data) {
+    Node &node = nodes[index];
+    if (node.type == NODE_RESPONDER) {
+        stats.responderReceived++;
+        MdnsParseResult result = parseMdnsQuery(data.data(), data.size(), query);
+        if (result == MDNS_PARSE_ERROR) {
+            stats.malformed++;
+        }
+        if (result != MDNS_PARSE_QUERY) {
+            return;
+        }
+
+        uint8_t response[MDNS_PACKET_SIZE];
+        bool unicast;
+        size_t length = node.responder->respond(query, false, (uint32_t) nowMs, response, sizeof(response), unicast);
+        if (length > 0) {
+            send(index, unicast ? (long) from : -1, response, length);
+        }
+    } else if (node.type == NODE_CONTROLLER && nowMs >= node.startMs && data.size() >= MDNS_HEADER_SIZE
+               && (data[2] & (DNS_FLAG_RESPONSE >> 8)) != 0) {
+        cacheResponse(node, data.data(), data.size());
+    }
+}
+
+void Segment::cacheResponse(Node &node, const uint8_t *packet, size_t length) {
+    size_t offset = skipMdnsQuestions(packet, length);
+    if (offset == 0) {
+        stats.malformed++;
+        return;
+    }
+    uint32_t records = (packet[6] << 8 | packet[7]) + (packet[8] << 8 | packet[9]) + (packet[10] << 8 | packet[11]);
+
+    MdnsRecord record;
+    for (uint32_t i = 0; i < records; i++) {
+        if (!readMdnsRecord(packet, length, offset, record)) {
+            stats.malformed++;
+            return;
+        }
+        if (record.type != DNS_TYPE_PTR && record.type != DNS_TYPE_SRV && record.type != DNS_TYPE_TXT
+            && record.type != DNS_TYPE_A) {
+            continue;
+        }
+        std::string key = cacheKey(record.type, record.name, record.target);
+        // a goodbye (RFC 6762 10.1)
+        if (record.ttl == 0) {
+            node.cache.erase(key);
+            continue;
+        }
+        node.cache[key] = {record.type, record.target, record.port, record.address, record.ttl,
+                           nowMs + record.ttl * 1000ULL};
+    }
+}
+
+void Segment::browse(size_t index, bool knownAnswers, bool unicastResponse) {
+    Node &node = nodes[index];
+    uint8_t packet[MDNS_PACKET_SIZE];
+    size_t length = MDNS_HEADER_SIZE;
+    length += writeMdnsQuestion(packet + length, sizeof(packet) - length, MDNS_SERVICE_TYPE, DNS_TYPE_PTR,
+                                unicastResponse);
+
+    uint16_t answers = 0;
+    bool truncated = false;
+    std::string prefix = cacheKey(DNS_TYPE_PTR, MDNS_SERVICE_TYPE, "");
+    for (auto entry = node.cache.lower_bound(prefix); knownAnswers && entry != node.cache.end()
+                                                      && entry->first.compare(0, prefix.size(), prefix) == 0; ++entry) {
+        const CachedRecord &record = entry->second;
+        uint32_t remaining = (record.expiresMs - nowMs) / 1000;
+        // RFC 6762 7.1, only the ones with at least half their TTL left
+        if (remaining * 2 < record.ttl) {
+            continue;
+        }
+        size_t written = writeKnownPtr(packet + length, sizeof(packet) - length, record.target.c_str(), remaining);
+        if (written == 0) {
+            truncated = true;
+            break;
+        }
+        length += written;
+        answers++;
+    }
+    if (truncated) {
+        stats.truncated++;
+    }
+    writeMdnsHeader(packet, sizeof(packet), 0, truncated ? DNS_FLAG_TRUNCATED : 0, 1, answers, 0);
+    send(index, -1, packet, length);
+}
+
+// asks for the SRV and TXT of every instance found, and the address of its host, when missing or about to expire
+void Segment::resolve(size_t index) {
+    Node &node = nodes[index];
+    std::string prefix = cacheKey(DNS_TYPE_PTR, MDNS_SERVICE_TYPE, "");
+    for (auto entry = node.cache.lower_bound(prefix);
+         entry != node.cache.end() && entry->first.compare(0, prefix.size(), prefix) == 0; ++entry) {
+        const char *instance = entry->second.target.c_str();
+        const CachedRecord *srv = find(node, DNS_TYPE_SRV, instance);
+        bool needSrv = !isFresh(srv, nowMs);
+        bool needTxt = !isFresh(find(node, DNS_TYPE_TXT, instance), nowMs);
+        bool needA = srv != nullptr && !isFresh(find(node, DNS_TYPE_A, srv->target.c_str()), nowMs);
+        if (!needSrv && !needTxt && !needA) {
+            continue;
+        }
+        auto resolving = node.resolvingMs.find(instance);
+        if (resolving != node.resolvingMs.end() && nowMs - resolving->second < STORM_RESOLVE_RETRY_MS) {
+            continue;
+        }
+        node.resolvingMs[instance] = nowMs;
+
+        uint8_t packet[MDNS_PACKET_SIZE];
+        size_t length = MDNS_HEADER_SIZE;
+        uint16_t questions = 0;
+        if (needSrv) {
+            length += writeMdnsQuestion(packet + length, sizeof(packet) - length, instance, DNS_TYPE_SRV, false);
+            questions++;
+        }
+        if (needTxt) {
+            length += writeMdnsQuestion(packet + length, sizeof(packet) - length, instance, DNS_TYPE_TXT, false);
+            questions++;
+        }
+        if (needA) {
+            length += writeMdnsQuestion(packet + length, sizeof(packet) - length, srv->target.c_str(), DNS_TYPE_A,
+                                        false);
+            questions++;
+        }
+        writeMdnsHeader(packet, sizeof(packet), 0, 0, questions, 0, 0);
+        send(index, -1, packet, length);
+    }
+}
+
+void Segment::tick(size_t index) {
+    Node &node = nodes[index];
+    if (node.type == NODE_RESPONDER) {
+        uint8_t packet[MDNS_PACKET_SIZE];
+        size_t length = node.responder->announce((uint32_t) nowMs, packet, sizeof(packet));
+        if (length > 0) {
+            send(index, -1, packet, length);
+        }
+        return;
+    }
+    if (nowMs < node.nextQueryMs) {
+        if (node.type == NODE_CONTROLLER && nowMs % STORM_RESOLVE_PERIOD_MS == 0) {
+            resolve(index);
+        }
+        return;
+    }
+
+    if (node.type == NODE_STORM) {
+        browse(index, false, false);
+        node.nextQueryMs += stormIntervalMs;
+        return;
+    }
+
+    for (auto entry = node.cache.begin(); entry != node.cache.end();) {
+        entry = entry->second.expiresMs <= nowMs ? node.cache.erase(entry) : std::next(entry);
+    }
+    // the first query asks for unicast responses (RFC 6762 5.4)
+    browse(index, true, node.queryIntervalMs == 0);
+    node.queryIntervalMs = node.queryIntervalMs == 0
+            ? STORM_FIRST_INTERVAL_MS : std::min(node.queryIntervalMs * 2, (uint32_t) STORM_MAX_INTERVAL_MS);
+    node.nextQueryMs = nowMs + node.queryIntervalMs;
+}
+
+static void lightName(char *out, size_t size, size_t responder, uint8_t light, bool renamed) {
+    snprintf(out, size, "Elgato Key Light Air %04zu-%u%s", responder, light, renamed ? " (renamed)" : "");
+}
+
+int runMdnsStorm(int argc, char **argv) {
+    long responderCount = std::max(option(argc, argv, "responders", 10L), 1L);
+    long lightCount = std::min(std::max(option(argc, argv, "lights", 2L), 1L), (long) MDNS_MAX_SERVICES);
+    long controllerCount = option(argc, argv, "controllers", 20L);
+    long stormCount = option(argc, argv, "storms", 2L);
+    long stormIntervalMs = std::max(option(argc, argv, "storm_interval", 250L), (long) STORM_STEP_MS);
+    long seconds = std::max(option(argc, argv, "seconds", 600L), 1L);
+    long renameAt = option(argc, argv, "rename_at", seconds / 2);
+    uint32_t seed = option(argc, argv, "seed", 1L);
+
+    std::mt19937 random(seed);
+    Segment segment;
+    segment.stormIntervalMs = stormIntervalMs;
+
+    for (long i = 0; i < responderCount + controllerCount + stormCount; i++) {
+        Node node;
+        node.address = (10u << 24) | (uint32_t) (i + 1);
+        if (i < responderCount) {
+            node.type = NODE_RESPONDER;
+            node.responder.reset(new MdnsResponder());
+            char host[32];
+            snprintf(host, sizeof(host), "elgato-%04ld", i);
+            node.responder->setHost(host, node.address);
+            for (uint8_t light = 0; light < lightCount; light++) {
+                char name[64];
+                char deviceId[18];
+                lightName(name, sizeof(name), i, light, false);
+                snprintf(deviceId, sizeof(deviceId), "3C:6A:9D:%02lX:%02lX:%02X", (i >> 8) & 0xFF, i & 0xFF, light);
+                node.responder->setService(light, name, deviceId, 9123 + 2 * light);
+            }
+        } else if (i < responderCount + controllerCount) {
+            node.type = NODE_CONTROLLER;
+            // the first query 20-120 ms after starting (RFC 6762 5.2)
+            node.startMs = random() % STORM_START_SPREAD_MS;
+            node.nextQueryMs = node.startMs + 20 + random() % 100;
+        } else {
+            node.type = NODE_STORM;
+            node.nextQueryMs = random() % stormIntervalMs;
+        }
+        segment.nodes.push_back(std::move(node));
+    }
+
+    printf("%ld responders with %ld lights, %ld controllers, %ld storm queriers every %ld ms, %ld s simulated\n\n",
+           responderCount, lightCount, controllerCount, stormCount, stormIntervalMs, seconds);
+
+    uint64_t durationMs = seconds * 1000ULL;
+    for (segment.nowMs = 0; segment.nowMs <= durationMs; segment.nowMs += STORM_STEP_MS) {
+        if (renameAt > 0 && segment.nowMs == renameAt * 1000ULL) {
+            // like `mdns -service_name`, the controllers should drop the old name with the goodbye
+            char name[64];
+            lightName(name, sizeof(name), 0, 0, true);
+            segment.nodes[0].responder->setService(0, name, "3C:6A:9D:00:00:00", 9123);
+        }
+        while (!segment.inFlight.empty() && segment.inFlight.front().atMs <= segment.nowMs) {
+            Datagram datagram = std::move(segment.inFlight.front());
+            segment.inFlight.pop_front();
+            segment.deliver(datagram);
+        }
+        for (size_t i = 0; i < segment.nodes.size(); i++) {
+            segment.tick(i);
+        }
+    }
+
+    MdnsStats total;
+    for (long i = 0; i < responderCount; i++) {
+        const MdnsStats &stats = segment.nodes[i].responder->getStats();
+        total.queries += stats.queries;
+        total.notForUs += stats.notForUs;
+        total.answers += stats.answers;
+        total.records += stats.records;
+        total.announcements += stats.announcements;
+        total.suppressedKnown += stats.suppressedKnown;
+        total.suppressedRateLimit += stats.suppressedRateLimit;
+        total.rebuilds += stats.rebuilds;
+    }
+
+    // every controller should have every light resolved, and not the renamed one
+    long complete = 0;
+    uint64_t missing = 0;
+    uint64_t stale = 0;
+    for (long c = responderCount; c < responderCount + controllerCount; c++) {
+        Node &controller = segment.nodes[c];
+        uint64_t found = 0;
+        for (long r = 0; r < responderCount; r++) {
+            MdnsResponder &responder = *segment.nodes[r].responder;
+            for (uint8_t light = 0; light < lightCount; light++) {
+                const char *name = responder.getServiceName(light);
+                const CachedRecord *srv = find(controller, DNS_TYPE_SRV, name);
+                const CachedRecord *a = srv != nullptr ? find(controller, DNS_TYPE_A, srv->target.c_str()) : nullptr;
+                bool resolved = controller.cache.count(cacheKey(DNS_TYPE_PTR, MDNS_SERVICE_TYPE, name)) > 0
+                                && srv != nullptr && srv->port == 9123 + 2 * light
+                                && find(controller, DNS_TYPE_TXT, name) != nullptr
+                                && a != nullptr && a->address == segment.nodes[r].address;
+                if (resolved) {
+                    found++;
+                } else {
+                    missing++;
+                }
+            }
+        }
+        uint64_t instances = 0;
+        std::string prefix = cacheKey(DNS_TYPE_PTR, MDNS_SERVICE_TYPE, "");
+        for (auto entry = controller.cache.lower_bound(prefix);
+             entry != controller.cache.end() && entry->first.compare(0, prefix.size(), prefix) == 0; ++entry) {
+            instances++;
+        }
+        stale += instances - found;
+        if (found == (uint64_t) (responderCount * lightCount) && instances == found) {
+            complete++;
+        }
+    }
+
+    double elapsedS = durationMs / 1000.0;
+    printf("segment: %llu queries, %llu responses (%llu unicast), %.1f messages/s, %.1f KB/s\n",
+           (unsigned long long) segment.stats.queries, (unsigned long long) segment.stats.responses,
+           (unsigned long long) segment.stats.unicast, (segment.stats.queries + segment.stats.responses) / elapsedS,
+           segment.stats.bytes / 1024.0 / elapsedS);
+    printf("responders: %llu queries seen (%llu not for us), %llu responses with %llu records (%llu announcements)\n",
+           (unsigned long long) total.queries, (unsigned long long) total.notForUs, (unsigned long long) total.answers,
+           (unsigned long long) total.records, (unsigned long long) total.announcements);
+    printf("suppressed answers: %llu known to the querier, %llu multicast less than %u ms before\n",
+           (unsigned long long) total.suppressedKnown, (unsigned long long) total.suppressedRateLimit,
+           MDNS_MULTICAST_INTERVAL_MS);
+    printf("per responder: %.1f messages received/s, %.2f responses sent/s, records rebuilt %llu times\n",
+           segment.stats.responderReceived / (double) responderCount / elapsedS,
+           total.answers / (double) responderCount / elapsedS, (unsigned long long) total.rebuilds);
+    printf("%llu browse queries had more known answers than fit, %llu malformed messages\n",
+           (unsigned long long) segment.stats.truncated, (unsigned long long) segment.stats.malformed);
+    printf("controllers: %ld of %ld resolved every light, %llu missing, %llu stale instances\n", complete,
+           controllerCount, (unsigned long long) missing, (unsigned long long) stale);
+
+    return complete == controllerCount ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#ifndef ESP32_LIGHT_MDNSSTORM_H
+#define ESP32_LIGHT_MDNSSTORM_H
+
+/*
+ * A busy network segment for the mDNS responder (MdnsResponder), in simulated time: `-responders` devices with
+ * `-lights` lights each, `-controllers` Control Centers browsing for `_elg._tcp` on the RFC 6762 5.2 schedule with the
+ * instances they know as known answers and resolving what they find, and `-storms` misbehaving queriers browsing every
+ * `-storm_interval` ms without known answers.  Every multicast message is delivered to every node.  Halfway through
+ * (`-rename_at`, 0 never) the first light is renamed, like with the `mdns` command.
+ *
+ *   mdns-storm [-responders 10] [-lights 2] [-controllers 20] [-storms 2] [-storm_interval 250] [-seconds 600]
+ *              [-rename_at <seconds / 2>] [-seed 1]
+ *
+ * Prints the traffic on the segment and the responders' counters, returns non zero when a controller did not resolve
+ * every light or still lists the renamed one.
+ */
+int runMdnsStorm(int argc, char **argv);
+
+#endif //ESP32_LIGHT_MDNSSTORM_H
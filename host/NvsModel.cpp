@@ -0,0 +1,193 @@
+#include "NvsModel.h"
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// page states, bits are only ever cleared
+#define NVS_PAGE_EMPTY 0xFFFFFFFFu
+#define NVS_PAGE_ACTIVE 0xFFFFFFFEu
+#define NVS_PAGE_FULL 0xFFFFFFFCu
+#define NVS_PAGE_FREEING 0xFFFFFFF8u
+
+// entry states, 2 bits each in the bitmap
+#define NVS_ENTRY_EMPTY 3
+#define NVS_ENTRY_WRITTEN 2
+#define NVS_ENTRY_ERASED 0
+
+#define NVS_ENTRIES_OFFSET (NVS_PAGE_HEADER_SIZE + NVS_BITMAP_SIZE)
+#define NVS_KEY_OFFSET 8
+#define NVS_KEY_SIZE 16
+#define NVS_DATA_OFFSET 24
+
+NvsModel::NvsModel(FlashBackend &flash) : flash(flash), pageCount(flash.size() / FLASH_SECTOR_SIZE) {
+}
+
+void NvsModel::format() {
+    for (uint32_t page = 0; page < pageCount; page++) {
+        flash.eraseSector(page * FLASH_SECTOR_SIZE);
+    }
+}
+
+void NvsModel::begin() {
+    index.clear();
+    usedPages.clear();
+    freePages.clear();
+    hasActivePage = false;
+    nextEntry = 0;
+    sequence = 0;
+
+    std::vector<std::pair<uint32_t, uint32_t>> filled;
+    std::vector<uint8_t> page(FLASH_SECTOR_SIZE);
+    for (uint32_t i = 0; i < pageCount; i++) {
+        uint32_t offset = i * FLASH_SECTOR_SIZE;
+        flash.read(offset, page.data(), NVS_PAGE_HEADER_SIZE);
+        uint32_t state;
+        memcpy(&state, page.data(), sizeof(state));
+        if (state == NVS_PAGE_EMPTY) {
+            // checked to be really erased before it is used
+            flash.read(offset + NVS_PAGE_HEADER_SIZE, page.data(), FLASH_SECTOR_SIZE - NVS_PAGE_HEADER_SIZE);
+            freePages.push_back(i);
+            continue;
+        }
+        uint32_t pageSequence;
+        memcpy(&pageSequence, page.data() + 4, sizeof(pageSequence));
+        filled.emplace_back(pageSequence, i);
+        if (state == NVS_PAGE_ACTIVE) {
+            hasActivePage = true;
+        }
+    }
+    std::sort(filled.begin(), filled.end());
+
+    // the newer pages override the entries of the older ones
+    for (const auto &pageOrder : filled) {
+        uint32_t i = pageOrder.second;
+        uint32_t offset = i * FLASH_SECTOR_SIZE;
+        uint8_t bitmap[NVS_BITMAP_SIZE];
+        flash.read(offset + NVS_PAGE_HEADER_SIZE, bitmap, sizeof(bitmap));
+
+        nextEntry = NVS_PAGE_ENTRIES;
+        for (uint8_t entry = 0; entry < NVS_PAGE_ENTRIES; entry++) {
+            uint8_t state = (bitmap[entry / 4] >> (entry % 4 * 2)) & 3;
+            if (state == NVS_ENTRY_EMPTY) {
+                nextEntry = std::min(nextEntry, entry);
+            } else if (state == NVS_ENTRY_WRITTEN) {
+                uint8_t item[NVS_ENTRY_SIZE];
+                flash.read(offset + NVS_ENTRIES_OFFSET + entry * NVS_ENTRY_SIZE, item, sizeof(item));
+                std::string key(1, (char) item[0]);
+                key.append((const char *) item + NVS_KEY_OFFSET, strnlen((const char *) item + NVS_KEY_OFFSET, NVS_KEY_SIZE));
+                index[key] = {i, entry, item[NVS_DATA_OFFSET]};
+            }
+        }
+        usedPages.push_back(i);
+        sequence = std::max(sequence, pageOrder.first);
+    }
+}
+
+void NvsModel::writePageState(uint32_t page, uint32_t state) {
+    flash.write(page * FLASH_SECTOR_SIZE, &state, sizeof(state));
+}
+
+void NvsModel::writeEntryState(uint32_t page, uint8_t entry, uint8_t state) {
+    // the word holding the entry, with only its bits cleared
+    uint32_t word = ~(((uint32_t) (NVS_ENTRY_EMPTY & ~state)) << (entry % 16 * 2));
+    flash.write(page * FLASH_SECTOR_SIZE + NVS_PAGE_HEADER_SIZE + entry / 16 * 4, &word, sizeof(word));
+}
+
+uint32_t NvsModel::activateFreePage() {
+    uint32_t page = freePages.front();
+    freePages.pop_front();
+    uint8_t header[NVS_PAGE_HEADER_SIZE];
+    memset(header, 0xFF, sizeof(header));
+    uint32_t state = NVS_PAGE_ACTIVE;
+    sequence++;
+    memcpy(header, &state, sizeof(state));
+    memcpy(header + 4, &sequence, sizeof(sequence));
+    flash.write(page * FLASH_SECTOR_SIZE, header, sizeof(header));
+    usedPages.push_back(page);
+    nextEntry = 0;
+    return page;
+}
+
+void NvsModel::nextPage() {
+    if (hasActivePage) {
+        writePageState(usedPages.back(), NVS_PAGE_FULL);
+    }
+    hasActivePage = true;
+
+    // one free page is kept for garbage collection
+    if (freePages.size() <= 1) {
+        collectGarbage();
+        return;
+    }
+
+    activateFreePage();
+}
+
+void NvsModel::collectGarbage() {
+    // the full page with the fewest live entries
+    std::vector<uint32_t> live(pageCount, 0);
+    for (const auto &item : index) {
+        live[item.second.page]++;
+    }
+    uint32_t victim = *std::min_element(usedPages.begin(), usedPages.end(), [&live](uint32_t a, uint32_t b) {
+        return live[a] < live[b];
+    });
+    writePageState(victim, NVS_PAGE_FREEING);
+
+    // the reserved page becomes the active one, with the live entries of the victim
+    uint32_t page = activateFreePage();
+
+    for (auto &item : index) {
+        if (item.second.page != victim || nextEntry == NVS_PAGE_ENTRIES) {
+            continue;
+        }
+        uint8_t entry[NVS_ENTRY_SIZE];
+        flash.read(victim * FLASH_SECTOR_SIZE + NVS_ENTRIES_OFFSET + item.second.entry * NVS_ENTRY_SIZE, entry,
+                   sizeof(entry));
+        flash.write(page * FLASH_SECTOR_SIZE + NVS_ENTRIES_OFFSET + nextEntry * NVS_ENTRY_SIZE, entry, sizeof(entry));
+        writeEntryState(page, nextEntry, NVS_ENTRY_WRITTEN);
+        item.second.page = page;
+        item.second.entry = nextEntry++;
+    }
+
+    flash.eraseSector(victim * FLASH_SECTOR_SIZE);
+    usedPages.erase(std::find(usedPages.begin(), usedPages.end(), victim));
+    freePages.push_back(victim);
+    garbageCollections++;
+}
+
+void NvsModel::writeEntry(const std::string &item, uint8_t value) {
+    if (!hasActivePage || nextEntry == NVS_PAGE_ENTRIES) {
+        nextPage();
+    }
+    uint32_t page = usedPages.back();
+
+    uint8_t entry[NVS_ENTRY_SIZE];
+    memset(entry, 0xFF, sizeof(entry));
+    // namespace, type (u8), span, chunk index, CRC
+    entry[0] = item[0];
+    entry[1] = 0x01;
+    entry[2] = 1;
+    memset(entry + 4, 0, 4);
+    memset(entry + NVS_KEY_OFFSET, 0, NVS_KEY_SIZE);
+    memcpy(entry + NVS_KEY_OFFSET, item.data() + 1, std::min(item.size() - 1, (size_t) NVS_KEY_SIZE - 1));
+    entry[NVS_DATA_OFFSET] = value;
+    flash.write(page * FLASH_SECTOR_SIZE + NVS_ENTRIES_OFFSET + nextEntry * NVS_ENTRY_SIZE, entry, sizeof(entry));
+    writeEntryState(page, nextEntry, NVS_ENTRY_WRITTEN);
+
+    auto old = index.find(item);
+    if (old != index.end()) {
+        writeEntryState(old->second.page, old->second.entry, NVS_ENTRY_ERASED);
+    }
+    index[item] = {page, nextEntry, value};
+    nextEntry++;
+}
+
+void NvsModel::setU8(uint8_t ns, const char *key, uint8_t value) {
+    std::string item = std::string(1, (char) ns) + key;
+    auto location = index.find(item);
+    if (location != index.end() && location->second.value == value) {
+        return;
+    }
+    writeEntry(item, value);
+}
@@ -0,0 +1,71 @@
+#ifndef ESP32_LIGHT_NVSMODEL_H
+#define ESP32_LIGHT_NVSMODEL_H
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include "FlashBackend.h"
+
+#define NVS_PAGE_HEADER_SIZE 32
+#define NVS_BITMAP_SIZE 32
+#define NVS_ENTRY_SIZE 32
+#define NVS_PAGE_ENTRIES 126
+
+/*
+ * How ESP-IDF's NVS stores small values (Preferences::putUChar) on flash, close enough to compare its flash traffic
+ * with the journal on an EmulatedFlash: pages with a header, a 2 bit per entry state bitmap and 32 byte entries.  A
+ * changed value is a new entry plus two bitmap writes (the new entry written, the old one erased), writing the same
+ * value again is skipped.  When the active page is full the next free one is taken, and when only one free page is left
+ * the page with the fewest live entries is garbage collected: they are copied to the last free page, which becomes the
+ * active one, and it is erased.  Loading reads every page header and bitmap, every written entry, and the whole of every
+ * empty page to check it is erased.
+ *
+ * Only single entry values, no blobs or strings spanning several entries, no namespaces table and no CRC checks.
+ */
+class NvsModel {
+
+private:
+    struct Location {
+        uint32_t page;
+        uint8_t entry;
+        uint8_t value;
+    };
+
+    FlashBackend &flash;
+    uint32_t pageCount;
+    // by namespace index and key
+    std::map<std::string, Location> index;
+    // in the order they were filled, the active one last
+    std::deque<uint32_t> usedPages;
+    std::deque<uint32_t> freePages;
+    bool hasActivePage = false;
+    uint8_t nextEntry = 0;
+    uint32_t sequence = 0;
+    uint64_t garbageCollections = 0;
+
+    void writePageState(uint32_t page, uint32_t state);
+    void writeEntryState(uint32_t page, uint8_t entry, uint8_t state);
+    // `item` is the namespace index followed by the key
+    void writeEntry(const std::string &item, uint8_t value);
+    // takes the first free page as the active one
+    uint32_t activateFreePage();
+    void nextPage();
+    void collectGarbage();
+
+public:
+    explicit NvsModel(FlashBackend &flash);
+
+    // erases every page, as `nvs_flash_erase()`
+    void format();
+    // loads the pages, as `nvs_flash_init()`
+    void begin();
+
+    // `ns` is the index of the namespace (Preferences::begin()), 1 and up
+    void setU8(uint8_t ns, const char *key, uint8_t value);
+
+    size_t getKeyCount() const { return index.size(); }
+    uint64_t getGarbageCollections() const { return garbageCollections; }
+};
+
+#endif //ESP32_LIGHT_NVSMODEL_H
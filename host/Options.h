@@ -0,0 +1,22 @@
+#ifndef ESP32_LIGHT_OPTIONS_H
+#define ESP32_LIGHT_OPTIONS_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// returns the value following `-name`, like the SimpleCLI arguments on the device
+inline const char *option(int argc, char **argv, const char *name, const char *defaultValue) {
+    for (int i = 0; i + 1 < argc; i++) {
+        if (argv[i][0] == '-' && strcmp(argv[i] + 1, name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return defaultValue;
+}
+
+inline long option(int argc, char **argv, const char *name, long defaultValue) {
+    const char *value = option(argc, argv, name, (const char *) nullptr);
+    return value != nullptr ? strtol(value, nullptr, 10) : defaultValue;
+}
+
+#endif //ESP32_LIGHT_OPTIONS_H
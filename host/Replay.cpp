@@ -0,0 +1,260 @@
+#include "Replay.h"
+#include "Options.h"
+#include "ElgatoApi.h"
+#include "HttpProtocol.h"
+#include "TrafficCapture.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define REPLAY_BUFFER_SIZE 1024
+#define REPLAY_RESPONSE_BUFFER_SIZE 2048
+
+static const char *methodName(ApiMethod method) {
+    switch (method) {
+        case API_GET: return "GET";
+        case API_PUT: return "PUT";
+        default: return "POST";
+    }
+}
+
+struct ReplayRequest {
+    uint32_t offsetUs;
+    uint8_t route;
+    uint16_t status;
+    uint32_t latencyUs;
+    // the request as the Elgato Control Center sends it, without Content-Type
+    std::string http;
+};
+
+struct RouteBudget {
+    uint32_t p50Us = 0;
+    uint32_t p99Us = 0;
+    // captured handler latency and replayed request path latency
+    std::vector<uint32_t> recorded;
+    std::vector<uint32_t> replayed;
+};
+
+static uint32_t percentile(std::vector<uint32_t> values, uint8_t percentile) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (values.size() * percentile + 99) / 100 - 1)];
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &data) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(file);
+    return true;
+}
+
+static std::string msgPackToJson(const uint8_t *data, size_t length) {
+    std::string json;
+    if (length == 0) {
+        return json;
+    }
+
+    DynamicJsonDocument doc(4096);
+    if (deserializeMsgPack(doc, data, length)) {
+        return json;
+    }
+    serializeJson(doc, json);
+    return json;
+}
+
+static bool readBudgets(const char *path, std::vector<RouteBudget> &budgets) {
+    FILE *file = fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        char method[8];
+        char uri[64];
+        unsigned int p50, p99;
+        if (line[0] == '#' || sscanf(line, "%7s %63s %u %u", method, uri, &p50, &p99) != 4) {
+            continue;
+        }
+
+        for (size_t i = 0; i < ElgatoApi::routeCount; i++) {
+            if (strcmp(ElgatoApi::routes[i].uri, uri) == 0 && strcmp(methodName(ElgatoApi::routes[i].method), method) == 0) {
+                budgets[i].p50Us = p50;
+                budgets[i].p99Us = p99;
+            }
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+int runReplay(int argc, char **argv) {
+    if (argc < 1 || argv[0][0] == '-') {
+        fprintf(stderr, "Usage: replay <file> [-speed 1] [-runs 1] [-budgets <file>] [-p50 <us>] [-p99 <us>]\n");
+        return 2;
+    }
+
+    const char *path = argv[0];
+    double speed = atof(option(argc, argv, "speed", "1"));
+    long runs = std::max(option(argc, argv, "runs", 1L), 1L);
+    const char *budgetsPath = option(argc, argv, "budgets", (const char *) nullptr);
+    long defaultP50 = option(argc, argv, "p50", 0L);
+    long defaultP99 = option(argc, argv, "p99", 0L);
+
+    std::vector<uint8_t> data;
+    if (!readFile(path, data) || !TrafficCapture::isCapture(data.data(), data.size())) {
+        fprintf(stderr, "%s is not a capture\n", path);
+        return 2;
+    }
+
+    std::vector<RouteBudget> budgets(ElgatoApi::routeCount);
+    for (RouteBudget &budget : budgets) {
+        budget.p50Us = defaultP50;
+        budget.p99Us = defaultP99;
+    }
+    if (budgetsPath != nullptr && !readBudgets(budgetsPath, budgets)) {
+        fprintf(stderr, "Failed to read %s\n", budgetsPath);
+        return 2;
+    }
+
+    // decode everything up front, so only the request path is timed
+    std::vector<ReplayRequest> requests;
+    std::vector<uint8_t> initialState;
+    std::string finalState;
+    CaptureRecord record;
+    size_t offset = CAPTURE_HEADER_SIZE;
+    size_t recordLength;
+    while ((recordLength = TrafficCapture::readRecord(data.data() + offset, data.size() - offset, record)) > 0) {
+        offset += recordLength;
+
+        if (record.type == CAPTURE_STATE_INITIAL) {
+            initialState.assign(record.body, record.body + record.bodyLength);
+        } else if (record.type == CAPTURE_STATE_FINAL) {
+            finalState = msgPackToJson(record.body, record.bodyLength);
+        } else if (record.type == CAPTURE_REQUEST && record.route < ElgatoApi::routeCount) {
+            const ElgatoApi::Route &route = ElgatoApi::routes[record.route];
+            std::string body = msgPackToJson(record.body, record.bodyLength);
+
+            ReplayRequest request = {record.offsetUs, record.route, record.status, record.latencyUs, ""};
+            request.http = std::string(methodName(route.method)) + " " + route.uri + " HTTP/1.1\r\n";
+            if (!body.empty()) {
+                request.http += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+            }
+            request.http += "\r\n" + body;
+            requests.push_back(request);
+
+            budgets[record.route].recorded.push_back(record.latencyUs);
+        }
+    }
+
+    printf("%zu requests over %.1fs\n", requests.size(), requests.empty() ? 0 : requests.back().offsetUs / 1e6);
+
+    bool passed = true;
+    uint32_t statusMismatches = 0;
+    uint32_t stateMismatches = 0;
+
+    for (long run = 0; run < runs; run++) {
+        AccessoryInfo info;
+        Lights lights;
+        Settings settings;
+        ElgatoApi api(info, lights, settings);
+
+        // start where the capture started
+        if (!initialState.empty()) {
+            DynamicJsonDocument stateDoc(4096);
+            deserializeMsgPack(stateDoc, initialState.data(), initialState.size());
+            JsonVariant state = stateDoc.as<JsonVariant>();
+            StaticJsonDocument<1024> ignored;
+            JsonObject ignoredResponse = ignored.to<JsonObject>();
+            api.putBatch(state, ignoredResponse);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (const ReplayRequest &request : requests) {
+            if (speed > 0) {
+                std::this_thread::sleep_until(start + std::chrono::microseconds((uint64_t) (request.offsetUs / speed)));
+            }
+
+            // copying into the receive buffer is not part of the request path
+            char buffer[REPLAY_BUFFER_SIZE];
+            size_t length = std::min(request.http.size(), sizeof(buffer));
+            memcpy(buffer, request.http.data(), length);
+
+            unsigned long begin = micros();
+            HttpRequest http;
+            HttpParseResult result = parseHttpRequest(buffer, length, sizeof(buffer), http);
+            StaticJsonDocument<1024> requestDoc;
+            StaticJsonDocument<1024> responseDoc;
+            int status = result == HTTP_PARSE_OK ? handleHttpRequest(api, http, requestDoc, responseDoc) : http.status;
+            char response[REPLAY_RESPONSE_BUFFER_SIZE];
+            writeHttpResponse(status, responseDoc, http.keepAlive, response, sizeof(response));
+            budgets[request.route].replayed.push_back(micros() - begin);
+
+            if (status != request.status) {
+                statusMismatches++;
+            }
+        }
+
+        if (!finalState.empty()) {
+            StaticJsonDocument<1024> stateDoc;
+            JsonObject state = stateDoc.to<JsonObject>();
+            TrafficCapture::stateToJson(api, state);
+            std::string replayedState;
+            serializeJson(stateDoc, replayedState);
+
+            if (replayedState != finalState) {
+                stateMismatches++;
+                if (stateMismatches == 1) {
+                    printf("Final state differs\n  captured: %s\n  replayed: %s\n", finalState.c_str(),
+                           replayedState.c_str());
+                }
+            }
+        }
+    }
+
+    printf("\n%-5s %-24s %7s %18s %18s %18s\n", "", "route", "count", "captured p50/p99", "replayed p50/p99",
+           "budget p50/p99");
+    for (size_t i = 0; i < ElgatoApi::routeCount; i++) {
+        RouteBudget &budget = budgets[i];
+        if (budget.replayed.empty()) {
+            continue;
+        }
+
+        uint32_t p50 = percentile(budget.replayed, 50);
+        uint32_t p99 = percentile(budget.replayed, 99);
+        bool withinBudget = (budget.p50Us == 0 || p50 <= budget.p50Us) && (budget.p99Us == 0 || p99 <= budget.p99Us);
+        passed &= withinBudget;
+
+        char captured[24], replayed[24], limit[24];
+        snprintf(captured, sizeof(captured), "%u/%uus", percentile(budget.recorded, 50), percentile(budget.recorded, 99));
+        snprintf(replayed, sizeof(replayed), "%u/%uus", p50, p99);
+        snprintf(limit, sizeof(limit), "%u/%uus", budget.p50Us, budget.p99Us);
+        printf("%-5s %-24s %7zu %18s %18s %18s %s\n", methodName(ElgatoApi::routes[i].method), ElgatoApi::routes[i].uri,
+               budget.replayed.size(), captured, replayed, limit, withinBudget ? "" : "OVER BUDGET");
+    }
+
+    if (finalState.empty()) {
+        printf("\nThe capture has no final state, it was not stopped or is truncated\n");
+    }
+    printf("\n%u status mismatches, %u of %ld runs with a different final state\n", statusMismatches, stateMismatches,
+           runs);
+
+    passed &= statusMismatches == 0 && stateMismatches == 0;
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+#ifndef ESP32_LIGHT_REPLAY_H
+#define ESP32_LIGHT_REPLAY_H
+
+/*
+ * Replays a capture (`GET /capture` on the device, or `fleet -capture`) through the HTTP request path of a fresh light
+ * that starts in the captured initial state.
+ *
+ *   replay <file> [-speed 1] [-runs 1] [-budgets host/budgets.txt] [-p50 <us>] [-p99 <us>]
+ *
+ * `-speed 1` keeps the original timing, `-speed 10` replays ten times faster and `-speed 0` without any delay.  The
+ * p50/p99 latency of every route is checked against its budget (a budget file has lines of `<method> <uri> <p50 us>
+ * <p99 us>`, `-p50`/`-p99` apply to routes not in the file), every status against the captured one, and the final state
+ * against the captured final state.  Returns non zero if any check fails.
+ */
+int runReplay(int argc, char **argv);
+
+#endif //ESP32_LIGHT_REPLAY_H
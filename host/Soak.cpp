@@ -0,0 +1,116 @@
+#include "Soak.h"
+#include "Allocations.h"
+#include "Options.h"
+#include "ElgatoApi.h"
+#include "HttpProtocol.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define SOAK_BUFFER_SIZE 1024
+#define SOAK_RESPONSE_BUFFER_SIZE 2048
+
+static void printHeap(const char *label, const HeapStats &stats) {
+    printf("%-8s %12llu allocations %12llu frees %9zu bytes in use %9zu bytes free in %6zu chunks, %5.1f%% fragmented\n",
+           label, (unsigned long long) stats.allocations, (unsigned long long) stats.frees, stats.inUse, stats.free,
+           stats.freeChunks, stats.fragmentation() * 100);
+}
+
+// the requests, built up front so building them is not part of the soak
+static std::vector<std::string> buildRequests() {
+    std::vector<std::string> requests;
+    std::vector<std::string> bodies;
+
+    // display names from empty to past the limit, the longer ones are rejected
+    std::string name;
+    for (uint32_t characters = 0; name.size() <= MAX_DISPLAY_NAME_LENGTH + 8; characters++) {
+        bodies.push_back("{\"displayName\":\"" + name + "\"}");
+        // with multi byte characters, the limit is in bytes
+        name += characters % 5 == 4 ? "\xC3\xA9" : "a";
+    }
+
+    for (size_t i = 0; i < bodies.size(); i++) {
+        const std::string &body = bodies[i];
+        requests.push_back("PUT /elgato/accessory-info HTTP/1.1\r\nContent-Length: " + std::to_string(body.size())
+                           + "\r\n\r\n" + body);
+        requests.push_back("GET /elgato/accessory-info HTTP/1.1\r\n\r\n");
+
+        // slider drags, a burst of brightness changes
+        for (uint8_t step = 0; step < 4; step++) {
+            std::string lights = "{\"lights\":[{\"brightness\":" + std::to_string((i * 4 + step) % 101) + ",\"on\":1}]}";
+            requests.push_back("PUT /elgato/lights HTTP/1.1\r\nContent-Length: " + std::to_string(lights.size())
+                               + "\r\n\r\n" + lights);
+        }
+        requests.push_back("GET /elgato/lights HTTP/1.1\r\n\r\n");
+        requests.push_back("GET /elgato/lights/settings HTTP/1.1\r\n\r\n");
+
+        std::string batch = "{\"lights\":[{\"on\":" + std::to_string(i % 2) + "}],\"accessory-info\":" + body + "}";
+        requests.push_back("PUT /elgato/batch HTTP/1.1\r\nContent-Length: " + std::to_string(batch.size())
+                           + "\r\n\r\n" + batch);
+    }
+    return requests;
+}
+
+int runSoak(int argc, char **argv) {
+    long total = option(argc, argv, "requests", 10000000L);
+    long reportEvery = std::max(option(argc, argv, "report", 1000000L), 1L);
+    long maxAllocations = option(argc, argv, "max_allocations", 0L);
+
+    if (!heapStatsAvailable()) {
+        printf("Allocation counters need glibc, only the requests are run\n");
+    }
+
+    std::vector<std::string> requests = buildRequests();
+
+    AccessoryInfo info;
+    Lights lights;
+    Settings settings;
+    ElgatoApi api(info, lights, settings);
+
+    // the first output allocates the stdout buffer, which is not part of the soak
+    printf("%ld requests, %zu different ones\n\n", total, requests.size());
+
+    HeapStats before = heapStats();
+    printHeap("before", before);
+
+    uint64_t statuses[6] = {};
+    for (long i = 0; i < total; i++) {
+        const std::string &text = requests[i % requests.size()];
+
+        // the same path and buffers as KeepAliveServer::processRequests()
+        char buffer[SOAK_BUFFER_SIZE];
+        memcpy(buffer, text.data(), text.size());
+
+        HttpRequest request;
+        HttpParseResult result = parseHttpRequest(buffer, text.size(), sizeof(buffer), request);
+        StaticJsonDocument<1024> requestDoc;
+        StaticJsonDocument<1024> responseDoc;
+        int status = result == HTTP_PARSE_OK ? handleHttpRequest(api, request, requestDoc, responseDoc) : request.status;
+        char response[SOAK_RESPONSE_BUFFER_SIZE];
+        writeHttpResponse(status, responseDoc, request.keepAlive, response, sizeof(response));
+        statuses[status / 100]++;
+
+        if ((i + 1) % reportEvery == 0) {
+            HeapStats now = heapStats();
+            char label[24];
+            snprintf(label, sizeof(label), "%ldk", (i + 1) / 1000);
+            printHeap(label, now);
+        }
+    }
+
+    HeapStats after = heapStats();
+    printHeap("after", after);
+
+    uint64_t allocations = after.allocations - before.allocations;
+    printf("\n%ld requests (%llu 2xx, %llu 4xx), %.3f allocations per 1000 requests, %+lld bytes in use\n", total,
+           (unsigned long long) statuses[2], (unsigned long long) statuses[4],
+           total > 0 ? allocations * 1000.0 / total : 0, (long long) after.inUse - (long long) before.inUse);
+    printf("Display name \"%s\" (%zu bytes)\n", info.displayName.c_str(), info.displayName.length());
+
+    bool passed = total == 0 || allocations * 1000 <= (uint64_t) maxAllocations * total;
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
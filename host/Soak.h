@@ -0,0 +1,15 @@
+#ifndef ESP32_LIGHT_SOAK_H
+#define ESP32_LIGHT_SOAK_H
+
+/*
+ * Long running soak of the request path: a mix of the requests the Elgato Control Center sends (including display names
+ * of every length up to past MAX_DISPLAY_NAME_LENGTH) through the same parse/handle/write path as the keep-alive server.
+ *
+ *   soak [-requests 10000000] [-report 1000000] [-max_allocations 0]
+ *
+ * Prints the allocations per request and the heap fragmentation while it runs and before/after.  Returns non zero when
+ * the request path allocates more than `-max_allocations` times per 1000 requests.
+ */
+int runSoak(int argc, char **argv);
+
+#endif //ESP32_LIGHT_SOAK_H
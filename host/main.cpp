@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#include "Fleet.h"
+#include "Replay.h"
+#include "Soak.h"
+#include "DmxSend.h"
+#include "JournalBench.h"
+#include "MdnsStorm.h"
+
+// host side tools, built with `pio run -e native`, the unit tests bring their own main
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "fleet") == 0) {
+        return runFleet(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "replay") == 0) {
+        return runReplay(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "soak") == 0) {
+        return runSoak(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "dmx-send") == 0) {
+        return runDmxSend(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "journal-bench") == 0) {
+        return runJournalBench(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "mdns-storm") == 0) {
+        return runMdnsStorm(argc - 2, argv + 2);
+    }
+
+    printf("Usage: %s <command> [options]\n\n", argv[0]);
+    printf("Commands:\n");
+    printf("  fleet      Runs many virtual fake lights for load and discovery testing\n");
+    printf("  replay     Replays a traffic capture and checks latency budgets and the final state\n");
+    printf("  soak       Runs the request path for a long time and reports allocations and heap fragmentation\n");
+    printf("  dmx-send   Streams Art-Net or sACN frames like a lighting console\n");
+    printf("  journal-bench\n");
+    printf("             Compares the state journal with NVS on emulated flash and tests recovery from power cuts\n");
+    printf("  mdns-storm Runs the mDNS responder on a simulated busy network and checks every light is discovered\n");
+    return 1;
+}
+#endif
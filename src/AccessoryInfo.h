@@ -3,33 +3,47 @@
 
 #include <ArduinoJson.h>
 #include "FakeLight.h"
+#include "JsonValidation.h"
+#include "InlineString.h"
+
+// limits of the values the Elgato Control Center shows, in bytes of UTF-8
+#define MAX_DISPLAY_NAME_LENGTH 64
+#define MAX_FIRMWARE_VERSION_LENGTH 16
+#define MAX_PRODUCT_NAME_LENGTH 32
+#define MAX_SERIAL_NUMBER_LENGTH 16
 
 struct AccessoryInfo {
-    String displayName = DEFAULT_DISPLAY_NAME;
-    String features[1] = { "lights" };
+    InlineString<MAX_DISPLAY_NAME_LENGTH> displayName = DEFAULT_DISPLAY_NAME;
+    const char *features[1] = { "lights" };
     int firmwareBuildNumber = 199;
-    String firmwareVersion = "1.0.3";
+    InlineString<MAX_FIRMWARE_VERSION_LENGTH> firmwareVersion = "1.0.3";
     int hardwareBoardType = 200;
-    String productName = "Elgato Key Light Air";
-    String serialNumber = "CW31J1A00183";
+    InlineString<MAX_PRODUCT_NAME_LENGTH> productName = "Elgato Key Light Air";
+    InlineString<MAX_SERIAL_NUMBER_LENGTH> serialNumber = "CW31J1A00183";
 
     AccessoryInfo() = default;
 
+    // checks a `PUT /elgato/accessory-info` body without applying it
+    static bool isValidJson(JsonObject &doc) {
+        return isValidJsonString(doc["displayName"], MAX_DISPLAY_NAME_LENGTH);
+    }
+
     void fromJson(JsonObject &doc) {
 
-        if (doc["displayName"]) {
-            String newName = doc["displayName"];
+        const char *newName = doc["displayName"];
+        if (newName != nullptr) {
             displayName = newName;
         }
     }
 
     void toJson(JsonObject &doc) {
-        doc["displayName"] = displayName;
+        // copied, the display name can change before an async response is serialized
+        doc["displayName"] = displayName.data();
         doc["firmwareBuildNumber"] = firmwareBuildNumber;
-        doc["firmwareVersion"] = firmwareVersion;
+        doc["firmwareVersion"] = firmwareVersion.c_str();
         doc["hardwareBoardType"] = hardwareBoardType;
-        doc["productName"] = productName;
-        doc["serialNumber"] = serialNumber;
+        doc["productName"] = productName.c_str();
+        doc["serialNumber"] = serialNumber.c_str();
 
         // create an empty array
         JsonArray featuresNode = doc.createNestedArray("features");
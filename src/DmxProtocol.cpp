@@ -0,0 +1,161 @@
+#include "DmxProtocol.h"
+#include <string.h>
+
+#define ARTNET_OP_DMX 0x5000
+#define ARTNET_PROTOCOL_VERSION 14
+
+#define SACN_VECTOR_ROOT_DATA 0x00000004
+#define SACN_VECTOR_FRAMING_DATA 0x00000002
+#define SACN_VECTOR_DMP_SET_PROPERTY 0x02
+#define SACN_OPTION_PREVIEW 0x80
+#define SACN_OPTION_TERMINATED 0x40
+#define SACN_DEFAULT_PRIORITY 100
+#define SACN_MAX_UNIVERSE 63999
+
+static const uint8_t artNetId[8] = {'A', 'r', 't', '-', 'N', 'e', 't', 0};
+static const uint8_t sacnId[12] = {'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0};
+
+static uint16_t read16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t read32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void write16(uint8_t *p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static void write32(uint8_t *p, uint32_t value) {
+    write16(p, value >> 16);
+    write16(p + 2, value & 0xFFFF);
+}
+
+DmxParseResult parseArtNet(const uint8_t *packet, size_t length, DmxFrame &frame) {
+    if (length < 10 || memcmp(packet, artNetId, sizeof(artNetId)) != 0) {
+        return DMX_PARSE_ERROR;
+    }
+    // the op code is the only little endian field
+    if ((packet[8] | (packet[9] << 8)) != ARTNET_OP_DMX) {
+        return DMX_PARSE_IGNORED;
+    }
+    if (length < ARTNET_HEADER_SIZE || read16(packet + 10) < ARTNET_PROTOCOL_VERSION) {
+        return DMX_PARSE_ERROR;
+    }
+
+    uint16_t slotCount = read16(packet + 16);
+    if (slotCount == 0 || slotCount > DMX_UNIVERSE_SIZE || (size_t) ARTNET_HEADER_SIZE + slotCount > length) {
+        return DMX_PARSE_ERROR;
+    }
+
+    frame.sequence = packet[12];
+    // net (7 bits), sub-net and universe (4 bits each)
+    frame.universe = ((packet[15] & 0x7F) << 8) | packet[14];
+    frame.terminated = false;
+    frame.slots = packet + ARTNET_HEADER_SIZE;
+    frame.slotCount = slotCount;
+    return DMX_PARSE_FRAME;
+}
+
+DmxParseResult parseSacn(const uint8_t *packet, size_t length, DmxFrame &frame) {
+    if (length < SACN_HEADER_SIZE || read16(packet) != 0x0010 || read16(packet + 2) != 0
+        || memcmp(packet + 4, sacnId, sizeof(sacnId)) != 0) {
+        return DMX_PARSE_ERROR;
+    }
+    // synchronization and discovery packets use other vectors
+    if (read32(packet + 18) != SACN_VECTOR_ROOT_DATA || read32(packet + 40) != SACN_VECTOR_FRAMING_DATA) {
+        return DMX_PARSE_IGNORED;
+    }
+    if (packet[117] != SACN_VECTOR_DMP_SET_PROPERTY || packet[118] != 0xA1) {
+        return DMX_PARSE_ERROR;
+    }
+
+    // the property values are the start code and the slots
+    uint16_t values = read16(packet + 123);
+    uint16_t universe = read16(packet + 113);
+    if (values == 0 || values > DMX_UNIVERSE_SIZE + 1 || (size_t) SACN_HEADER_SIZE - 1 + values > length
+        || universe == 0 || universe > SACN_MAX_UNIVERSE) {
+        return DMX_PARSE_ERROR;
+    }
+
+    uint8_t options = packet[112];
+    frame.universe = universe;
+    frame.sequence = packet[111];
+    frame.terminated = (options & SACN_OPTION_TERMINATED) != 0;
+    frame.slots = packet + SACN_HEADER_SIZE;
+    frame.slotCount = values - 1;
+
+    // preview data is meant for visualizers, other start codes (e.g. per slot priorities) don't carry levels
+    if (!frame.terminated && ((options & SACN_OPTION_PREVIEW) != 0 || packet[125] != 0)) {
+        return DMX_PARSE_IGNORED;
+    }
+    return DMX_PARSE_FRAME;
+}
+
+bool isLateSequence(uint8_t last, uint8_t sequence) {
+    if (sequence == 0) {
+        return false;
+    }
+    auto behind = (int8_t) (sequence - last);
+    return behind <= 0 && behind > -DMX_SEQUENCE_WINDOW;
+}
+
+size_t writeArtNet(uint8_t *out, size_t capacity, uint16_t universe, uint8_t sequence, const uint8_t *slots,
+                   uint16_t slotCount) {
+    // ArtDmx has an even number of slots
+    uint16_t length = slotCount + (slotCount & 1);
+    if (slotCount == 0 || length > DMX_UNIVERSE_SIZE || capacity < (size_t) ARTNET_HEADER_SIZE + length) {
+        return 0;
+    }
+
+    memcpy(out, artNetId, sizeof(artNetId));
+    out[8] = ARTNET_OP_DMX & 0xFF;
+    out[9] = ARTNET_OP_DMX >> 8;
+    write16(out + 10, ARTNET_PROTOCOL_VERSION);
+    out[12] = sequence;
+    out[13] = 0;
+    out[14] = universe & 0xFF;
+    out[15] = (universe >> 8) & 0x7F;
+    write16(out + 16, length);
+    memcpy(out + ARTNET_HEADER_SIZE, slots, slotCount);
+    if (length > slotCount) {
+        out[ARTNET_HEADER_SIZE + slotCount] = 0;
+    }
+    return ARTNET_HEADER_SIZE + length;
+}
+
+size_t writeSacn(uint8_t *out, size_t capacity, const uint8_t cid[SACN_CID_LENGTH], const char *sourceName,
+                 uint16_t universe, uint8_t sequence, const uint8_t *slots, uint16_t slotCount, bool terminated) {
+    size_t length = SACN_HEADER_SIZE + slotCount;
+    if (slotCount > DMX_UNIVERSE_SIZE || capacity < length || universe == 0 || universe > SACN_MAX_UNIVERSE) {
+        return 0;
+    }
+    memset(out, 0, SACN_HEADER_SIZE);
+
+    // root layer
+    write16(out, 0x0010);
+    memcpy(out + 4, sacnId, sizeof(sacnId));
+    write16(out + 16, 0x7000 | (length - 16));
+    write32(out + 18, SACN_VECTOR_ROOT_DATA);
+    memcpy(out + 22, cid, SACN_CID_LENGTH);
+
+    // framing layer, the source name is null terminated
+    write16(out + 38, 0x7000 | (length - 38));
+    write32(out + 40, SACN_VECTOR_FRAMING_DATA);
+    strncpy((char *) out + 44, sourceName, SACN_SOURCE_NAME_LENGTH - 1);
+    out[108] = SACN_DEFAULT_PRIORITY;
+    out[111] = sequence;
+    out[112] = terminated ? SACN_OPTION_TERMINATED : 0;
+    write16(out + 113, universe);
+
+    // DMP layer, one property per slot after the start code
+    write16(out + 115, 0x7000 | (length - 115));
+    out[117] = SACN_VECTOR_DMP_SET_PROPERTY;
+    out[118] = 0xA1;
+    write16(out + 121, 1);
+    write16(out + 123, slotCount + 1);
+    memcpy(out + SACN_HEADER_SIZE, slots, slotCount);
+    return length;
+}
@@ -0,0 +1,66 @@
+#ifndef ESP32_LIGHT_DMXPROTOCOL_H
+#define ESP32_LIGHT_DMXPROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Art-Net (ArtDmx) and sACN (ANSI E1.31 data packets) parsing and writing, without any networking so it is shared by
+ * `DmxReceiver` on the device and the `dmx-send` host tool.  Parsing does not copy, the frame points into the packet.
+ */
+
+#define ARTNET_PORT 6454
+#define SACN_PORT 5568
+
+#define DMX_UNIVERSE_SIZE 512
+
+// ArtDmx header, the slots follow it
+#define ARTNET_HEADER_SIZE 18
+// E1.31 data packet up to and including the start code, the slots follow it
+#define SACN_HEADER_SIZE 126
+#define SACN_SOURCE_NAME_LENGTH 64
+#define SACN_CID_LENGTH 16
+
+// E1.31 6.7.2, a sequence number up to this far behind the last one is an out of order packet, further is a restart
+#define DMX_SEQUENCE_WINDOW 20
+
+enum DmxProtocol : uint8_t {
+    DMX_ARTNET,
+    DMX_SACN
+};
+
+enum DmxParseResult : uint8_t {
+    DMX_PARSE_FRAME,
+    // a valid packet that does not carry levels (ArtPoll, sACN preview data or a non zero start code)
+    DMX_PARSE_IGNORED,
+    DMX_PARSE_ERROR
+};
+
+struct DmxFrame {
+    uint16_t universe;
+    // 0 when the sender does not number its packets (Art-Net)
+    uint8_t sequence;
+    // the sender stopped streaming this universe (sACN)
+    bool terminated;
+    const uint8_t *slots;
+    uint16_t slotCount;
+};
+
+DmxParseResult parseArtNet(const uint8_t *packet, size_t length, DmxFrame &frame);
+DmxParseResult parseSacn(const uint8_t *packet, size_t length, DmxFrame &frame);
+
+// whether `sequence` is an old packet that arrived after `last`, 0 (Art-Net without sequence numbers) never is
+bool isLateSequence(uint8_t last, uint8_t sequence);
+
+// write a packet for `slotCount` slots, return the bytes written or 0 if it does not fit
+size_t writeArtNet(uint8_t *out, size_t capacity, uint16_t universe, uint8_t sequence, const uint8_t *slots,
+                   uint16_t slotCount);
+size_t writeSacn(uint8_t *out, size_t capacity, const uint8_t cid[SACN_CID_LENGTH], const char *sourceName,
+                 uint16_t universe, uint8_t sequence, const uint8_t *slots, uint16_t slotCount, bool terminated);
+
+// the multicast group of a sACN universe, as an IPv4 address in host byte order
+inline uint32_t sacnMulticastGroup(uint16_t universe) {
+    return (239u << 24) | (255u << 16) | universe;
+}
+
+#endif //ESP32_LIGHT_DMXPROTOCOL_H
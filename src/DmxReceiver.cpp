@@ -0,0 +1,359 @@
+#include "DmxReceiver.h"
+#include <Preferences.h>
+#include <lwip/igmp.h>
+#include <lwip/tcpip.h>
+#include "Tasks.h"
+#include "Esp32App.h"
+
+static uint32_t difference(uint32_t a, uint32_t b) {
+    return a > b ? a - b : b - a;
+}
+
+// joins or leaves the multicast group of a sACN universe, on the lwIP thread
+static void changeGroupCallback(void *arg) {
+    auto value = (uint32_t) (uintptr_t) arg;
+    ip4_addr_t group;
+    group.addr = lwip_htonl(sacnMulticastGroup(value & 0xFFFF));
+    if (value >> 16) {
+        igmp_joingr(IP4_ADDR_ANY4, &group);
+    } else {
+        igmp_leavegr(IP4_ADDR_ANY4, &group);
+    }
+}
+
+static void changeGroup(uint16_t universe, bool join) {
+    tcpip_callback(changeGroupCallback, (void *) (uintptr_t) ((join ? 1u << 16 : 0) | universe));
+}
+
+void DmxReceiver::begin(LightInstance **lights, uint8_t count) {
+    instances = lights;
+    instanceCount = count;
+
+    for (uint8_t i = 0; i < instanceCount; i++) {
+        Preferences preferences;
+        preferences.begin(instances[i]->getPreferencesName(), true);
+        patches[i].universe = preferences.getUShort("dmx-universe", 1);
+        patches[i].channel = preferences.getUShort("dmx-channel", 0);
+        preferences.end();
+    }
+    Serial.flush(); // flush is required after getting preferences
+
+    rebuildUniverses();
+    for (DmxUniverse &universe : universes) {
+        if (universe.used) {
+            changeGroup(universe.universe, true);
+        }
+    }
+    listen();
+
+    // the frames are taken by the output task, see consumeFrames()
+    LightOutput::setPeriodHook(consumeFrames, this);
+}
+
+void DmxReceiver::listen() {
+    bool patched = false;
+    for (int8_t slot : patchUniverse) {
+        patched |= slot >= 0;
+    }
+    // nothing to do with the (broadcast) Art-Net traffic until a light is patched
+    if (listening || !patched) {
+        return;
+    }
+
+    // unicast and broadcast Art-Net, unicast and (with the groups joined) multicast sACN
+    artNet.onPacket([this](AsyncUDPPacket &packet) {
+        ingest(DMX_ARTNET, packet.data(), packet.length());
+    });
+    sacn.onPacket([this](AsyncUDPPacket &packet) {
+        ingest(DMX_SACN, packet.data(), packet.length());
+    });
+    listening = artNet.listen(ARTNET_PORT) && sacn.listen(SACN_PORT);
+    if (!listening) {
+        Serial.println("Failed to listen for Art-Net/sACN");
+    }
+}
+
+bool DmxReceiver::patch(uint8_t light, uint16_t universe, uint16_t channel) {
+    // Art-Net universes start at 0, sACN universes at 1 and end at 63999
+    if (light >= instanceCount || universe > 63999 || channel > DMX_UNIVERSE_SIZE - DMX_LIGHT_CHANNELS + 1) {
+        return false;
+    }
+
+    uint16_t before[MAX_DMX_UNIVERSES];
+    bool usedBefore[MAX_DMX_UNIVERSES];
+    portENTER_CRITICAL(&lock);
+    for (uint8_t i = 0; i < MAX_DMX_UNIVERSES; i++) {
+        before[i] = universes[i].universe;
+        usedBefore[i] = universes[i].used;
+    }
+    patches[light].universe = universe;
+    patches[light].channel = channel;
+    rebuildUniverses();
+    portEXIT_CRITICAL(&lock);
+
+    // a slot keeps its universe while it is used, so only the slots that changed need their group changed
+    for (uint8_t i = 0; i < MAX_DMX_UNIVERSES; i++) {
+        bool changed = usedBefore[i] != universes[i].used || before[i] != universes[i].universe;
+        if (changed && usedBefore[i]) {
+            changeGroup(before[i], false);
+        }
+        if (changed && universes[i].used) {
+            changeGroup(universes[i].universe, true);
+        }
+    }
+    if (channel == 0) {
+        instances[light]->setStreaming(false);
+    }
+    listen();
+
+    Preferences preferences;
+    preferences.begin(instances[light]->getPreferencesName(), false);
+    preferences.putUShort("dmx-universe", universe);
+    preferences.putUShort("dmx-channel", channel);
+    preferences.end();
+    return true;
+}
+
+void DmxReceiver::rebuildUniverses() {
+    // the slots of universes that are still patched keep their frame and statistics
+    for (DmxUniverse &universe : universes) {
+        bool patched = false;
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            patched |= patches[i].channel > 0 && patches[i].universe == universe.universe;
+        }
+        if (universe.used && !patched) {
+            universe = DmxUniverse();
+        }
+        universe.slotCount = 0;
+    }
+
+    for (uint8_t i = 0; i < MAX_LIGHT_INSTANCES; i++) {
+        patchUniverse[i] = -1;
+        if (i >= instanceCount || patches[i].channel == 0) {
+            continue;
+        }
+
+        // there are as many slots as lights, so there is always one free
+        int8_t slot = -1;
+        for (int8_t j = 0; j < MAX_DMX_UNIVERSES && slot < 0; j++) {
+            if (universes[j].used && universes[j].universe == patches[i].universe) {
+                slot = j;
+            }
+        }
+        for (int8_t j = 0; j < MAX_DMX_UNIVERSES && slot < 0; j++) {
+            if (!universes[j].used) {
+                slot = j;
+                universes[j].used = true;
+                universes[j].universe = patches[i].universe;
+            }
+        }
+
+        patchUniverse[i] = slot;
+        universes[slot].slotCount = max(universes[slot].slotCount,
+                                        (uint16_t) (patches[i].channel - 1 + DMX_LIGHT_CHANNELS));
+    }
+}
+
+void DmxReceiver::ingest(DmxProtocol protocol, const uint8_t *packet, size_t length) {
+    packets++;
+
+    DmxFrame frame;
+    DmxParseResult result = protocol == DMX_ARTNET ? parseArtNet(packet, length, frame) : parseSacn(packet, length, frame);
+    if (result != DMX_PARSE_FRAME) {
+        if (result == DMX_PARSE_ERROR) {
+            invalid++;
+        } else {
+            ignored++;
+        }
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    bool patched = false;
+
+    portENTER_CRITICAL(&lock);
+    for (DmxUniverse &universe : universes) {
+        if (!universe.used || universe.universe != frame.universe) {
+            continue;
+        }
+        patched = true;
+
+        // after a pause the sender may have started over
+        bool resumed = universe.lastArrivalUs == 0 || now - universe.lastArrivalUs >= DMX_STREAM_TIMEOUT_MS * 1000LL;
+        if (resumed) {
+            universe.hasSequence[DMX_ARTNET] = false;
+            universe.hasSequence[DMX_SACN] = false;
+            universe.intervalUs = 0;
+        } else if (universe.hasSequence[protocol] && isLateSequence(universe.lastSequence[protocol], frame.sequence)) {
+            universe.late++;
+            break;
+        }
+        universe.lastSequence[protocol] = frame.sequence;
+        universe.hasSequence[protocol] = true;
+
+        // latest frame wins, one that was not taken yet is dropped
+        universe.frames++;
+        if (universe.pending) {
+            universe.dropped++;
+        }
+        uint16_t count = min(frame.slotCount, universe.slotCount);
+        memcpy(universe.slots, frame.slots, count);
+        memset(universe.slots + count, 0, universe.slotCount - count);
+        universe.pending = true;
+        universe.terminated = frame.terminated;
+
+        if (!resumed) {
+            auto intervalUs = (uint32_t) (now - universe.lastArrivalUs);
+            if (universe.intervalUs == 0) {
+                universe.intervalUs = intervalUs;
+            } else {
+                uint32_t jitterUs = difference(intervalUs, universe.intervalUs);
+                universe.arrivalIntervals++;
+                universe.arrivalJitterTotalUs += jitterUs;
+                universe.arrivalJitterMaxUs = max(universe.arrivalJitterMaxUs, jitterUs);
+                universe.intervalUs = (universe.intervalUs * 7 + intervalUs) / 8;
+            }
+        }
+        universe.lastArrivalUs = now;
+        break;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (!patched) {
+        unpatched++;
+    }
+}
+
+void DmxReceiver::consumeFrames(void *arg) {
+    static_cast<DmxReceiver *>(arg)->consumeFrames();
+}
+
+void DmxReceiver::consumeFrames() {
+    int64_t now = esp_timer_get_time();
+
+    // taken under the lock, applied after it
+    struct Update {
+        bool frame;
+        bool stop;
+        bool on;
+        uint8_t level;
+        uint8_t temperature;
+        uint32_t fadeMs;
+    } updates[MAX_LIGHT_INSTANCES] = {};
+    bool taken[MAX_DMX_UNIVERSES] = {};
+
+    portENTER_CRITICAL(&lock);
+    for (uint8_t i = 0; i < MAX_DMX_UNIVERSES; i++) {
+        DmxUniverse &universe = universes[i];
+        if (!universe.used || !universe.pending) {
+            continue;
+        }
+        universe.pending = false;
+        taken[i] = true;
+
+        if (universe.terminated) {
+            universe.lastAppliedUs = 0;
+            continue;
+        }
+        if (universe.lastAppliedUs != 0 && universe.intervalUs != 0
+            && now - universe.lastAppliedUs < DMX_STREAM_TIMEOUT_MS * 1000LL) {
+            uint32_t jitterUs = difference((uint32_t) (now - universe.lastAppliedUs), universe.intervalUs);
+            universe.outputIntervals++;
+            universe.outputJitterTotalUs += jitterUs;
+            universe.outputJitterMaxUs = max(universe.outputJitterMaxUs, jitterUs);
+        }
+        universe.lastAppliedUs = now;
+        universe.applied++;
+    }
+
+    for (uint8_t i = 0; i < instanceCount; i++) {
+        int8_t slot = patchUniverse[i];
+        if (slot < 0) {
+            continue;
+        }
+        const DmxUniverse &universe = universes[slot];
+        Update &update = updates[i];
+
+        if (taken[slot]) {
+            const uint8_t *levels = universe.slots + patches[i].channel - 1;
+            update.frame = !universe.terminated;
+            update.stop = universe.terminated;
+            update.on = levels[0] >= 128;
+            update.level = levels[1];
+            update.temperature = levels[2];
+            // reach each frame as the next one is due
+            update.fadeMs = constrain(universe.intervalUs / 1000, (uint32_t) OUTPUT_PERIOD_MS, (uint32_t) DMX_MAX_FADE_MS);
+        } else {
+            update.stop = now - universe.lastArrivalUs >= DMX_STREAM_TIMEOUT_MS * 1000LL;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    // the light is held steady while a firmware update is written, the frames taken meanwhile are dropped
+    bool updating = Esp32App::isUpdating();
+
+    for (uint8_t i = 0; i < instanceCount; i++) {
+        const Update &update = updates[i];
+        if (update.frame && !updating) {
+            instances[i]->setStreaming(true);
+            instances[i]->applyStream(update.on, update.level, update.temperature, update.fadeMs);
+        } else if (update.stop && instances[i]->isStreaming()) {
+            instances[i]->setStreaming(false);
+        }
+    }
+}
+
+void DmxReceiver::printStats() {
+    Serial.printf("\tDMX: %s, %u packets, %u invalid, %u ignored, %u for other universes\n",
+                  listening ? "listening" : "not listening", packets, invalid, ignored, unpatched);
+
+    for (uint8_t i = 0; i < instanceCount; i++) {
+        if (patches[i].channel == 0) {
+            Serial.printf("\tLight %u: not patched\n", i);
+        } else {
+            Serial.printf("\tLight %u: universe %u, channels %u-%u, %s\n", i, patches[i].universe, patches[i].channel,
+                          patches[i].channel + DMX_LIGHT_CHANNELS - 1,
+                          instances[i]->isStreaming() ? "streaming" : "not streaming");
+        }
+    }
+
+    for (const DmxUniverse &slot : universes) {
+        if (!slot.used) {
+            continue;
+        }
+        portENTER_CRITICAL(&lock);
+        DmxUniverse universe = slot;
+        portEXIT_CRITICAL(&lock);
+
+        uint32_t arrivalJitterUs = universe.arrivalIntervals > 0
+                ? universe.arrivalJitterTotalUs / universe.arrivalIntervals : 0;
+        uint32_t outputJitterUs = universe.outputIntervals > 0
+                ? universe.outputJitterTotalUs / universe.outputIntervals : 0;
+        Serial.printf("\tUniverse %u: %u frames, %u dropped, %u late, %u applied, interval %uus\n", universe.universe,
+                      universe.frames, universe.dropped, universe.late, universe.applied, universe.intervalUs);
+        Serial.printf("\t\tjitter arriving avg %uus, max %uus, applied avg %uus, max %uus\n", arrivalJitterUs,
+                      universe.arrivalJitterMaxUs, outputJitterUs, universe.outputJitterMaxUs);
+    }
+}
+
+void DmxReceiver::resetStats() {
+    packets = 0;
+    invalid = 0;
+    ignored = 0;
+    unpatched = 0;
+
+    portENTER_CRITICAL(&lock);
+    for (DmxUniverse &universe : universes) {
+        universe.frames = 0;
+        universe.dropped = 0;
+        universe.late = 0;
+        universe.applied = 0;
+        universe.arrivalIntervals = 0;
+        universe.arrivalJitterMaxUs = 0;
+        universe.arrivalJitterTotalUs = 0;
+        universe.outputIntervals = 0;
+        universe.outputJitterMaxUs = 0;
+        universe.outputJitterTotalUs = 0;
+    }
+    portEXIT_CRITICAL(&lock);
+}
@@ -0,0 +1,107 @@
+#ifndef ESP32_LIGHT_DMXRECEIVER_H
+#define ESP32_LIGHT_DMXRECEIVER_H
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include "DmxProtocol.h"
+#include "LightInstance.h"
+
+// every light can listen to its own universe
+#define MAX_DMX_UNIVERSES MAX_LIGHT_INSTANCES
+// on (128-255 is on), level and temperature (stored as is, like the one of `PUT /elgato/lights`), from the patched channel
+#define DMX_LIGHT_CHANNELS 3
+// E1.31 network data loss timeout, a light without frames for this long stops streaming
+#define DMX_STREAM_TIMEOUT_MS 2500
+// longest fade between two frames, slower streams step
+#define DMX_MAX_FADE_MS 100
+
+// where a light takes its levels from, `channel` is 1-512 (0 if the light is not patched)
+struct DmxPatch {
+    uint16_t universe = 1;
+    uint16_t channel = 0;
+};
+
+// the newest frame of a universe and its timing, written by the UDP task and taken by the output task
+struct DmxUniverse {
+    bool used = false;
+    uint16_t universe = 0;
+    // the slots the patched lights need, the rest of a frame is not copied
+    uint16_t slotCount = 0;
+    uint8_t slots[DMX_UNIVERSE_SIZE];
+    bool pending = false;
+    bool terminated = false;
+
+    // per protocol, a console may send both
+    uint8_t lastSequence[2] = {};
+    bool hasSequence[2] = {};
+
+    int64_t lastArrivalUs = 0;
+    int64_t lastAppliedUs = 0;
+    // smoothed time between frames, the output fades over it
+    uint32_t intervalUs = 0;
+
+    uint32_t frames = 0;
+    // overwritten by a newer frame before the output task took it
+    uint32_t dropped = 0;
+    // older than the last frame, discarded
+    uint32_t late = 0;
+    uint32_t applied = 0;
+    // deviation of the time between frames from the smoothed interval, as they arrive and as they are applied
+    uint32_t arrivalIntervals = 0;
+    uint32_t arrivalJitterMaxUs = 0;
+    uint64_t arrivalJitterTotalUs = 0;
+    uint32_t outputIntervals = 0;
+    uint32_t outputJitterMaxUs = 0;
+    uint64_t outputJitterTotalUs = 0;
+};
+
+/*
+ * Art-Net and sACN (E1.31) input, to drive the lights from a lighting console at frame rate.  Each light is patched to
+ * DMX_LIGHT_CHANNELS channels of a universe with the `dmx` command.
+ *
+ * Packets are parsed on the AsyncUDP task and only the newest frame of each universe is kept, in a preallocated slot.
+ * The output task takes the frames at the start of its period and fades to them over the measured frame interval, so
+ * frames bunched up or delayed by WiFi don't show as steps.  While a light is streaming its state is neither persisted
+ * nor published, the last state is once no frame arrived for DMX_STREAM_TIMEOUT_MS (or the sACN source terminated).
+ * Frames are dropped while a firmware update is written, like the HTTP, MQTT and CLI changes.
+ */
+class DmxReceiver {
+
+private:
+    AsyncUDP artNet;
+    AsyncUDP sacn;
+    bool listening = false;
+
+    LightInstance **instances = nullptr;
+    uint8_t instanceCount = 0;
+    DmxPatch patches[MAX_LIGHT_INSTANCES];
+    // the universe slot of every patched light, -1 if not patched
+    int8_t patchUniverse[MAX_LIGHT_INSTANCES];
+    DmxUniverse universes[MAX_DMX_UNIVERSES];
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    // only written by the UDP task
+    volatile uint32_t packets = 0;
+    volatile uint32_t invalid = 0;
+    volatile uint32_t ignored = 0;
+    volatile uint32_t unpatched = 0;
+
+    void listen();
+    void ingest(DmxProtocol protocol, const uint8_t *packet, size_t length);
+    void rebuildUniverses();
+    static void consumeFrames(void *arg);
+    void consumeFrames();
+
+public:
+    // loads the patches from the preferences of the lights, and listens once one is patched
+    void begin(LightInstance **lights, uint8_t count);
+
+    // patches (or with channel 0 unpatches) a light and saves it, returns false if the patch is invalid
+    bool patch(uint8_t light, uint16_t universe, uint16_t channel);
+
+    void printStats();
+    void resetStats();
+};
+
+#endif //ESP32_LIGHT_DMXRECEIVER_H
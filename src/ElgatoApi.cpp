@@ -0,0 +1,218 @@
+#include "ElgatoApi.h"
+#include <Arduino.h>
+#include <string.h>
+
+// AsyncWebServer matches URI prefixes, so /elgato/lights/settings has to come before /elgato/lights
+const ElgatoApi::Route ElgatoApi::routes[] = {
+        {"/elgato/accessory-info",  API_GET,  &ElgatoApi::getAccessoryInfo},
+        {"/elgato/accessory-info",  API_PUT,  &ElgatoApi::putAccessoryInfo},
+        {"/elgato/lights/settings", API_GET,  &ElgatoApi::getSettings},
+        {"/elgato/lights/settings", API_PUT,  &ElgatoApi::putSettings},
+        {"/elgato/lights",          API_GET,  &ElgatoApi::getLights},
+        {"/elgato/lights",          API_PUT,  &ElgatoApi::putLights},
+        {"/elgato/batch",           API_PUT,  &ElgatoApi::putBatch},
+        {"/elgato/identify",        API_POST, &ElgatoApi::identify},
+        // force empty 404
+        {"/elgato/battery-info",    API_GET,  &ElgatoApi::notFound},
+};
+
+const size_t ElgatoApi::routeCount = sizeof(ElgatoApi::routes) / sizeof(ElgatoApi::routes[0]);
+
+int ElgatoApi::handle(ApiMethod method, const char *uri, JsonVariant &body, JsonObject &response) {
+    bool uriFound = false;
+
+    for (size_t i = 0; i < routeCount; i++) {
+        if (strcmp(routes[i].uri, uri) == 0) {
+            if (routes[i].method == method) {
+                // like the AsyncWebServer JSON handler, a PUT without a JSON body is a bad request
+                if (method == API_PUT && body.isNull()) {
+                    return 400;
+                }
+                return handle(routes[i], body, response);
+            }
+            uriFound = true;
+        }
+    }
+
+    return uriFound ? 405 : 404;
+}
+
+int ElgatoApi::handle(const Route &route, JsonVariant &body, JsonObject &response) {
+    size_t index = &route - routes;
+    if (hooks.handlerStarted) {
+        hooks.handlerStarted(index);
+    }
+
+    if (hooks.lockState) {
+        hooks.lockState();
+    }
+
+    int status;
+    if (capture == nullptr || !capture->isActive()) {
+        status = (this->*route.handler)(body, response);
+    } else {
+        unsigned long start = micros();
+        status = (this->*route.handler)(body, response);
+        capture->record(index, status, micros() - start, body);
+    }
+
+    if (hooks.unlockState) {
+        hooks.unlockState();
+    }
+
+    if (hooks.handlerFinished) {
+        hooks.handlerFinished(index);
+    }
+    return status;
+}
+
+int ElgatoApi::getAccessoryInfo(JsonVariant &/* body */, JsonObject &response) {
+    info.toJson(response);
+    return 200;
+}
+
+int ElgatoApi::putAccessoryInfo(JsonVariant &body, JsonObject &response) {
+    if (isBusy()) {
+        return 503;
+    }
+
+    // an over-long display name would be cut off
+    JsonObject jsonObj = body.as<JsonObject>();
+    if (!AccessoryInfo::isValidJson(jsonObj)) {
+        return 400;
+    }
+    info.fromJson(jsonObj);
+
+    if (hooks.accessoryInfoChanged) {
+        hooks.accessoryInfoChanged();
+    }
+    return getAccessoryInfo(body, response);
+}
+
+int ElgatoApi::getSettings(JsonVariant &/* body */, JsonObject &response) {
+    settings.toJson(response);
+    return 200;
+}
+
+int ElgatoApi::putSettings(JsonVariant &body, JsonObject &response) {
+    if (isBusy()) {
+        return 503;
+    }
+
+    JsonObject jsonObj = body.as<JsonObject>();
+    settings.fromJson(jsonObj);
+
+    if (hooks.settingsChanged) {
+        hooks.settingsChanged();
+    }
+    return getSettings(body, response);
+}
+
+int ElgatoApi::getLights(JsonVariant &/* body */, JsonObject &response) {
+    lights.toJson(response);
+    return 200;
+}
+
+int ElgatoApi::putLights(JsonVariant &body, JsonObject &response) {
+    if (isBusy()) {
+        return 503;
+    }
+
+    JsonObject jsonObj = body.as<JsonObject>();
+    lights.fromJson(jsonObj);
+
+    // handle the lights changed
+    if (hooks.lightsChanged) {
+        hooks.lightsChanged(lights.lights[0]);
+    }
+
+    // return the GET lights json
+    return getLights(body, response);
+}
+
+int ElgatoApi::putBatch(JsonVariant &body, JsonObject &response) {
+    if (isBusy()) {
+        return 503;
+    }
+
+    // {"lights": [...], "settings": {...}, "accessory-info": {...}}, any subset of the resources
+    JsonObject batch = body.as<JsonObject>();
+    if (batch.isNull()) {
+        response["error"] = "expected a JSON object";
+        return 400;
+    }
+
+    // validate everything before anything is applied
+    for (JsonPair pair : batch) {
+        const char *key = pair.key().c_str();
+        if (strcmp(key, "lights") != 0 && strcmp(key, "settings") != 0 && strcmp(key, "accessory-info") != 0) {
+            response["error"] = "unknown resource";
+            return 400;
+        }
+    }
+
+    bool hasLights = batch.containsKey("lights");
+    bool hasSettings = batch.containsKey("settings");
+    bool hasInfo = batch.containsKey("accessory-info");
+    JsonObject settingsJson = batch["settings"];
+    JsonObject infoJson = batch["accessory-info"];
+
+    if (hasLights && !lights.isValidJson(batch)) {
+        response["error"] = "invalid lights";
+        return 400;
+    }
+    if (hasSettings && (settingsJson.isNull() || !Settings::isValidJson(settingsJson))) {
+        response["error"] = "invalid settings";
+        return 400;
+    }
+    if (hasInfo && (infoJson.isNull() || !AccessoryInfo::isValidJson(infoJson))) {
+        response["error"] = "invalid accessory-info";
+        return 400;
+    }
+
+    // apply, each hook runs once so the output and persistence see a single change.  The lights go first, changing
+    // them also updates the power on settings, which the settings in the batch take precedence over
+    if (hasLights) {
+        lights.fromJson(batch);
+        if (hooks.lightsChanged) {
+            hooks.lightsChanged(lights.lights[0]);
+        }
+    }
+
+    if (hasSettings) {
+        settings.fromJson(settingsJson);
+        if (hooks.settingsChanged) {
+            hooks.settingsChanged();
+        }
+    }
+
+    if (hasInfo) {
+        info.fromJson(infoJson);
+        if (hooks.accessoryInfoChanged) {
+            hooks.accessoryInfoChanged();
+        }
+    }
+
+    // one combined response, the lights use the same layout as `GET /elgato/lights`
+    lights.toJson(response);
+    JsonObject settingsResponse = response.createNestedObject("settings");
+    settings.toJson(settingsResponse);
+    JsonObject infoResponse = response.createNestedObject("accessory-info");
+    info.toJson(infoResponse);
+    return 200;
+}
+
+int ElgatoApi::identify(JsonVariant &/* body */, JsonObject &/* response */) {
+    if (isBusy()) {
+        return 503;
+    }
+
+    if (hooks.identify) {
+        hooks.identify();
+    }
+    return 200;
+}
+
+int ElgatoApi::notFound(JsonVariant &/* body */, JsonObject &/* response */) {
+    return 404;
+}
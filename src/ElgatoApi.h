@@ -0,0 +1,83 @@
+#ifndef ESP32_LIGHT_ELGATOAPI_H
+#define ESP32_LIGHT_ELGATOAPI_H
+
+#include <functional>
+#include <ArduinoJson.h>
+#include "AccessoryInfo.h"
+#include "Lights.h"
+#include "Settings.h"
+#include "TrafficCapture.h"
+
+enum ApiMethod {
+    API_GET,
+    API_PUT,
+    API_POST
+};
+
+/*
+ * Side effects of the API, everything hardware or persistence related is kept out of `ElgatoApi` so the same routes can
+ * be served by more than one HTTP server.
+ */
+struct ElgatoApiHooks {
+    std::function<void(Light &)> lightsChanged;
+    std::function<void()> settingsChanged;
+    std::function<void()> accessoryInfoChanged;
+    std::function<void()> identify;
+    // when true, requests that change state are rejected with a 503
+    std::function<bool()> isBusy;
+    // around every handler, e.g. to watch for stalls (`route` indexes `ElgatoApi::routes`)
+    std::function<void(size_t route)> handlerStarted;
+    std::function<void(size_t route)> handlerFinished;
+    // held while a handler runs, for state that is also changed outside the API (MQTT, the CLI)
+    std::function<void()> lockState;
+    std::function<void()> unlockState;
+};
+
+/*
+ * The Elgato routes (under `/elgato/`), independent of the HTTP server that receives the requests.
+ */
+class ElgatoApi {
+
+public:
+    // fills `response` and returns the HTTP status, an empty response means the status is sent without a body
+    typedef int (ElgatoApi::*Handler)(JsonVariant &body, JsonObject &response);
+
+    struct Route {
+        const char *uri;
+        ApiMethod method;
+        Handler handler;
+    };
+
+    static const Route routes[];
+    static const size_t routeCount;
+
+    AccessoryInfo &info;
+    Lights &lights;
+    Settings &settings;
+    ElgatoApiHooks hooks;
+    // when set and active, every handled request is recorded
+    TrafficCapture *capture = nullptr;
+
+    ElgatoApi(AccessoryInfo &info, Lights &lights, Settings &settings) : info(info), lights(lights), settings(settings) {}
+
+    // dispatches to the matching route, 404 for unknown URIs, 405 for unsupported methods and 400 for a PUT without a
+    // JSON body
+    int handle(ApiMethod method, const char *uri, JsonVariant &body, JsonObject &response);
+
+    int handle(const Route &route, JsonVariant &body, JsonObject &response);
+
+    int getAccessoryInfo(JsonVariant &body, JsonObject &response);
+    int putAccessoryInfo(JsonVariant &body, JsonObject &response);
+    int getSettings(JsonVariant &body, JsonObject &response);
+    int putSettings(JsonVariant &body, JsonObject &response);
+    int getLights(JsonVariant &body, JsonObject &response);
+    int putLights(JsonVariant &body, JsonObject &response);
+    int putBatch(JsonVariant &body, JsonObject &response);
+    int identify(JsonVariant &body, JsonObject &response);
+    int notFound(JsonVariant &body, JsonObject &response);
+
+private:
+    bool isBusy() { return hooks.isBusy && hooks.isBusy(); }
+};
+
+#endif //ESP32_LIGHT_ELGATOAPI_H
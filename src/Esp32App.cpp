@@ -3,18 +3,52 @@
 //
 
 #include "Esp32App.h"
+#include "Tasks.h"
+#include "InlineString.h"
 #include <WiFi.h>
 #include <Preferences.h>
 #include <ArduinoOTA.h>
+#include <esp_ota_ops.h>
 
 static SimpleCLI simpleCli;
 
 TaskHandle_t baseAppTask;
 
+static HousekeepingFunction housekeepingFunctions[MAX_HOUSEKEEPING_FUNCTIONS];
+static uint8_t housekeepingCount = 0;
+
+static volatile bool updating = false;
+static TimerHandle_t healthCheckTimer = nullptr;
+
+// keep a new firmware in the pending verify state until `markHealthy()` is called, instead of accepting it as soon as
+// it boots (the Arduino core calls this during startup).  Only with a bootloader built with rollback, see
+// `startProbation()` for the stock one
+extern "C" bool verifyRollbackLater() {
+    return true;
+}
+
+bool Esp32App::isUpdating() {
+    return updating;
+}
+
+void Esp32App::setUpdating(bool isUpdating) {
+    updating = isUpdating;
+}
+
 Command Esp32App::addCommand(const char *name, void (*callback)(cmd *)) {
     return simpleCli.addCommand(name, callback);
 }
 
+void Esp32App::addHousekeeping(HousekeepingFunction function) {
+    if (housekeepingCount < MAX_HOUSEKEEPING_FUNCTIONS) {
+        housekeepingFunctions[housekeepingCount++] = function;
+    }
+}
+
+TaskHandle_t Esp32App::getHousekeepingTask() {
+    return baseAppTask;
+}
+
 void wifiCommandCallback(cmd* c) {
     Command cmd(c);
 
@@ -31,7 +65,7 @@ void wifiCommandCallback(cmd* c) {
     ESP.restart();
 }
 
-void rebootCommandCallback(cmd* c) {
+void rebootCommandCallback(cmd* /* c */) {
     ESP.restart();
 }
 
@@ -69,7 +103,7 @@ void statusCommandCallback(cmd* c) {
     }
 }
 
-void helpCommandCallback(cmd* c) {
+void helpCommandCallback(cmd* /* c */) {
     Serial.println("\nUsage:");
     Serial.println(simpleCli.toString());
 }
@@ -154,22 +188,29 @@ void Esp32App::registerCommands() {
         .setDescription("Prints this help message");
 }
 
-String input;
+// longer lines are rejected instead of parsed truncated, `wifi` with a 32 byte SSID and a 64 byte password fits
+#define CLI_INPUT_LENGTH 160
+
+static InlineString<CLI_INPUT_LENGTH> input;
 void _handleSerialInput() {
     // Check if user typed something into the serial monitor
-    if (Serial.available()) {
+    while (Serial.available()) {
         char c = Serial.read();
 
         if (c == '\b') {
-            input = input.substring(0, input.length() - 1);
+            input.removeLast();
         } else {
-            input += c;
+            input.append(c);
         }
 
         Serial.print(c);
         if (c == '\r') {
-            simpleCli.parse(input);
-            input = "";
+            if (input.truncated()) {
+                Serial.printf("\r\nERROR: commands are limited to %u characters\r\n# ", CLI_INPUT_LENGTH);
+            } else {
+                simpleCli.parse(input.c_str());
+            }
+            input.clear();
         }
     }
 
@@ -193,22 +234,109 @@ void _handleSerialInput() {
 }
 
 boolean otaEnabled = false;
-void loopHandler(void * pvParameters) {
+void loopHandler(void * /* pvParameters */) {
     while (true) {
         _handleSerialInput();
 
         if (otaEnabled) {
             ArduinoOTA.handle();
         }
+
+        for (uint8_t i = 0; i < housekeepingCount; i++) {
+            housekeepingFunctions[i]();
+        }
+
+        // yield to the network tasks sharing this core
+        vTaskDelay(pdMS_TO_TICKS(HOUSEKEEPING_PERIOD_MS));
+    }
+}
+
+// set during the first boot of a firmware written by an update when the bootloader can't roll back, see
+// `Esp32App::prepareRollback()`
+static const esp_partition_t *verifyingPartition = nullptr;
+
+void healthCheckExpired(TimerHandle_t /* timer */) {
+    Serial.println("Firmware health check failed, rolling back to the previous firmware");
+    if (verifyingPartition != nullptr) {
+        // the boot partition already is the previous firmware
+        esp_restart();
+    }
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+// the stock Arduino bootloader is built without CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE, so a new firmware is never
+// pending verification.  Instead the previous firmware is made the boot partition again for as long as the new one is
+// on probation, a failed health check, crash or watchdog reset before `markHealthy()` boots the previous firmware
+bool startProbation(const esp_partition_t *running) {
+    Preferences prefs;
+    prefs.begin("ota", false);
+    String verify = prefs.getString("verify", "");
+    String previous = prefs.getString("previous", "");
+    // only the first boot after the update, a rolled back or USB flashed firmware drops the marker
+    prefs.remove("verify");
+    prefs.end();
+
+    if (verify != running->label) {
+        return false;
+    }
+
+    const esp_partition_t *previousPartition = esp_partition_find_first(ESP_PARTITION_TYPE_APP,
+                                                                        ESP_PARTITION_SUBTYPE_ANY, previous.c_str());
+    if (previousPartition == nullptr || esp_ota_set_boot_partition(previousPartition) != ESP_OK) {
+        Serial.println("Previous firmware not bootable, the new firmware can't be rolled back");
+        return false;
+    }
+    verifyingPartition = running;
+    return true;
+}
+
+void startHealthCheck() {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+
+    // only the first boot of a new firmware is pending verification
+    bool pending = esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY;
+    if (pending || startProbation(running)) {
+        Serial.printf("New firmware, waiting up to %us for the health check\n", OTA_HEALTH_CHECK_SECONDS);
+        healthCheckTimer = xTimerCreate("OTA health check", pdMS_TO_TICKS(OTA_HEALTH_CHECK_SECONDS * 1000), pdFALSE,
+                                        nullptr, healthCheckExpired);
+        xTimerStart(healthCheckTimer, 0);
+    }
+}
+
+void Esp32App::prepareRollback() {
+#ifndef CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE
+    // Update has switched the boot partition to the new firmware, the running one is what to roll back to
+    Preferences prefs;
+    prefs.begin("ota", false);
+    prefs.putString("verify", esp_ota_get_boot_partition()->label);
+    prefs.putString("previous", esp_ota_get_running_partition()->label);
+    prefs.end();
+#endif
+}
+
+void Esp32App::markHealthy() {
+    if (healthCheckTimer != nullptr) {
+        xTimerStop(healthCheckTimer, 0);
+        xTimerDelete(healthCheckTimer, 0);
+        healthCheckTimer = nullptr;
+
+        if (verifyingPartition != nullptr) {
+            esp_ota_set_boot_partition(verifyingPartition);
+            verifyingPartition = nullptr;
+        } else {
+            esp_ota_mark_app_valid_cancel_rollback();
+        }
+        Serial.println("Firmware health check passed");
     }
 }
 
-bool startOTA() {
+bool startOTA(String &pass) {
 
     Preferences prefs;
     prefs.begin("ota", false);
     int port = prefs.getInt("port", 3232);
-    String pass = prefs.getString("pass", "");
+    pass = prefs.getString("pass", "");
     prefs.end();
     Serial.flush();
 
@@ -216,25 +344,29 @@ bool startOTA() {
         ArduinoOTA.setPort(port);
         ArduinoOTA.setHostname(WiFi.getHostname());
         ArduinoOTA.setPassword(pass.c_str());
+        // MdnsDiscovery is the responder, ESPmDNS would take the port (espota.py is given the address anyway)
+        ArduinoOTA.setMdnsEnabled(false);
 
         ArduinoOTA
                 .onStart([]() {
-                    String type;
-                    if (ArduinoOTA.getCommand() == U_FLASH)
-                        type = "sketch";
-                    else // U_SPIFFS
-                        type = "filesystem";
+                    // U_SPIFFS otherwise
+                    const char *type = ArduinoOTA.getCommand() == U_FLASH ? "sketch" : "filesystem";
 
                     // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
-                    Serial.println("Start firmware update: " + type);
+                    Serial.printf("Start firmware update: %s\n", type);
+                    updating = true;
                 })
                 .onEnd([]() {
                     Serial.println("\nFirmware update finished");
+                    Esp32App::prepareRollback();
+                    updating = false;
                 })
                 .onProgress([](unsigned int progress, unsigned int total) {
-                    Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
+                    // total / 100 is zero for images smaller than 100 bytes
+                    Serial.printf("Progress: %u%%\r", total ? (unsigned int) ((uint64_t) progress * 100 / total) : 0);
                 })
                 .onError([](ota_error_t error) {
+                    updating = false;
                     Serial.printf("Error[%u]: ", error);
                     if (error == OTA_AUTH_ERROR) Serial.println("OTA firmware update failed: Authentication Error");
                     else if (error == OTA_BEGIN_ERROR) Serial.println("OTA firmware update failed: Failed to Start");
@@ -254,6 +386,9 @@ bool startOTA() {
 
 void Esp32App::begin() {
 
+    // a new firmware has to prove it works before it replaces the previous one
+    startHealthCheck();
+
     // register CLI commands
     registerCommands();
 
@@ -270,19 +405,19 @@ void Esp32App::begin() {
     if (ssid != "") {
         setupWifi(ssid.c_str(), pass.c_str(), hostname.c_str());
 
-        otaEnabled = startOTA();
+        otaEnabled = startOTA(otaPassword);
     } else {
         defaultNoWifiHandler();
     }
 
     xTaskCreatePinnedToCore(
             loopHandler, /* Task function. */
-            "Serial/Firmware", /* name of task. */
-            10000, /* Stack size of task */
+            "Housekeeping", /* name of task. */
+            HOUSEKEEPING_TASK_STACK_SIZE, /* Stack size of task */
             nullptr, /* parameter of the task */
-            1, /* priority of the task */
+            HOUSEKEEPING_TASK_PRIORITY, /* priority of the task */
             &baseAppTask, /* Task handle to keep track of created task */
-            1); /* pin task to core 0 */
+            HOUSEKEEPING_CORE); /* pin task to the housekeeping core */
 }
 
 
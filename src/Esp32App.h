@@ -8,15 +8,43 @@
 #include <SimpleCLI.h>
 #include <esp_task.h>
 
+// seconds a freshly updated firmware has to call `markHealthy()` before it is rolled back to the previous firmware
+#define OTA_HEALTH_CHECK_SECONDS 60
+
+#define MAX_HOUSEKEEPING_FUNCTIONS 4
+
+typedef void (*HousekeepingFunction)();
+
 class Esp32App {
 
 protected:
+    // password for firmware updates, empty if updates are disabled
+    String otaPassword;
+
     virtual void registerCommands();
 
+    static void setUpdating(bool updating);
+
 public:
 
+    // true while a firmware update is being written, the light state should not be changed during an update
+    static bool isUpdating();
+
+    // after an update has been written, lets the new firmware be rolled back when it fails its health check (with the
+    // stock bootloader, which can't do it by itself)
+    static void prepareRollback();
+
+    // confirms a newly updated firmware is working (HTTP is up and the light output restored), otherwise it is rolled
+    // back after OTA_HEALTH_CHECK_SECONDS
+    void markHealthy();
+
     Command addCommand(const char* name, void (* callback)(cmd* c));
 
+    // runs `function` periodically from the low priority housekeeping task, must be called before `begin()`
+    void addHousekeeping(HousekeepingFunction function);
+
+    static TaskHandle_t getHousekeepingTask();
+
     static void defaultNoWifiHandler() {
         Serial.println("WiFi not configured use 'wifi -ssid <your-ssid> -pass <your-pass>'");
     }
@@ -3,6 +3,61 @@
 //
 
 #include "Esp32WebApp.h"
+#include <Update.h>
+#include "InlineString.h"
+
+// firmware is buffered and handed to the flash writer in multiples of the flash sector size, instead of one call per
+// TCP segment
+#define UPDATE_CHUNK_SIZE (4 * SPI_FLASH_SEC_SIZE)
+#define NOT_FOUND_MESSAGE_LENGTH 1024
+
+// state of a POST /update, kept in the request's `_tempObject` (freed with the request).  Only the request that owns
+// the running update gets the chunk buffer, a rejected one just carries its status to the response
+struct FirmwareUpload {
+    // 0 while the upload is running
+    int status;
+    size_t chunkLength;
+    unsigned long startMs;
+    unsigned long flushUs;
+
+    // UPDATE_CHUNK_SIZE bytes follow the owner's state
+    uint8_t *chunk() {
+        return reinterpret_cast<uint8_t *>(this + 1);
+    }
+};
+
+// the request that owns `Update`, only one update can run at a time
+static AsyncWebServerRequest *updateRequest = nullptr;
+
+FirmwareUpload *createUpload(AsyncWebServerRequest *request, size_t chunkSize, int status) {
+    auto *upload = (FirmwareUpload *) malloc(sizeof(FirmwareUpload) + chunkSize);
+    if (upload != nullptr) {
+        *upload = {status, 0, 0, 0};
+    }
+    request->_tempObject = upload;
+    return upload;
+}
+
+// leaves an update running on another request alone
+void rejectUpload(AsyncWebServerRequest *request, int status) {
+    createUpload(request, 0, status);
+}
+
+void endUpdate(FirmwareUpload *upload, int status) {
+    upload->status = status;
+    upload->chunkLength = 0;
+    updateRequest = nullptr;
+}
+
+bool flushUpdateChunk(FirmwareUpload *upload) {
+    unsigned long start = micros();
+    size_t written = Update.write(upload->chunk(), upload->chunkLength);
+    upload->flushUs += micros() - start;
+
+    bool success = written == upload->chunkLength;
+    upload->chunkLength = 0;
+    return success;
+}
 
 void Esp32WebApp::registerCommands() {
     Esp32App::registerCommands();
@@ -11,28 +66,136 @@ void Esp32WebApp::registerCommands() {
 Esp32WebApp::Esp32WebApp(AsyncWebServer &server) : server(server) {
 
     server.onNotFound([](AsyncWebServerRequest *request) {
-        String message = "File Not Found 404\n\n";
-        message += "URI: ";
-        message += request->url();
-        message += "\nMethod: ";
-        message += (request->method() == HTTP_GET) ? "GET" : "POST";
-        message += "\nArguments: ";
-        message += request->args();
-        message += "\n";
+        // built in place, long URIs, arguments and headers are cut off
+        InlineString<NOT_FOUND_MESSAGE_LENGTH> message;
+        message.appendf("File Not Found 404\n\nURI: %s\nMethod: %s\nArguments: %u\n", request->url().c_str(),
+                        request->method() == HTTP_GET ? "GET" : "POST", (unsigned int) request->args());
         for (uint8_t i = 0; i < request->args(); i++) {
-            message += " " + request->argName(i) + ": " + request->arg(i) + "\n";
+            message.appendf(" %s: %s\n", request->argName(i).c_str(), request->arg(i).c_str());
         }
 
-        message += "\nHeaders: ";
-        message += request->headers();
-        message += "\n";
+        message.appendf("\nHeaders: %u\n", (unsigned int) request->headers());
         for (uint8_t i = 0; i < request->headers(); i++) {
-            message += " " + request->headerName(i) + ": " + request->header(i) + "\n";
+            message.appendf(" %s: %s\n", request->headerName(i).c_str(), request->header(i).c_str());
         }
 
         Serial.println(404);
-        Serial.println(message);
-        request->send(404, "text/plain", message);
+        Serial.println(message.c_str());
+        request->send(404, "text/plain", message.c_str());
+    });
+}
+
+void Esp32WebApp::registerUpdateHandler() {
+
+    // POST /update - streams a firmware image, e.g.:
+    // curl -u ota:<pass> -H "Content-Type: application/octet-stream" --data-binary @firmware.bin \
+    //     http://<device-ip>:9123/update?md5=<md5>
+    // (with curl's default form content type the body would be parsed as form fields and never reach the handler)
+    server.on("/update", HTTP_POST, [](AsyncWebServerRequest *request) {
+        // without a body the upload never started
+        auto *upload = (FirmwareUpload *) request->_tempObject;
+        int status = upload != nullptr ? upload->status : 400;
+
+        if (status == 401) {
+            request->requestAuthentication();
+            return;
+        }
+
+        if (status == 200) {
+            // restart into the new firmware once the response has been delivered
+            request->onDisconnect([]() {
+                ESP.restart();
+            });
+            request->send(200, "text/plain", "Firmware updated, restarting");
+        } else if (status == 409) {
+            request->send(409, "text/plain", "Another firmware update is running");
+        } else {
+            request->send(status, "text/plain", Update.errorString());
+        }
+    }, nullptr, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+
+        if (index == 0) {
+            if (!request->authenticate("ota", otaPassword.c_str())) {
+                rejectUpload(request, 401);
+                return;
+            }
+
+            if (Update.isRunning() || updateRequest != nullptr) {
+                rejectUpload(request, 409);
+                return;
+            }
+
+            FirmwareUpload *upload = createUpload(request, UPDATE_CHUNK_SIZE, 0);
+            if (upload == nullptr) {
+                rejectUpload(request, 500);
+                return;
+            }
+
+            // Update validates the image header, and the whole image before switching the boot partition
+            if (!Update.begin(total, U_FLASH)) {
+                upload->status = 400;
+                return;
+            }
+
+            if (request->hasParam("md5")) {
+                Update.setMD5(request->getParam("md5")->value().c_str());
+            }
+
+            // the running firmware is untouched until the update ends, an interrupted upload can simply be retried
+            request->onDisconnect([request]() {
+                if (updateRequest == request) {
+                    Serial.println("Firmware update interrupted");
+                    Update.abort();
+                    endUpdate((FirmwareUpload *) request->_tempObject, 400);
+                    setUpdating(false);
+                }
+            });
+
+            Serial.printf("Start firmware update: %u bytes\n", total);
+            upload->startMs = millis();
+            updateRequest = request;
+            setUpdating(true);
+        }
+
+        // rejected, or the update already ended
+        auto *upload = (FirmwareUpload *) request->_tempObject;
+        if (upload == nullptr || upload->status != 0 || updateRequest != request) {
+            return;
+        }
+
+        bool last = index + len == total;
+        while (len > 0) {
+            size_t copy = min(len, (size_t) UPDATE_CHUNK_SIZE - upload->chunkLength);
+            memcpy(upload->chunk() + upload->chunkLength, data, copy);
+            upload->chunkLength += copy;
+            data += copy;
+            len -= copy;
+
+            if (upload->chunkLength == UPDATE_CHUNK_SIZE && !flushUpdateChunk(upload)) {
+                Serial.printf("Firmware update failed: %s\n", Update.errorString());
+                Update.abort();
+                endUpdate(upload, 500);
+                setUpdating(false);
+                return;
+            }
+        }
+
+        if (last) {
+            bool success = (upload->chunkLength == 0 || flushUpdateChunk(upload)) && Update.end();
+            unsigned long elapsedMs = max(millis() - upload->startMs, 1UL);
+
+            if (success) {
+                Serial.printf("Firmware update finished: %u bytes in %lums (%lu KB/s, flash writes %lums)\n",
+                              total, elapsedMs, total / elapsedMs, upload->flushUs / 1000);
+                prepareRollback();
+            } else {
+                Serial.printf("Firmware update failed: %s\n", Update.errorString());
+                Update.abort();
+            }
+
+            endUpdate(upload, success ? 200 : 500);
+            setUpdating(false);
+        }
     });
 }
 
@@ -41,6 +204,10 @@ void Esp32WebApp::begin() {
 
     if (WiFi.status() == WL_CONNECTED) {
 
+        if (!otaPassword.isEmpty()) {
+            registerUpdateHandler();
+        }
+
         server.begin();
         Serial.println("HTTP server started");
     }
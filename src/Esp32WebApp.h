@@ -13,6 +13,8 @@ class Esp32WebApp: public Esp32App {
 private:
     AsyncWebServer &server;
 
+    void registerUpdateHandler();
+
 protected:
     void registerCommands() override;
 
@@ -0,0 +1,29 @@
+#ifndef ESP32_LIGHT_FLASHBACKEND_H
+#define ESP32_LIGHT_FLASHBACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the erase unit of the ESP32's SPI flash
+#define FLASH_SECTOR_SIZE 4096
+
+/*
+ * Raw NOR flash, a partition on the device (PartitionFlash) or an emulation on the host.  Writes can only clear bits,
+ * so a region has to be erased (set to 0xFF) a sector at a time before it is written again.  Offsets are relative to
+ * the start of the region.
+ */
+class FlashBackend {
+
+public:
+    virtual ~FlashBackend() = default;
+
+    // bytes available, a multiple of FLASH_SECTOR_SIZE
+    virtual size_t size() const = 0;
+
+    virtual bool read(size_t offset, void *data, size_t length) = 0;
+    virtual bool write(size_t offset, const void *data, size_t length) = 0;
+    // `offset` is the start of a sector
+    virtual bool eraseSector(size_t offset) = 0;
+};
+
+#endif //ESP32_LIGHT_FLASHBACKEND_H
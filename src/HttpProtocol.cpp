@@ -0,0 +1,193 @@
+#include "HttpProtocol.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+const char *statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+// finds the next CRLF in [from, end)
+const char *findCrlf(const char *from, const char *end) {
+    for (const char *c = from; c + 1 < end; c++) {
+        if (c[0] == '\r' && c[1] == '\n') {
+            return c;
+        }
+    }
+    return nullptr;
+}
+
+// returns the value of the header if `line` is that header, otherwise nullptr
+const char *headerValue(const char *line, const char *name) {
+    size_t length = strlen(name);
+    if (strncasecmp(line, name, length) != 0 || line[length] != ':') {
+        return nullptr;
+    }
+
+    const char *value = line + length + 1;
+    while (*value == ' ') {
+        value++;
+    }
+    return value;
+}
+
+// a Content-Length is digits only up to the end of the line (trailing spaces aside), anything else (signs, overflow)
+// is rejected
+bool parseContentLength(const char *value, const char *lineEnd, size_t &length) {
+    length = 0;
+    while (lineEnd > value && (lineEnd[-1] == ' ' || lineEnd[-1] == '\t')) {
+        lineEnd--;
+    }
+    if (value >= lineEnd) {
+        return false;
+    }
+    for (const char *c = value; c < lineEnd; c++) {
+        if (*c < '0' || *c > '9') {
+            return false;
+        }
+        size_t digit = *c - '0';
+        if (length > (SIZE_MAX - digit) / 10) {
+            return false;
+        }
+        length = length * 10 + digit;
+    }
+    return true;
+}
+
+HttpParseResult parseHttpRequest(char *buffer, size_t length, size_t capacity, HttpRequest &request) {
+    request = HttpRequest();
+    request.keepAlive = true;
+
+    const char *end = buffer + length;
+    const char *headersEnd = nullptr;
+    for (const char *crlf = findCrlf(buffer, end); crlf != nullptr; crlf = findCrlf(crlf + 2, end)) {
+        if (crlf + 4 <= end && crlf[2] == '\r' && crlf[3] == '\n') {
+            headersEnd = crlf;
+            break;
+        }
+    }
+
+    if (headersEnd == nullptr) {
+        if (length < capacity) {
+            // wait for the rest of the headers
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        request.length = length;
+        request.keepAlive = false;
+        request.status = 413;
+        return HTTP_PARSE_ERROR;
+    }
+
+    // headers, only the ones that affect framing are interesting
+    const char *lineEnd = findCrlf(buffer, headersEnd + 2);
+    bool connectionHeader = false;
+    for (const char *line = lineEnd + 2; line < headersEnd; line = findCrlf(line, headersEnd + 2) + 2) {
+        const char *value;
+        if ((value = headerValue(line, "Content-Length")) != nullptr) {
+            if (!parseContentLength(value, findCrlf(line, headersEnd + 2), request.bodyLength)) {
+                // the framing can't be trusted anymore
+                request.length = length;
+                request.keepAlive = false;
+                request.status = 400;
+                return HTTP_PARSE_ERROR;
+            }
+        } else if ((value = headerValue(line, "Connection")) != nullptr) {
+            connectionHeader = true;
+            request.keepAlive = strncasecmp(value, "close", 5) != 0;
+        }
+    }
+
+    size_t headersLength = headersEnd + 4 - buffer;
+    // compared this way around so a huge Content-Length can't wrap
+    if (request.bodyLength > capacity - headersLength) {
+        // the framing can't be trusted anymore
+        request.length = length;
+        request.keepAlive = false;
+        request.status = 413;
+        return HTTP_PARSE_ERROR;
+    }
+
+    if (length < headersLength + request.bodyLength) {
+        // wait for the rest of the body
+        return HTTP_PARSE_INCOMPLETE;
+    }
+
+    request.length = headersLength + request.bodyLength;
+    request.body = buffer + headersLength;
+
+    // request line: <method> <uri> HTTP/1.x
+    buffer[lineEnd - buffer] = '\0';
+    char *uri = strchr(buffer, ' ');
+    char *version = uri != nullptr ? strchr(uri + 1, ' ') : nullptr;
+    if (version == nullptr) {
+        request.keepAlive = false;
+        request.status = 400;
+        return HTTP_PARSE_ERROR;
+    }
+
+    *uri++ = '\0';
+    *version++ = '\0';
+    request.method = buffer;
+    request.uri = uri;
+
+    // HTTP/1.0 closes by default, HTTP/1.1 keeps the connection open by default
+    if (!connectionHeader) {
+        request.keepAlive = strcmp(version, "HTTP/1.0") != 0;
+    }
+
+    char *query = strchr(uri, '?');
+    if (query != nullptr) {
+        *query = '\0';
+    }
+
+    return HTTP_PARSE_OK;
+}
+
+int handleHttpRequest(ElgatoApi &api, const HttpRequest &request, JsonDocument &requestDoc, JsonDocument &responseDoc) {
+    JsonObject response = responseDoc.to<JsonObject>();
+    JsonVariant json;
+
+    if (request.bodyLength > 0) {
+        if (deserializeJson(requestDoc, request.body, request.bodyLength)) {
+            return 400;
+        }
+        json = requestDoc.as<JsonVariant>();
+    }
+
+    if (strcmp(request.method, "GET") == 0) {
+        return api.handle(API_GET, request.uri, json, response);
+    } else if (strcmp(request.method, "PUT") == 0) {
+        return api.handle(API_PUT, request.uri, json, response);
+    } else if (strcmp(request.method, "POST") == 0) {
+        return api.handle(API_POST, request.uri, json, response);
+    }
+    return 405;
+}
+
+size_t writeHttpResponse(int status, JsonDocument &body, bool keepAlive, char *out, size_t capacity) {
+    size_t bodyLength = body.size() > 0 ? measureJson(body) : 0;
+
+    int headLength = snprintf(out, capacity, "HTTP/1.1 %d %s\r\n%sContent-Length: %u\r\nConnection: %s\r\n\r\n",
+                              status, statusText(status),
+                              bodyLength > 0 ? "Content-Type: application/json\r\n" : "",
+                              (unsigned int) bodyLength, keepAlive ? "keep-alive" : "close");
+
+    // serializeJson also writes a terminating zero
+    if (headLength < 0 || headLength + bodyLength + 1 > capacity) {
+        return 0;
+    }
+
+    if (bodyLength > 0) {
+        serializeJson(body, out + headLength, capacity - headLength);
+    }
+    return headLength + bodyLength;
+}
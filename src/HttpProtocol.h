@@ -0,0 +1,41 @@
+#ifndef ESP32_LIGHT_HTTPPROTOCOL_H
+#define ESP32_LIGHT_HTTPPROTOCOL_H
+
+#include <stddef.h>
+#include <ArduinoJson.h>
+#include "ElgatoApi.h"
+
+/*
+ * HTTP/1.1 request parsing and response writing for the routes under `/elgato/`, without any networking so it is
+ * shared by `KeepAliveServer` on the device and the host tools.
+ */
+
+enum HttpParseResult {
+    HTTP_PARSE_INCOMPLETE,
+    HTTP_PARSE_OK,
+    HTTP_PARSE_ERROR
+};
+
+struct HttpRequest {
+    const char *method;
+    const char *uri;
+    const char *body;
+    size_t bodyLength;
+    // bytes of the buffer used by this request, the next pipelined request starts after them
+    size_t length;
+    bool keepAlive;
+    // the status to respond with when parsing failed
+    int status;
+};
+
+// parses the request at the start of `buffer`, which is modified in place (`capacity` is the size of the whole buffer,
+// a request that can't fit is an error)
+HttpParseResult parseHttpRequest(char *buffer, size_t length, size_t capacity, HttpRequest &request);
+
+// dispatches a parsed request to the matching route, and returns the HTTP status
+int handleHttpRequest(ElgatoApi &api, const HttpRequest &request, JsonDocument &requestDoc, JsonDocument &responseDoc);
+
+// writes the status line, headers and (when not empty) the JSON body, returns the bytes written or 0 if it does not fit
+size_t writeHttpResponse(int status, JsonDocument &body, bool keepAlive, char *out, size_t capacity);
+
+#endif //ESP32_LIGHT_HTTPPROTOCOL_H
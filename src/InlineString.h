@@ -0,0 +1,129 @@
+#ifndef ESP32_LIGHT_INLINESTRING_H
+#define ESP32_LIGHT_INLINESTRING_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * String of at most `Capacity` bytes stored inline, for values that live as long as the device runs (accessory info,
+ * the CLI line) and would otherwise reallocate an Arduino `String` on every change.
+ *
+ * Values that are too long are truncated at the last complete UTF-8 character that fits, and `truncated()` is set until
+ * the next assignment.  Use `isValidJsonString()` to reject them before they get here.
+ */
+template<size_t Capacity>
+class InlineString {
+
+private:
+    char value[Capacity + 1] = "";
+    size_t valueLength = 0;
+    bool wasTruncated = false;
+
+    // `length` without a UTF-8 character that is cut off at the end
+    static size_t completeLength(const char *text, size_t length) {
+        // back up over the continuation bytes (10xxxxxx) to the lead byte of the last character
+        size_t lead = length;
+        while (lead > 0 && length - lead < 3 && ((uint8_t) text[lead - 1] & 0xC0) == 0x80) {
+            lead--;
+        }
+        if (lead == 0 || (uint8_t) text[lead - 1] < 0xC0) {
+            return length;
+        }
+
+        auto first = (uint8_t) text[lead - 1];
+        size_t expected = first >= 0xF0 ? 4 : (first >= 0xE0 ? 3 : 2);
+        return length - (lead - 1) < expected ? lead - 1 : length;
+    }
+
+    // bytes of `text` (`length` long) that fit in `space`
+    static size_t fitting(const char *text, size_t length, size_t space) {
+        return length <= space ? length : completeLength(text, space);
+    }
+
+public:
+    InlineString() = default;
+
+    InlineString(const char *text) { // NOLINT(google-explicit-constructor)
+        assign(text);
+    }
+
+    InlineString &operator=(const char *text) {
+        assign(text);
+        return *this;
+    }
+
+    void assign(const char *text) {
+        valueLength = 0;
+        wasTruncated = false;
+        append(text);
+    }
+
+    void append(const char *text) {
+        if (text == nullptr) {
+            return;
+        }
+        size_t length = strlen(text);
+        size_t copy = fitting(text, length, Capacity - valueLength);
+        memcpy(value + valueLength, text, copy);
+        valueLength += copy;
+        value[valueLength] = '\0';
+        wasTruncated |= copy < length;
+    }
+
+    void append(char c) {
+        if (valueLength == Capacity) {
+            wasTruncated = true;
+            return;
+        }
+        value[valueLength++] = c;
+        value[valueLength] = '\0';
+    }
+
+    // printf style append, truncated like `append()`
+    void appendf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(value + valueLength, Capacity + 1 - valueLength, format, args);
+        va_end(args);
+
+        if (length < 0) {
+            value[valueLength] = '\0';
+            return;
+        }
+        if (valueLength + length > Capacity) {
+            // vsnprintf cuts at a byte, not a character
+            valueLength += completeLength(value + valueLength, Capacity - valueLength);
+            value[valueLength] = '\0';
+            wasTruncated = true;
+            return;
+        }
+        valueLength += length;
+    }
+
+    // removes the last byte, e.g. for a backspace
+    void removeLast() {
+        if (valueLength > 0) {
+            value[--valueLength] = '\0';
+        }
+    }
+
+    void clear() {
+        assign("");
+    }
+
+    const char *c_str() const { return value; }
+    // non const, so ArduinoJson copies the value instead of keeping a pointer to it
+    char *data() { return value; }
+    size_t length() const { return valueLength; }
+    bool isEmpty() const { return valueLength == 0; }
+    bool truncated() const { return wasTruncated; }
+    static constexpr size_t capacity() { return Capacity; }
+
+    bool operator==(const char *text) const { return strcmp(value, text) == 0; }
+    bool operator!=(const char *text) const { return strcmp(value, text) != 0; }
+};
+
+#endif //ESP32_LIGHT_INLINESTRING_H
@@ -0,0 +1,23 @@
+#ifndef ESP32_LIGHT_JSONVALIDATION_H
+#define ESP32_LIGHT_JSONVALIDATION_H
+
+#include <string.h>
+#include <ArduinoJson.h>
+
+// a missing value is valid, otherwise it must be an integer within [min, max]
+inline bool isValidJsonInteger(JsonVariantConst value, long min, long max) {
+    if (value.isNull()) {
+        return true;
+    }
+    return value.is<long>() && value.as<long>() >= min && value.as<long>() <= max;
+}
+
+// a missing value is valid, otherwise it must be a string of at most `maxLength` characters
+inline bool isValidJsonString(JsonVariantConst value, size_t maxLength) {
+    if (value.isNull()) {
+        return true;
+    }
+    return value.is<const char *>() && strlen(value.as<const char *>()) <= maxLength;
+}
+
+#endif //ESP32_LIGHT_JSONVALIDATION_H
@@ -0,0 +1,249 @@
+#include "KeepAliveServer.h"
+#include "HttpProtocol.h"
+#include <Arduino.h>
+
+// responses are assembled here, all callbacks run on the AsyncTCP task so one buffer is enough
+static char responseBuffer[KEEP_ALIVE_RESPONSE_BUFFER_SIZE];
+
+KeepAliveServer::KeepAliveServer(uint16_t port, ElgatoApi &api) : server(port), api(api) {}
+
+void KeepAliveServer::begin() {
+    server.onClient([](void *arg, AsyncClient *client) {
+        ((KeepAliveServer *) arg)->onConnect(client);
+    }, this);
+
+    // small responses should not wait for the ACK of the previous segment (Nagle)
+    server.setNoDelay(true);
+    server.begin();
+}
+
+KeepAliveServer::Connection *KeepAliveServer::findConnection(AsyncClient *client) {
+    for (auto &connection : connections) {
+        if (connection.client == client) {
+            return &connection;
+        }
+    }
+    return nullptr;
+}
+
+void KeepAliveServer::onConnect(AsyncClient *client) {
+    Connection *connection = findConnection(nullptr);
+
+    if (connection == nullptr) {
+        // the pool is full, make room by closing the connection that has been idle the longest
+        Connection *idlest = nullptr;
+        for (auto &candidate : connections) {
+            if (candidate.requestLength == 0 && !candidate.closing
+                && (idlest == nullptr || candidate.lastActiveMs < idlest->lastActiveMs)) {
+                idlest = &candidate;
+            }
+        }
+
+        if (idlest == nullptr) {
+            connectionsRejected++;
+            client->close(true);
+            delete client;
+            return;
+        }
+
+        connectionsEvicted++;
+        idlest->client->close(true);
+        connection = findConnection(nullptr);
+    }
+
+    connectionsAccepted++;
+    connection->client = client;
+    connection->requestLength = 0;
+    connection->requests = 0;
+    connection->closing = false;
+    connection->lastActiveMs = millis();
+
+    client->setRxTimeout(KEEP_ALIVE_IDLE_TIMEOUT_S);
+
+    client->onData([](void *arg, AsyncClient *c, void *data, size_t len) {
+        auto *server = (KeepAliveServer *) arg;
+        Connection *connection = server->findConnection(c);
+        if (connection != nullptr) {
+            server->onData(*connection, (const char *) data, len);
+        }
+    }, this);
+
+    client->onAck([](void *arg, AsyncClient *c, size_t /* len */, uint32_t /* time */) {
+        auto *server = (KeepAliveServer *) arg;
+        Connection *connection = server->findConnection(c);
+        if (connection == nullptr) {
+            return;
+        }
+
+        if (connection->closing) {
+            // the last response has been delivered
+            server->close(*connection);
+        } else {
+            // continue with pipelined requests that did not fit in the send buffer
+            server->processRequests(*connection);
+        }
+    }, this);
+
+    client->onTimeout([](void *arg, AsyncClient *c, uint32_t /* time */) {
+        auto *server = (KeepAliveServer *) arg;
+        Connection *connection = server->findConnection(c);
+        if (connection != nullptr) {
+            server->close(*connection);
+        }
+    }, this);
+
+    client->onDisconnect([](void *arg, AsyncClient *c) {
+        auto *server = (KeepAliveServer *) arg;
+        Connection *connection = server->findConnection(c);
+        if (connection != nullptr) {
+            connection->client = nullptr;
+            connection->requestLength = 0;
+        }
+        delete c;
+    }, this);
+}
+
+void KeepAliveServer::close(Connection &connection) {
+    // triggers onDisconnect, which frees the connection
+    connection.client->close(true);
+}
+
+void KeepAliveServer::onData(Connection &connection, const char *data, size_t len) {
+    connection.lastActiveMs = millis();
+
+    if (connection.closing) {
+        return;
+    }
+
+    while (len > 0 && !connection.closing) {
+        size_t space = sizeof(connection.request) - connection.requestLength;
+        if (space == 0) {
+            // the client pipelines more than can be buffered without reading its responses
+            StaticJsonDocument<16> empty;
+            size_t responseLength = writeHttpResponse(503, empty, false, responseBuffer, sizeof(responseBuffer));
+            connection.client->add(responseBuffer, responseLength);
+            connection.client->send();
+            connection.closing = true;
+            return;
+        }
+
+        size_t copy = min(len, space);
+        memcpy(connection.request + connection.requestLength, data, copy);
+        connection.requestLength += copy;
+        data += copy;
+        len -= copy;
+
+        processRequests(connection);
+    }
+}
+
+void KeepAliveServer::processRequests(Connection &connection) {
+    AsyncClient *client = connection.client;
+    size_t responseLength = 0;
+
+    while (!connection.closing && connection.requestLength > 0) {
+
+        // a pipelined response must not be split by a full send buffer
+        if (client->space() < responseLength + sizeof(responseBuffer)) {
+            break;
+        }
+
+        HttpRequest request;
+        HttpParseResult result = parseHttpRequest(connection.request, connection.requestLength,
+                                                  sizeof(connection.request), request);
+        if (result == HTTP_PARSE_INCOMPLETE) {
+            break;
+        }
+
+        unsigned long start = micros();
+
+        StaticJsonDocument<1024> requestDoc;
+        StaticJsonDocument<1024> responseDoc;
+        int status = result == HTTP_PARSE_OK
+                ? handleHttpRequest(api, request, requestDoc, responseDoc)
+                : request.status;
+
+        // status line, headers and body end up in one buffer, and pipelined responses are sent as one segment
+        size_t written = writeHttpResponse(status, responseDoc, request.keepAlive, responseBuffer + responseLength,
+                                           sizeof(responseBuffer) - responseLength);
+        if (written == 0 && responseLength > 0) {
+            client->add(responseBuffer, responseLength);
+            responseLength = 0;
+            written = writeHttpResponse(status, responseDoc, request.keepAlive, responseBuffer, sizeof(responseBuffer));
+        }
+        if (written == 0) {
+            // the response doesn't fit even on its own (the buffer was flushed above), the client still gets an
+            // answer instead of waiting for it on an open connection
+            StaticJsonDocument<16> empty;
+            written = writeHttpResponse(500, empty, false, responseBuffer, sizeof(responseBuffer));
+            request.keepAlive = false;
+        }
+        responseLength += written;
+
+        // latency histogram, bucket n counts latencies below 2^(n+1) microseconds
+        unsigned long elapsedUs = micros() - start;
+        uint8_t bucket = 0;
+        while (bucket < KEEP_ALIVE_LATENCY_BUCKETS - 1 && (elapsedUs >> (bucket + 1)) > 0) {
+            bucket++;
+        }
+        latencyBuckets[bucket]++;
+
+        requestsHandled++;
+        if (connection.requests++ > 0) {
+            requestsReused++;
+        }
+
+        // drop the handled request, the next pipelined request moves to the front
+        memmove(connection.request, connection.request + request.length, connection.requestLength - request.length);
+        connection.requestLength -= request.length;
+
+        if (!request.keepAlive) {
+            connection.closing = true;
+        }
+    }
+
+    if (responseLength > 0) {
+        client->add(responseBuffer, responseLength);
+        client->send();
+    }
+}
+
+uint32_t KeepAliveServer::latencyPercentile(uint8_t percentile) {
+    uint32_t total = 0;
+    for (uint32_t count : latencyBuckets) {
+        total += count;
+    }
+
+    uint32_t target = (total * percentile + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t bucket = 0; bucket < KEEP_ALIVE_LATENCY_BUCKETS; bucket++) {
+        seen += latencyBuckets[bucket];
+        if (seen >= target && seen > 0) {
+            return 1UL << (bucket + 1);
+        }
+    }
+    return 0;
+}
+
+void KeepAliveServer::printStats() {
+    uint8_t open = 0;
+    for (auto &connection : connections) {
+        if (connection.client != nullptr) {
+            open++;
+        }
+    }
+
+    Serial.printf("\tKeep-alive connections: %u open, %u accepted, %u evicted, %u rejected\n",
+                  open, connectionsAccepted, connectionsEvicted, connectionsRejected);
+    Serial.printf("\tKeep-alive requests: %u handled, %u on reused connections\n", requestsHandled, requestsReused);
+    Serial.printf("\tKeep-alive latency: p50 < %uus, p99 < %uus\n", latencyPercentile(50), latencyPercentile(99));
+}
+
+void KeepAliveServer::resetStats() {
+    connectionsAccepted = 0;
+    connectionsEvicted = 0;
+    connectionsRejected = 0;
+    requestsHandled = 0;
+    requestsReused = 0;
+    memset(latencyBuckets, 0, sizeof(latencyBuckets));
+}
@@ -0,0 +1,63 @@
+#ifndef ESP32_LIGHT_KEEPALIVESERVER_H
+#define ESP32_LIGHT_KEEPALIVESERVER_H
+
+#include <AsyncTCP.h>
+#include "ElgatoApi.h"
+
+// connections kept open at the same time, when full the least recently used idle connection is closed
+#define KEEP_ALIVE_MAX_CONNECTIONS 4
+#define KEEP_ALIVE_IDLE_TIMEOUT_S 30
+// a complete request (headers and body) has to fit, the Elgato requests are well below this
+#define KEEP_ALIVE_REQUEST_BUFFER_SIZE 1024
+// responses of pipelined requests are combined into one write, up to this size
+#define KEEP_ALIVE_RESPONSE_BUFFER_SIZE 1460
+#define KEEP_ALIVE_LATENCY_BUCKETS 20
+
+/*
+ * Minimal HTTP/1.1 server for the routes under `/elgato/` with persistent connections.
+ *
+ * `AsyncWebServer` closes the connection after every response, so every request costs a TCP handshake and a new
+ * `AsyncClient`.  This server keeps a bounded pool of connections open, handles pipelined requests in order, and
+ * writes the status line, headers and body of small responses as one segment.
+ */
+class KeepAliveServer {
+
+private:
+    struct Connection {
+        AsyncClient *client = nullptr;
+        char request[KEEP_ALIVE_REQUEST_BUFFER_SIZE];
+        size_t requestLength = 0;
+        uint32_t requests = 0;
+        unsigned long lastActiveMs = 0;
+        bool closing = false;
+    };
+
+    AsyncServer server;
+    ElgatoApi &api;
+    Connection connections[KEEP_ALIVE_MAX_CONNECTIONS];
+
+    // statistics, latency is the time from a complete request to its response being queued
+    uint32_t connectionsAccepted = 0;
+    uint32_t connectionsEvicted = 0;
+    uint32_t connectionsRejected = 0;
+    uint32_t requestsHandled = 0;
+    uint32_t requestsReused = 0;
+    uint32_t latencyBuckets[KEEP_ALIVE_LATENCY_BUCKETS] = {};
+
+    void onConnect(AsyncClient *client);
+    void onData(Connection &connection, const char *data, size_t len);
+    void processRequests(Connection &connection);
+    void close(Connection &connection);
+    Connection *findConnection(AsyncClient *client);
+    uint32_t latencyPercentile(uint8_t percentile);
+
+public:
+    KeepAliveServer(uint16_t port, ElgatoApi &api);
+
+    void begin();
+
+    void printStats();
+    void resetStats();
+};
+
+#endif //ESP32_LIGHT_KEEPALIVESERVER_H
@@ -0,0 +1,425 @@
+#include "LightInstance.h"
+#include <AsyncJson.h>
+#include <Preferences.h>
+#include "JsonCallbackHandler.h"
+#include "FakeLight.h"
+#include "Esp32App.h"
+
+LightInstance::LightInstance(uint8_t index, uint8_t pin, uint8_t channel, uint8_t indicatorPin)
+        : index(index),
+          port(LIGHT_INSTANCE_PORT + 2 * index),
+          keepAlivePort(LIGHT_INSTANCE_PORT + 2 * index + 1),
+          server(port),
+          api(info, lights, settings),
+          keepAliveServer(keepAlivePort, api),
+          output(pin, channel, indicatorPin) {
+
+    stateLock = xSemaphoreCreateMutexStatic(&stateLockBuffer);
+
+    if (index == 0) {
+        strcpy(preferencesName, "fake-light");
+    } else {
+        snprintf(preferencesName, sizeof(preferencesName), "fake-light-%u", index);
+    }
+}
+
+void LightInstance::loadIdentity() {
+    // instance 0 has the defaults from FakeLight.h, the others count up from there
+    char defaultServiceName[64] = DEFAULT_SERVICE_NAME;
+    char defaultDeviceId[] = DEFAULT_DEVICE_ID;
+    char defaultDisplayName[64] = DEFAULT_DISPLAY_NAME;
+    if (index > 0) {
+        snprintf(defaultServiceName, sizeof(defaultServiceName), "%s-%u", DEFAULT_SERVICE_NAME, index + 1);
+        snprintf(defaultDeviceId + 15, 3, "%02X", (unsigned int) ((strtoul(defaultDeviceId + 15, nullptr, 16) + index) & 0xFF));
+        snprintf(defaultDisplayName, sizeof(defaultDisplayName), "%s %u", DEFAULT_DISPLAY_NAME, index + 1);
+
+        char serialNumber[16];
+        snprintf(serialNumber, sizeof(serialNumber), "%.7s%05lu", info.serialNumber.c_str(),
+                 strtoul(info.serialNumber.c_str() + 7, nullptr, 10) + index);
+        info.serialNumber = serialNumber;
+    }
+
+    Preferences preferences;
+    preferences.begin(preferencesName, false);
+    serviceName = preferences.getString("service_name", defaultServiceName);
+    deviceId = preferences.getString("device_id", defaultDeviceId);
+    // read into the inline buffer, values longer than the limit were never stored
+    char displayName[MAX_DISPLAY_NAME_LENGTH + 1];
+    info.displayName = preferences.getString("displayName", displayName, sizeof(displayName)) > 0
+            ? displayName : defaultDisplayName;
+    preferences.end();
+    Serial.flush(); // flush is required after getting preferences
+}
+
+void LightInstance::loadSettings() {
+
+    uint8_t on;
+    uint8_t temp; // TODO this doesn't do anything
+    uint8_t brightness;
+    const JournalLight *journaled = journal != nullptr ? journal->getLight(index) : nullptr;
+    if (journaled != nullptr) {
+        on = journaled->on;
+        temp = journaled->temperature;
+        brightness = journaled->brightness;
+        onSeconds = journaled->onSeconds;
+        switchCycles = journaled->switchCycles;
+    } else {
+        // not journaled yet, the first write moves the light state to the journal
+        Preferences preferences;
+        preferences.begin(preferencesName);
+        on = preferences.getUChar("light-0-on", 1);
+        temp = preferences.getUChar("light-0-temp", 100);
+        brightness = preferences.getUChar("light-0-bright", 100);
+        preferences.end();
+        Serial.flush();
+    }
+
+    lights.lights[0].on = on;
+    lights.lights[0].temperature = temp;
+    lights.lights[0].brightness = brightness;
+
+    // TODO this _should_ be separate, but they are coupled for now
+    settings.powerOnBehavior = on;
+    settings.powerOnTemperature = temp;
+    settings.powerOnBrightness = brightness;
+
+    Serial.printf("Loaded settings of light %u from the %s - on: %u, temp: %u, brightness: %u\n", index,
+                  journaled != nullptr ? "journal" : "preferences", on, temp, brightness);
+}
+
+void LightInstance::writeSettings(bool writeLights, bool writeAccessoryInfo) {
+    int8_t watch = monitor != nullptr ? monitor->enter(persistPath) : -1;
+
+    // copied, the flash writes happen without the lock
+    lockState();
+    Light light = lights.lights[0];
+    InlineString<MAX_DISPLAY_NAME_LENGTH> displayName = info.displayName;
+    unlockState();
+
+    if (writeLights && journal != nullptr) {
+        journal->setLight(index, {light.on, light.brightness, light.temperature, 0, onSeconds, switchCycles});
+        journal->commit();
+        usageJournaledMs = millis();
+        writeLights = false;
+    }
+
+    if (writeLights || writeAccessoryInfo) {
+        Preferences preferences;
+        preferences.begin(preferencesName, false);
+        if (writeLights) {
+            preferences.putUChar("light-0-on", light.on);
+            preferences.putUChar("light-0-temp", light.temperature);
+            preferences.putUChar("light-0-bright", light.brightness);
+        }
+        if (writeAccessoryInfo) {
+            preferences.putString("displayName", displayName.c_str());
+        }
+        preferences.end();
+    }
+
+    if (monitor != nullptr) {
+        monitor->exit(watch);
+    }
+}
+
+void LightInstance::countUsage() {
+    unsigned long now = millis();
+    if (usageOn) {
+        onMs += now - usageCountedMs;
+        onSeconds += onMs / 1000;
+        onMs %= 1000;
+    }
+    usageCountedMs = now;
+
+    bool on = output.isOn();
+    if (on && !usageOn) {
+        switchCycles++;
+    }
+    usageOn = on;
+}
+
+void LightInstance::persistSettings() {
+    // every housekeeping pass, switching is counted to within HOUSEKEEPING_PERIOD_MS
+    countUsage();
+    if (journal != nullptr && usageOn && millis() - usageJournaledMs >= USAGE_JOURNAL_INTERVAL_MS) {
+        lightsDirty = true;
+    }
+
+    // the output task only flags the end of a stream, one that started again since is kept when it stops again
+    if (streamStopped) {
+        streamStopped = false;
+        if (!streaming) {
+            keepStreamedLight();
+        }
+    }
+
+    // the lights are written once the stream stops
+    bool lightsChanged = lightsDirty && !streaming;
+    if ((lightsChanged || accessoryInfoDirty) && millis() - settingsChangedMs >= SETTINGS_WRITE_DELAY_MS) {
+        bool writeLights = lightsChanged;
+        bool writeAccessoryInfo = accessoryInfoDirty;
+        if (writeLights) {
+            lightsDirty = false;
+        }
+        accessoryInfoDirty = false;
+        writeSettings(writeLights, writeAccessoryInfo);
+    }
+}
+
+void LightInstance::changeLight(bool on, uint8_t brightness, uint32_t durationMs) {
+
+    Serial.printf("Setting light %u brightness to: %u\n", index, brightness);
+
+    // the output task updates the board LED and the LED strip PWM
+    output.set(on, brightness, durationMs);
+}
+
+void LightInstance::lightsChanges(Light &light) {
+
+    Serial.printf("Light %u - PowerOn: %u, Temperature: %u, Brightness: %u\n", index, light.on, light.temperature,
+                  light.brightness);
+
+    // fade using the configured durations
+    bool on = light.on == 1;
+    int durationMs = on != output.isOn()
+            ? (on ? settings.switchOnDurationMs : settings.switchOffDurationMs)
+            : settings.colorChangeDurationMs;
+    changeLight(on, on ? light.brightness : 0, max(durationMs, 0));
+
+    // update settings with current info
+    settings.powerOnBehavior = light.on;
+    settings.powerOnTemperature = light.temperature;
+    settings.powerOnBrightness = light.brightness;
+
+    // persist the changes, see persistSettings()
+    settingsChangedMs = millis();
+    lightsDirty = true;
+
+    // publish the new state to MQTT (if enabled)
+    if (mqtt != nullptr) {
+        mqtt->stateChanged();
+    }
+}
+
+void LightInstance::applyLights(JsonObject &jsonObj) {
+    // the light is held steady while a firmware update is written
+    if (Esp32App::isUpdating()) {
+        return;
+    }
+
+    // runs on the housekeeping task, while a request may be handled on the AsyncTCP task
+    lockState();
+    lights.fromJson(jsonObj);
+
+    // handle the lights changed
+    lightsChanges(lights.lights[0]);
+    unlockState();
+}
+
+void LightInstance::applyStream(bool on, uint8_t level, uint8_t temperature, uint32_t durationMs) {
+    output.setLevel(on, on ? level : 0, durationMs);
+
+    // no logging or persistence at frame rate, the state is only updated for `GET /elgato/lights`.  The output task
+    // doesn't wait for the lock, a frame that finds it taken is caught up by the next one or when the stream stops
+    streamedLight.on = on;
+    streamedLight.brightness = (level * 100 + 127) / 255;
+    streamedLight.temperature = temperature;
+    if (xSemaphoreTake(stateLock, 0) == pdTRUE) {
+        lights.lights[0] = streamedLight;
+        unlockState();
+    }
+}
+
+void LightInstance::setStreaming(bool isStreaming) {
+    if (streaming == isStreaming) {
+        return;
+    }
+    streaming = isStreaming;
+
+    // called from the output task, which must not wait for a handler holding the lock, see keepStreamedLight()
+    if (!isStreaming) {
+        streamStopped = true;
+    }
+}
+
+void LightInstance::keepStreamedLight() {
+    // keep the last streamed state, as if it was set with a single PUT
+    lockState();
+    Light &light = lights.lights[0];
+    light = streamedLight;
+    settings.powerOnBehavior = light.on;
+    settings.powerOnTemperature = light.temperature;
+    settings.powerOnBrightness = light.brightness;
+    unlockState();
+    settingsChangedMs = millis();
+    lightsDirty = true;
+    if (mqtt != nullptr) {
+        mqtt->stateChanged();
+    }
+}
+
+void LightInstance::accessoryInfoChanges() {
+    // persist the changes, see persistSettings()
+    settingsChangedMs = millis();
+    accessoryInfoDirty = true;
+
+    if (mqtt != nullptr) {
+        mqtt->displayNameChanged(info.displayName.c_str());
+    }
+}
+
+void LightInstance::identify() {
+    // on off on off
+    for (uint8_t i = 0; i < 2; i++) {
+        changeLight(true, lights.lights[0].brightness, 0);
+        delay(500);
+
+        changeLight(false, 0, 0);
+        delay(500);
+    }
+}
+
+void LightInstance::begin(uint16_t freq, uint8_t resolution) {
+    size_t freeHeap = ESP.getFreeHeap();
+
+    // get the initial configuration
+    loadSettings();
+
+    // configure PWM and set the initial state of LEDs
+    if (!output.begin(freq, resolution)) {
+        Serial.printf("No output available for light %u\n", index);
+    }
+    lightsChanges(lights.lights[0]);
+
+    registerRoutes();
+
+    heapUsed = freeHeap - ESP.getFreeHeap();
+}
+
+void LightInstance::sendApiResponse(AsyncWebServerRequest *request, const ElgatoApi::Route &route, JsonVariant &json) {
+    auto * response = new AsyncJsonResponse();
+    JsonObject jsonObject = response->getRoot();
+    int status = api.handle(route, json, jsonObject);
+
+    // identify, errors and the forced 404s have no body
+    if (jsonObject.size() == 0) {
+        delete response;
+        request->send(status);
+        return;
+    }
+
+    response->setCode(status);
+    response->setLength();
+    request->send(response);
+}
+
+void LightInstance::registerRoutes() {
+    api.hooks.lightsChanged = [this](Light &light) {
+        lightsChanges(light);
+    };
+    api.hooks.settingsChanged = [this]() {
+        if (mqtt != nullptr) {
+            mqtt->stateChanged();
+        }
+    };
+    api.hooks.accessoryInfoChanged = [this]() {
+        accessoryInfoChanges();
+    };
+    api.hooks.identify = [this]() {
+        identify();
+    };
+    api.hooks.lockState = [this]() {
+        lockState();
+    };
+    api.hooks.unlockState = [this]() {
+        unlockState();
+    };
+    // the light is held steady while a firmware update is written, state changes are rejected until it finishes
+    api.hooks.isBusy = Esp32App::isUpdating;
+
+    server.on("/", HTTP_GET, [](AsyncWebServerRequest * request) {
+        request->send(200, "text/html", "Welcome to the REST Web Server");
+    });
+
+    // the /elgato/* routes, see ElgatoApi
+    for (size_t i = 0; i < ElgatoApi::routeCount; i++) {
+        const ElgatoApi::Route &route = ElgatoApi::routes[i];
+
+        if (route.method == API_PUT) {
+            auto* handler = new JsonCallbackHandler(route.uri, [this, &route](AsyncWebServerRequest *request, JsonVariant &json) {
+                sendApiResponse(request, route, json);
+            });
+            handler->setMethod(HTTP_PUT);
+            server.addHandler(handler);
+        } else {
+            server.on(route.uri, route.method == API_GET ? HTTP_GET : HTTP_POST, [this, &route](AsyncWebServerRequest *request) {
+                JsonVariant json;
+                sendApiResponse(request, route, json);
+            });
+        }
+    }
+
+    // traffic capture for `replay`, these run on the AsyncTCP task like the API handlers and record the state under
+    // the same lock, so the state records and the requests in between line up
+    api.capture = &capture;
+    server.on("/capture/start", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        if (captureDownloads > 0) {
+            request->send(409, "text/plain", "The previous capture is still being downloaded");
+            return;
+        }
+        size_t size = request->hasParam("size") ? request->getParam("size")->value().toInt() : CAPTURE_DEFAULT_SIZE;
+        lockState();
+        bool started = capture.start(api, size);
+        unlockState();
+        request->send(started ? 200 : 503);
+    });
+    server.on("/capture", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        lockState();
+        capture.stop(api);
+        unlockState();
+        if (capture.size() == 0) {
+            request->send(404);
+            return;
+        }
+
+        // sent straight from the capture buffer, a new capture can't be started until the client is gone
+        AsyncWebServerResponse *response = request->beginResponse_P(200, "application/octet-stream", capture.data(),
+                                                                    capture.size());
+        response->addHeader("Content-Disposition", "attachment; filename=\"traffic.cap\"");
+        captureDownloads++;
+        request->onDisconnect([this]() {
+            captureDownloads--;
+        });
+        request->send(response);
+    });
+
+    // the server of instance 0 is shared with Esp32WebApp (`/update`), which starts it
+    if (index > 0) {
+        server.begin();
+    }
+
+    // the same routes with persistent connections
+    keepAliveServer.begin();
+}
+
+void LightInstance::advertise(MdnsDiscovery &discovery, bool keepAlive) {
+    uint16_t servicePort = keepAlive ? keepAlivePort : port;
+
+    // the instance name is per service, so several lights share one responder
+    discovery.advertise(index, serviceName.c_str(), deviceId.c_str(), servicePort);
+
+    Serial.print("\tService Name: ");
+    Serial.println(serviceName);
+    Serial.print("\tDevice ID: ");
+    Serial.println(deviceId);
+    Serial.print("\tPort: ");
+    Serial.println(servicePort);
+}
+
+void LightInstance::printStatus() {
+    Serial.printf("\tLight %u: %s (%s), \"%s\", serial %s\n", index, serviceName.c_str(), deviceId.c_str(),
+                  info.displayName.c_str(), info.serialNumber.c_str());
+    Serial.printf("\t\tports %u (keep-alive %u), pin %u, channel %u, %u bytes\n", port, keepAlivePort,
+                  output.getPin(), output.getChannel(), getMemoryUsage());
+    Serial.printf("\t\ton for %.1f hours, %u switch cycles\n", onSeconds / 3600.0f, switchCycles);
+}
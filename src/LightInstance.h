@@ -0,0 +1,152 @@
+#ifndef ESP32_LIGHT_LIGHTINSTANCE_H
+#define ESP32_LIGHT_LIGHTINSTANCE_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "AccessoryInfo.h"
+#include "Lights.h"
+#include "Settings.h"
+#include "ElgatoApi.h"
+#include "KeepAliveServer.h"
+#include "TrafficCapture.h"
+#include "LightOutput.h"
+#include "MqttBridge.h"
+#include "StallMonitor.h"
+#include "StateJournal.h"
+#include "MdnsDiscovery.h"
+
+// every instance needs its own LEDC channel, see LightOutput
+#define MAX_LIGHT_INSTANCES MAX_LIGHT_OUTPUTS
+static_assert(MAX_LIGHT_INSTANCES <= JOURNAL_LIGHTS, "every light needs its place in a journal record");
+static_assert(MAX_LIGHT_INSTANCES <= MDNS_MAX_SERVICES, "every light is advertised as a service");
+// instance n serves HTTP on LIGHT_INSTANCE_PORT + 2n, and keep-alive connections on the port after that
+#define LIGHT_INSTANCE_PORT 9123
+
+// settings are persisted from the housekeeping task once changes settle, so a burst of changes costs one flash write
+#define SETTINGS_WRITE_DELAY_MS 1000
+// while a light stays on its usage counters are journaled this often, a power loss loses at most this much on time
+#define USAGE_JOURNAL_INTERVAL_MS (15 * 60 * 1000)
+
+/*
+ * One emulated Elgato light: its identity (mDNS service name, device id, display name, serial number), state, HTTP
+ * servers and PWM output.  All instances share the WiFi/AsyncTCP stack, the light output task and the housekeeping
+ * task, only the buffers and handlers are per instance.
+ *
+ * Instance 0 keeps its settings in the "fake-light" preferences, instance n in "fake-light-n".  With a journal the
+ * light state and the usage counters (on time, switch cycles) go there instead, the preferences are only read until
+ * the light is first journaled.
+ */
+class LightInstance {
+
+private:
+    char preferencesName[16];
+    String serviceName;
+    String deviceId;
+
+    // what changed since the last flush, see persistSettings()
+    volatile bool lightsDirty = false;
+    volatile bool accessoryInfoDirty = false;
+    volatile unsigned long settingsChangedMs = 0;
+    // driven by DMX, the light state changes too often to be persisted, see DmxReceiver
+    volatile bool streaming = false;
+    // the last streamed frame, written by the output task only
+    Light streamedLight;
+    // set by the output task when the stream stopped, the housekeeping task keeps the last frame as the light state
+    volatile bool streamStopped = false;
+
+    // see lockState()
+    StaticSemaphore_t stateLockBuffer;
+    SemaphoreHandle_t stateLock;
+
+    // usage counters, counted on the housekeeping task
+    uint32_t onSeconds = 0;
+    uint32_t switchCycles = 0;
+    // on time not in `onSeconds` yet
+    uint32_t onMs = 0;
+    bool usageOn = false;
+    unsigned long usageCountedMs = 0;
+    unsigned long usageJournaledMs = 0;
+
+    // heap allocated by `begin()`, the servers, handlers and output
+    size_t heapUsed = 0;
+
+    void loadSettings();
+    void writeSettings(bool writeLights, bool writeAccessoryInfo);
+    void countUsage();
+    void changeLight(bool on, uint8_t brightness, uint32_t durationMs);
+    void accessoryInfoChanges();
+    void keepStreamedLight();
+    void identify();
+    void sendApiResponse(AsyncWebServerRequest *request, const ElgatoApi::Route &route, JsonVariant &json);
+    void registerRoutes();
+
+public:
+    const uint8_t index;
+    const uint16_t port;
+    const uint16_t keepAlivePort;
+
+    AsyncWebServer server;
+    AccessoryInfo info;
+    Lights lights;
+    Settings settings;
+    ElgatoApi api;
+    KeepAliveServer keepAliveServer;
+    TrafficCapture capture;
+    // `GET /capture` responses still being sent from the capture buffer, a new capture would free it under them
+    uint8_t captureDownloads = 0;
+    LightOutput output;
+
+    // set on the light that is bridged to MQTT
+    MqttBridge *mqtt = nullptr;
+    // when set, the flash writes are timed against the persist budget
+    StallMonitor *monitor = nullptr;
+    uint8_t persistPath = 0;
+    // when set, the light state and usage counters are appended to it instead of written to the preferences
+    StateJournal *journal = nullptr;
+
+    LightInstance(uint8_t index, uint8_t pin, uint8_t channel, uint8_t indicatorPin);
+
+    // reads the identity from the preferences, instances other than 0 derive their defaults from the index
+    void loadIdentity();
+
+    // restores the light output and starts serving the `/elgato/*` routes
+    void begin(uint16_t freq, uint8_t resolution);
+
+    // registers the `_elg._tcp` service, MdnsDiscovery::begin() has to be called first
+    void advertise(MdnsDiscovery &discovery, bool keepAlive);
+
+    // `lights`, `settings` and `info` are changed from the AsyncTCP task (HTTP), the housekeeping task (MQTT, the CLI)
+    // and the output task (DMX).  Whatever changes them, or needs a consistent copy, holds this lock, which is taken
+    // around every API handler.  It is never held across a flash write
+    void lockState() { xSemaphoreTake(stateLock, portMAX_DELAY); }
+    void unlockState() { xSemaphoreGive(stateLock); }
+    SemaphoreHandle_t getStateLock() const { return stateLock; }
+
+    // call with the state locked
+    void lightsChanges(Light &light);
+
+    // applies a `PUT /elgato/lights` body, used for MQTT commands
+    void applyLights(JsonObject &jsonObj);
+
+    // applies a streamed frame (DMX level 0-255) from the output task, fading over `durationMs`
+    void applyStream(bool on, uint8_t level, uint8_t temperature, uint32_t durationMs);
+
+    // while streaming the light state is not persisted or published, the last one is once the stream stops (on the next
+    // housekeeping pass, the output task never waits for the state lock)
+    void setStreaming(bool isStreaming);
+    bool isStreaming() const { return streaming; }
+
+    // all changes within SETTINGS_WRITE_DELAY_MS are written with a single flush, called from the housekeeping task
+    void persistSettings();
+
+    const char *getPreferencesName() const { return preferencesName; }
+    const String &getServiceName() const { return serviceName; }
+    const String &getDeviceId() const { return deviceId; }
+
+    // the instance itself and everything `begin()` allocated
+    size_t getMemoryUsage() const { return sizeof(LightInstance) + heapUsed; }
+
+    void printStatus();
+};
+
+#endif //ESP32_LIGHT_LIGHTINSTANCE_H
@@ -0,0 +1,158 @@
+#include "LightOutput.h"
+#include "Tasks.h"
+#include "StallMonitor.h"
+
+LightOutput *LightOutput::outputs[MAX_LIGHT_OUTPUTS] = {};
+volatile uint8_t LightOutput::outputCount = 0;
+TaskHandle_t LightOutput::task = nullptr;
+OutputPeriodHook LightOutput::periodHook = nullptr;
+void *LightOutput::periodHookArg = nullptr;
+StallMonitor *LightOutput::monitor = nullptr;
+uint8_t LightOutput::monitorPath = 0;
+
+LightOutput::LightOutput(uint8_t pin, uint8_t channel, uint8_t indicatorPin)
+        : pin(pin), channel(channel), indicatorPin(indicatorPin) {}
+
+bool LightOutput::begin(uint16_t freq, uint8_t resolution) {
+    if (outputCount >= MAX_LIGHT_OUTPUTS) {
+        return false;
+    }
+
+    if (indicatorPin != NO_INDICATOR_PIN) {
+        pinMode(indicatorPin, OUTPUT);
+    }
+
+    // configure PWM on the pin
+    ledcSetup(channel, freq, resolution);
+    maxDuty = (1 << resolution) - 1;
+
+    // attach the channel to the GPIO to be controlled
+    ledcAttachPin(pin, channel);
+
+    // the task picks up the new output on its next period
+    outputs[outputCount] = this;
+    outputCount++;
+
+    if (task == nullptr) {
+        xTaskCreatePinnedToCore(
+                outputTask, /* Task function. */
+                "Light output", /* name of task. */
+                OUTPUT_TASK_STACK_SIZE, /* Stack size of task */
+                nullptr, /* parameter of the task */
+                OUTPUT_TASK_PRIORITY, /* priority of the task */
+                &task, /* Task handle to keep track of created task */
+                OUTPUT_CORE); /* pin task to the output core */
+    }
+    return true;
+}
+
+void LightOutput::set(bool isOn, uint8_t brightness, uint32_t durationMs) {
+    // brightness is a percentage, convert to the PWM duty
+    setDuty(isOn, (maxDuty * min(brightness, (uint8_t) 100) / 100) << 8, durationMs);
+}
+
+void LightOutput::setLevel(bool isOn, uint8_t level, uint32_t durationMs) {
+    setDuty(isOn, (maxDuty * level / 255) << 8, durationMs);
+}
+
+void LightOutput::setDuty(bool isOn, uint32_t duty, uint32_t durationMs) {
+    uint32_t steps = max(durationMs / OUTPUT_PERIOD_MS, (uint32_t) 1);
+
+    portENTER_CRITICAL(&lock);
+    on = isOn;
+    targetDuty = duty;
+    stepDuty = max((duty > currentDuty ? duty - currentDuty : currentDuty - duty) / steps, (uint32_t) 1);
+    portEXIT_CRITICAL(&lock);
+}
+
+void LightOutput::setPeriodHook(OutputPeriodHook hook, void *arg) {
+    // the argument first, the task may pick up the hook right away
+    periodHookArg = arg;
+    periodHook = hook;
+}
+
+void LightOutput::setStallMonitor(StallMonitor *stallMonitor, uint8_t path) {
+    monitorPath = path;
+    monitor = stallMonitor;
+}
+
+void LightOutput::outputTask(void * /* pvParameters */) {
+    TickType_t lastWake = xTaskGetTickCount();
+
+    while (true) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(OUTPUT_PERIOD_MS));
+        int8_t watch = monitor != nullptr ? monitor->enter(monitorPath) : -1;
+        if (periodHook != nullptr) {
+            periodHook(periodHookArg);
+        }
+        for (uint8_t i = 0; i < outputCount; i++) {
+            outputs[i]->update();
+        }
+        if (monitor != nullptr) {
+            monitor->exit(watch);
+        }
+    }
+}
+
+void LightOutput::update() {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&lock);
+    if (lastUpdateUs != 0) {
+        auto periodUs = (uint32_t) (now - lastUpdateUs);
+        periods++;
+        totalPeriodUs += periodUs;
+        minPeriodUs = min(minPeriodUs, periodUs);
+        maxPeriodUs = max(maxPeriodUs, periodUs);
+    }
+
+    if (currentDuty < targetDuty) {
+        currentDuty = min(currentDuty + stepDuty, targetDuty);
+    } else if (currentDuty > targetDuty) {
+        currentDuty = currentDuty > targetDuty + stepDuty ? currentDuty - stepDuty : targetDuty;
+    }
+    uint32_t duty = currentDuty >> 8;
+    bool isOn = on;
+    portEXIT_CRITICAL(&lock);
+    lastUpdateUs = now;
+
+    if (duty != writtenDuty) {
+        ledcWrite(channel, duty);
+        writtenDuty = duty;
+    }
+    if (isOn != writtenOn && indicatorPin != NO_INDICATOR_PIN) {
+        digitalWrite(indicatorPin, isOn ? HIGH : LOW);
+        writtenOn = isOn;
+    }
+}
+
+void LightOutput::printStats() {
+    portENTER_CRITICAL(&lock);
+    uint32_t count = periods;
+    uint32_t minUs = minPeriodUs;
+    uint32_t maxUs = maxPeriodUs;
+    uint64_t totalUs = totalPeriodUs;
+    portEXIT_CRITICAL(&lock);
+
+    if (count == 0) {
+        Serial.printf("\tOutput (pin %u): no periods measured\n", pin);
+        return;
+    }
+
+    // jitter is the largest deviation from the nominal period
+    uint32_t nominalUs = OUTPUT_PERIOD_MS * 1000;
+    uint32_t lateUs = maxUs > nominalUs ? maxUs - nominalUs : 0;
+    uint32_t earlyUs = minUs < nominalUs ? nominalUs - minUs : 0;
+    uint32_t jitterUs = max(lateUs, earlyUs);
+    Serial.printf("\tOutput (pin %u): %u periods of %ums, min %uus, avg %uus, max %uus, jitter %uus\n",
+                  pin, count, OUTPUT_PERIOD_MS, minUs, (uint32_t) (totalUs / count), maxUs, jitterUs);
+}
+
+void LightOutput::resetStats() {
+    portENTER_CRITICAL(&lock);
+    periods = 0;
+    minPeriodUs = UINT32_MAX;
+    maxPeriodUs = 0;
+    totalPeriodUs = 0;
+    portEXIT_CRITICAL(&lock);
+}
@@ -0,0 +1,89 @@
+#ifndef ESP32_LIGHT_LIGHTOUTPUT_H
+#define ESP32_LIGHT_LIGHTOUTPUT_H
+
+#include <Arduino.h>
+
+// one per emulated light, all of them are updated by the same output task
+#define MAX_LIGHT_OUTPUTS 4
+#define NO_INDICATOR_PIN 0xFF
+
+class StallMonitor;
+
+// called by the output task at the start of every period, before the outputs are updated
+typedef void (*OutputPeriodHook)(void *arg);
+
+/*
+ * Drives the LED strip PWM (and the on board indicator LED) from a dedicated task pinned to OUTPUT_CORE.  Other tasks
+ * only set the target, the output task fades towards it and is the only one that touches the LEDC channel.  The task is
+ * shared by all outputs.
+ */
+class LightOutput {
+
+private:
+    const uint8_t pin;
+    const uint8_t channel;
+    const uint8_t indicatorPin;
+    uint32_t maxDuty = 255;
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    static LightOutput *outputs[MAX_LIGHT_OUTPUTS];
+    static volatile uint8_t outputCount;
+    static TaskHandle_t task;
+    static OutputPeriodHook periodHook;
+    static void *periodHookArg;
+    static StallMonitor *monitor;
+    static uint8_t monitorPath;
+
+    // duty values are 8.8 fixed point so short fades still move every period
+    uint32_t targetDuty = 0;
+    uint32_t currentDuty = 0;
+    uint32_t stepDuty = 0;
+    bool on = false;
+
+    // only touched by the output task
+    uint32_t writtenDuty = UINT32_MAX;
+    int8_t writtenOn = -1;
+    int64_t lastUpdateUs = 0;
+
+    // timing of the output period, in microseconds
+    uint32_t periods = 0;
+    uint32_t minPeriodUs = UINT32_MAX;
+    uint32_t maxPeriodUs = 0;
+    uint64_t totalPeriodUs = 0;
+
+    static void outputTask(void *pvParameters);
+    void update();
+    void setDuty(bool on, uint32_t duty, uint32_t durationMs);
+
+public:
+    // `indicatorPin` can be NO_INDICATOR_PIN
+    LightOutput(uint8_t pin, uint8_t channel, uint8_t indicatorPin);
+
+    // returns false when MAX_LIGHT_OUTPUTS outputs are running already
+    bool begin(uint16_t freq, uint8_t resolution);
+
+    // fades to the brightness (percentage 0-100) over `durationMs`, 0 changes the output on the next period
+    void set(bool on, uint8_t brightness, uint32_t durationMs);
+
+    // the same with a DMX level (0-255), for the finer steps of streamed input
+    void setLevel(bool on, uint8_t level, uint32_t durationMs);
+
+    bool isOn() const { return on; }
+
+    uint8_t getPin() const { return pin; }
+    uint8_t getChannel() const { return channel; }
+
+    static TaskHandle_t getTask() { return task; }
+
+    // runs `hook` on the output task, e.g. to pick up streamed frames without another task
+    static void setPeriodHook(OutputPeriodHook hook, void *arg);
+
+    // times every period (the hook and the updates) against the output budget
+    static void setStallMonitor(StallMonitor *stallMonitor, uint8_t path);
+
+    void printStats();
+    void resetStats();
+};
+
+#endif //ESP32_LIGHT_LIGHTOUTPUT_H
@@ -3,6 +3,7 @@
 
 #include <ArduinoJson.h>
 #include "Settings.h"
+#include "JsonValidation.h"
 
 struct Light {
     uint8_t brightness;
@@ -30,31 +31,35 @@ struct Lights {
             const JsonArray& lightArray = doc["lights"];
             const JsonObject& light0 = lightArray[0];
 
-            if (light0["brightness"]) {
-                uint8_t brightness = light0["brightness"].as<uint8_t>();
+            // only the keys in the body change, 0 is a value like any other.  `on` also takes `true`/`false`,
+            // which `|` would treat as missing
+            lights[0].brightness = light0["brightness"] | lights[0].brightness;
+            lights[0].temperature = light0["temperature"] | lights[0].temperature;
+            lights[0].on = light0["on"].is<bool>() ? light0["on"].as<bool>() : light0["on"] | lights[0].on;
 
-                if (lights[0].brightness != brightness) {
-                    lights[0].brightness = brightness;
-                }
-            }
-
-            if (light0["temperature"]) {
-                uint8_t temperature = light0["temperature"].as<uint8_t>();
+        }
+    }
 
-                if (lights[0].temperature != temperature) {
-                    lights[0].temperature = temperature;
-                }
-            }
+    // checks a `PUT /elgato/lights` body without applying it
+    bool isValidJson(JsonObject &doc) {
+        JsonVariant lightArray = doc["lights"];
+        if (lightArray.isNull()) {
+            return true;
+        }
 
-            if (light0["on"] || 0 == light0["on"]) {
-                uint8_t on = light0["on"].as<uint8_t>();
+        if (!lightArray.is<JsonArray>() || lightArray.size() > numberOfLights) {
+            return false;
+        }
 
-                if (lights[0].on != on) {
-                    lights[0].on = on;
-                }
+        for (JsonVariant light : lightArray.as<JsonArray>()) {
+            if (!light.is<JsonObject>()
+                || !(light["on"].is<bool>() || isValidJsonInteger(light["on"], 0, 1))
+                || !isValidJsonInteger(light["brightness"], 0, 100)
+                || !isValidJsonInteger(light["temperature"], 0, UINT8_MAX)) {
+                return false;
             }
-
         }
+        return true;
     }
 
     void toJson(JsonObject & doc) {
@@ -62,12 +67,11 @@ struct Lights {
 
         JsonArray features = doc.createNestedArray("lights");
 
-        DynamicJsonDocument light0(200);
+        // built in the response document, a temporary document would be a heap allocation per request
+        JsonObject light0 = features.createNestedObject();
         light0["brightness"] = lights[0].brightness;
         light0["on"] = lights[0].on;
         light0["temperature"] = lights[0].temperature;
-
-        features.add(light0);
     }
 };
 #endif //ESP32_LIGHT_LIGHTS_H
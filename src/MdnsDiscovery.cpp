@@ -0,0 +1,122 @@
+#include "MdnsDiscovery.h"
+#include <WiFi.h>
+
+// in host byte order, 0 while not connected
+static uint32_t localAddress() {
+    IPAddress ip = WiFi.localIP();
+    return ((uint32_t) ip[0] << 24) | ((uint32_t) ip[1] << 16) | ((uint32_t) ip[2] << 8) | ip[3];
+}
+
+bool MdnsDiscovery::begin(const char *hostName) {
+    strncpy(hostLabel, hostName, sizeof(hostLabel) - 1);
+    portENTER_CRITICAL(&lock);
+    responder.setHost(hostLabel, localAddress());
+    portEXIT_CRITICAL(&lock);
+
+    udp.onPacket([this](AsyncUDPPacket &packet) {
+        receive(packet);
+    });
+    // RFC 6762 11, sent with an IP TTL of 255
+    listening = udp.listenMulticast(IPAddress(224, 0, 0, 251), MDNS_PORT, 255);
+    if (!listening) {
+        Serial.println("Failed to start the mDNS responder");
+    }
+    return listening;
+}
+
+void MdnsDiscovery::advertise(uint8_t index, const char *instanceName, const char *deviceId, uint16_t port) {
+    portENTER_CRITICAL(&lock);
+    bool changed = responder.setService(index, instanceName, deviceId, port);
+    const char *name = responder.getServiceName(index);
+    portEXIT_CRITICAL(&lock);
+
+    if (name == nullptr) {
+        Serial.printf("Failed to advertise light %u\n", index);
+    } else if (changed) {
+        Serial.printf("\tAdvertising %s on port %u\n", name, port);
+    }
+}
+
+void MdnsDiscovery::receive(AsyncUDPPacket &packet) {
+    packets++;
+    // parsed before taking the lock, the known answers can take a while
+    MdnsParseResult result = parseMdnsQuery(packet.data(), packet.length(), query);
+    if (result != MDNS_PARSE_QUERY) {
+        if (result == MDNS_PARSE_ERROR) {
+            malformed++;
+        } else {
+            responses++;
+        }
+        return;
+    }
+
+    bool legacy = packet.remotePort() != MDNS_PORT;
+    bool unicast;
+    portENTER_CRITICAL(&lock);
+    size_t length = responder.respond(query, legacy, millis(), reply, sizeof(reply), unicast);
+    portEXIT_CRITICAL(&lock);
+    if (length == 0) {
+        return;
+    }
+
+    size_t sent;
+    if (unicast) {
+        unicastReplies++;
+        sent = udp.writeTo(reply, length, packet.remoteIP(), packet.remotePort());
+    } else {
+        sent = udp.writeTo(reply, length, IPAddress(224, 0, 0, 251), MDNS_PORT);
+    }
+    if (sent != length) {
+        sendFailures++;
+    }
+}
+
+void MdnsDiscovery::loop() {
+    if (!listening) {
+        return;
+    }
+
+    // after a reconnect the address may have changed, the records are rebuilt and announced again
+    uint32_t address = localAddress();
+    portENTER_CRITICAL(&lock);
+    responder.setHost(hostLabel, address);
+    size_t length = address != 0 ? responder.announce(millis(), announcement, sizeof(announcement)) : 0;
+    portEXIT_CRITICAL(&lock);
+
+    if (length > 0) {
+        udp.writeTo(announcement, length, IPAddress(224, 0, 0, 251), MDNS_PORT);
+    }
+}
+
+void MdnsDiscovery::printStats() {
+    portENTER_CRITICAL(&lock);
+    MdnsStats stats = responder.getStats();
+    portEXIT_CRITICAL(&lock);
+
+    Serial.printf("\tmDNS: %s as %s\n", listening ? "listening" : "not listening", responder.getHostName());
+    for (uint8_t i = 0; i < MDNS_MAX_SERVICES; i++) {
+        const char *name = responder.getServiceName(i);
+        if (name != nullptr) {
+            Serial.printf("\tLight %u: %s\n", i, name);
+        }
+    }
+    Serial.printf("\treceived: %u packets, %u queries (%u not for us), %u responses of others, %u malformed\n",
+                  packets, stats.queries, stats.notForUs, responses, malformed);
+    Serial.printf("\tsent: %u responses with %u records, %u of them announcements, %u unicast, %u failed\n",
+                  stats.answers, stats.records, stats.announcements, unicastReplies, sendFailures);
+    Serial.printf("\tsuppressed: %u known answers, %u multicast less than %ums ago\n", stats.suppressedKnown,
+                  stats.suppressedRateLimit, MDNS_MULTICAST_INTERVAL_MS);
+    Serial.printf("\trecords rebuilt %u times\n", stats.rebuilds);
+}
+
+void MdnsDiscovery::resetStats() {
+    packets = 0;
+    malformed = 0;
+    responses = 0;
+    unicastReplies = 0;
+    sendFailures = 0;
+
+    portENTER_CRITICAL(&lock);
+    responder.resetStats();
+    portEXIT_CRITICAL(&lock);
+}
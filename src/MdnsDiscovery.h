@@ -0,0 +1,51 @@
+#ifndef ESP32_LIGHT_MDNSDISCOVERY_H
+#define ESP32_LIGHT_MDNSDISCOVERY_H
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include "MdnsResponder.h"
+
+/*
+ * The mDNS responder of the device, in place of ESPmDNS: MdnsResponder on a multicast AsyncUDP socket.  Queries are
+ * parsed on the AsyncUDP task and answered from the precomputed records, announcements and address changes are handled
+ * from the housekeeping task.  Print the counters with the `discovery` command.
+ */
+class MdnsDiscovery {
+
+private:
+    AsyncUDP udp;
+    bool listening = false;
+    MdnsResponder responder;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    // only used by the AsyncUDP task
+    MdnsQuery query;
+    uint8_t reply[MDNS_PACKET_SIZE];
+    // only used by the housekeeping task
+    uint8_t announcement[MDNS_PACKET_SIZE];
+    char hostLabel[64] = {};
+
+    // only written by the AsyncUDP task
+    volatile uint32_t packets = 0;
+    volatile uint32_t malformed = 0;
+    volatile uint32_t responses = 0;
+    volatile uint32_t unicastReplies = 0;
+    volatile uint32_t sendFailures = 0;
+
+    void receive(AsyncUDPPacket &packet);
+
+public:
+    // starts answering for `<hostName>.local` at the current address
+    bool begin(const char *hostName);
+
+    // registers (or updates) the `_elg._tcp` service of a light
+    void advertise(uint8_t index, const char *instanceName, const char *deviceId, uint16_t port);
+
+    // from the housekeeping task: follows address changes and sends the announcements
+    void loop();
+
+    void printStats();
+    void resetStats();
+};
+
+#endif //ESP32_LIGHT_MDNSDISCOVERY_H
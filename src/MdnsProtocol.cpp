@@ -0,0 +1,401 @@
+#include "MdnsProtocol.h"
+#include <string.h>
+
+// a label is at most 63 bytes, a name at most 255 on the wire (RFC 1035 2.3.4)
+#define DNS_LABEL_LENGTH 63
+#define DNS_NAME_WIRE_LENGTH 255
+// compression pointers followed before a name is considered a loop
+#define DNS_MAX_POINTERS 16
+
+enum NameResult : int8_t {
+    NAME_MALFORMED = -1,
+    // well formed but longer than MDNS_NAME_LENGTH, read as an empty name
+    NAME_TOO_LONG = 0,
+    NAME_OK = 1
+};
+
+static uint16_t read16(const uint8_t *data) {
+    return (data[0] << 8) | data[1];
+}
+
+static uint32_t read32(const uint8_t *data) {
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+// reads the (possibly compressed) name at `offset`, `end` is set past it
+static NameResult readName(const uint8_t *packet, size_t length, size_t offset, char *out, size_t &end) {
+    size_t position = offset;
+    size_t written = 0;
+    uint8_t pointers = 0;
+    bool tooLong = false;
+    end = 0;
+
+    while (true) {
+        if (position >= length) {
+            return NAME_MALFORMED;
+        }
+        uint8_t labelLength = packet[position];
+
+        if ((labelLength & 0xC0) == 0xC0) {
+            if (position + 1 >= length || ++pointers > DNS_MAX_POINTERS) {
+                return NAME_MALFORMED;
+            }
+            if (end == 0) {
+                end = position + 2;
+            }
+            position = ((labelLength & 0x3F) << 8) | packet[position + 1];
+            continue;
+        }
+        if (labelLength > DNS_LABEL_LENGTH) {
+            return NAME_MALFORMED;
+        }
+        if (labelLength == 0) {
+            if (end == 0) {
+                end = position + 1;
+            }
+            break;
+        }
+        if (position + 1 + labelLength > length) {
+            return NAME_MALFORMED;
+        }
+
+        // the dot before the label, and the label with its dots and backslashes escaped
+        if (written > 0 && written + 1 < MDNS_NAME_LENGTH) {
+            out[written++] = '.';
+        }
+        for (uint8_t i = 0; i < labelLength && !tooLong; i++) {
+            char c = (char) packet[position + 1 + i];
+            bool escape = c == '.' || c == '\\';
+            if (written + (escape ? 2 : 1) >= MDNS_NAME_LENGTH) {
+                tooLong = true;
+                break;
+            }
+            if (escape) {
+                out[written++] = '\\';
+            }
+            out[written++] = c;
+        }
+        position += 1 + labelLength;
+    }
+
+    out[tooLong ? 0 : written] = '\0';
+    return tooLong ? NAME_TOO_LONG : NAME_OK;
+}
+
+MdnsParseResult parseMdnsQuery(const uint8_t *packet, size_t length, MdnsQuery &query) {
+    query.questionCount = 0;
+    query.knownAnswerCount = 0;
+    query.truncated = false;
+    if (length < MDNS_HEADER_SIZE) {
+        return MDNS_PARSE_ERROR;
+    }
+
+    query.id = read16(packet);
+    uint16_t flags = read16(packet + 2);
+    if (flags & DNS_FLAG_RESPONSE) {
+        return MDNS_PARSE_RESPONSE;
+    }
+    // RFC 6762 18.3, only standard queries
+    if ((flags & 0x7800) != 0) {
+        return MDNS_PARSE_ERROR;
+    }
+    query.truncated = (flags & DNS_FLAG_TRUNCATED) != 0;
+    uint16_t questions = read16(packet + 4);
+    uint16_t answers = read16(packet + 6);
+
+    size_t offset = MDNS_HEADER_SIZE;
+    for (uint16_t i = 0; i < questions; i++) {
+        MdnsQuestion &question = query.questions[query.questionCount < MDNS_MAX_QUESTIONS ? query.questionCount : 0];
+        char name[MDNS_NAME_LENGTH];
+        size_t end;
+        NameResult result = readName(packet, length, offset, name, end);
+        if (result == NAME_MALFORMED || end + 4 > length) {
+            return MDNS_PARSE_ERROR;
+        }
+        offset = end + 4;
+
+        if (result == NAME_TOO_LONG || query.questionCount == MDNS_MAX_QUESTIONS) {
+            query.truncated = true;
+            continue;
+        }
+        strcpy(question.name, name);
+        question.type = read16(packet + end);
+        question.unicastResponse = (read16(packet + end + 2) & MDNS_CLASS_TOP_BIT) != 0;
+        query.questionCount++;
+    }
+
+    for (uint16_t i = 0; i < answers; i++) {
+        if (query.knownAnswerCount == MDNS_MAX_KNOWN_ANSWERS) {
+            query.truncated = true;
+            break;
+        }
+        MdnsRecord record;
+        if (!readMdnsRecord(packet, length, offset, record)) {
+            return MDNS_PARSE_ERROR;
+        }
+        if (record.name[0] == '\0') {
+            query.truncated = true;
+            continue;
+        }
+        MdnsKnownAnswer &known = query.knownAnswers[query.knownAnswerCount++];
+        known.nameHash = mdnsNameHash(record.name);
+        known.type = record.type;
+        known.ttl = record.ttl;
+        known.targetHash = record.target[0] != '\0' ? mdnsNameHash(record.target) : 0;
+        known.port = record.port;
+        known.data = record.data;
+        known.dataLength = record.dataLength;
+    }
+    return MDNS_PARSE_QUERY;
+}
+
+size_t skipMdnsQuestions(const uint8_t *packet, size_t length) {
+    if (length < MDNS_HEADER_SIZE) {
+        return 0;
+    }
+    uint16_t questions = read16(packet + 4);
+    size_t offset = MDNS_HEADER_SIZE;
+    for (uint16_t i = 0; i < questions; i++) {
+        char name[MDNS_NAME_LENGTH];
+        size_t end;
+        if (readName(packet, length, offset, name, end) == NAME_MALFORMED || end + 4 > length) {
+            return 0;
+        }
+        offset = end + 4;
+    }
+    return offset;
+}
+
+bool readMdnsRecord(const uint8_t *packet, size_t length, size_t &offset, MdnsRecord &record) {
+    size_t end;
+    if (readName(packet, length, offset, record.name, end) == NAME_MALFORMED || end + 10 > length) {
+        return false;
+    }
+    record.type = read16(packet + end);
+    record.cacheFlush = (read16(packet + end + 2) & MDNS_CLASS_TOP_BIT) != 0;
+    record.ttl = read32(packet + end + 4);
+    record.dataLength = read16(packet + end + 8);
+    record.data = packet + end + 10;
+    record.target[0] = '\0';
+    record.port = 0;
+    record.address = 0;
+
+    size_t dataStart = end + 10;
+    if (dataStart + record.dataLength > length) {
+        return false;
+    }
+    size_t nameEnd;
+    if (record.type == DNS_TYPE_PTR) {
+        if (readName(packet, dataStart + record.dataLength, dataStart, record.target, nameEnd) == NAME_MALFORMED) {
+            return false;
+        }
+    } else if (record.type == DNS_TYPE_SRV && record.dataLength > 6) {
+        record.port = read16(record.data + 4);
+        if (readName(packet, dataStart + record.dataLength, dataStart + 6, record.target, nameEnd) == NAME_MALFORMED) {
+            return false;
+        }
+    } else if (record.type == DNS_TYPE_A && record.dataLength == 4) {
+        record.address = read32(record.data);
+    }
+
+    offset = dataStart + record.dataLength;
+    return true;
+}
+
+bool mdnsNameEquals(const char *a, const char *b) {
+    for (; *a != '\0' && *b != '\0'; a++, b++) {
+        char lowerA = *a >= 'A' && *a <= 'Z' ? *a + 32 : *a;
+        char lowerB = *b >= 'A' && *b <= 'Z' ? *b + 32 : *b;
+        if (lowerA != lowerB) {
+            return false;
+        }
+    }
+    return *a == *b;
+}
+
+uint32_t mdnsNameHash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash ^= (uint8_t) (*name >= 'A' && *name <= 'Z' ? *name + 32 : *name);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool escapeMdnsLabel(char *out, size_t capacity, const char *label) {
+    size_t written = 0;
+    for (; *label != '\0'; label++) {
+        bool escape = *label == '.' || *label == '\\';
+        if (written + (escape ? 2 : 1) >= capacity) {
+            return false;
+        }
+        if (escape) {
+            out[written++] = '\\';
+        }
+        out[written++] = *label;
+    }
+    if (capacity == 0) {
+        return false;
+    }
+    out[written] = '\0';
+    return true;
+}
+
+// appends to a buffer, remembering when something did not fit
+struct MdnsWriter {
+    uint8_t *out;
+    size_t capacity;
+    size_t length = 0;
+    bool overflow = false;
+
+    MdnsWriter(uint8_t *out, size_t capacity) : out(out), capacity(capacity) {}
+
+    void u8(uint8_t value) {
+        if (length + 1 > capacity) {
+            overflow = true;
+            return;
+        }
+        out[length++] = value;
+    }
+
+    void u16(uint16_t value) {
+        u8(value >> 8);
+        u8(value & 0xFF);
+    }
+
+    void u32(uint32_t value) {
+        u16(value >> 16);
+        u16(value & 0xFFFF);
+    }
+
+    void name(const char *dotted) {
+        size_t start = length;
+        while (*dotted != '\0') {
+            // the label's length is filled in once it is written
+            size_t lengthAt = length;
+            u8(0);
+            uint8_t labelLength = 0;
+            for (; *dotted != '\0' && *dotted != '.'; dotted++) {
+                if (*dotted == '\\' && dotted[1] != '\0') {
+                    dotted++;
+                }
+                u8(*dotted);
+                labelLength++;
+            }
+            if (*dotted == '.') {
+                dotted++;
+            }
+            if (labelLength == 0 || labelLength > DNS_LABEL_LENGTH) {
+                overflow = true;
+                return;
+            }
+            if (!overflow) {
+                out[lengthAt] = labelLength;
+            }
+        }
+        u8(0);
+        if (length - start > DNS_NAME_WIRE_LENGTH) {
+            overflow = true;
+        }
+    }
+
+    // a record up to its rdata length, returns where that goes
+    size_t record(const char *recordName, uint16_t type, bool cacheFlush, uint32_t ttl) {
+        name(recordName);
+        u16(type);
+        u16(DNS_CLASS_IN | (cacheFlush ? MDNS_CLASS_TOP_BIT : 0));
+        u32(ttl);
+        size_t dataLengthAt = length;
+        u16(0);
+        return dataLengthAt;
+    }
+
+    void endRecord(size_t dataLengthAt) {
+        if (!overflow) {
+            uint16_t dataLength = length - dataLengthAt - 2;
+            out[dataLengthAt] = dataLength >> 8;
+            out[dataLengthAt + 1] = dataLength & 0xFF;
+        }
+    }
+
+    size_t result() const {
+        return overflow ? 0 : length;
+    }
+};
+
+size_t writeMdnsHeader(uint8_t *out, size_t capacity, uint16_t id, uint16_t flags, uint16_t questions,
+                       uint16_t answers, uint16_t additionals) {
+    MdnsWriter writer(out, capacity);
+    writer.u16(id);
+    writer.u16(flags);
+    writer.u16(questions);
+    writer.u16(answers);
+    writer.u16(0);
+    writer.u16(additionals);
+    return writer.result();
+}
+
+size_t writeMdnsName(uint8_t *out, size_t capacity, const char *name) {
+    MdnsWriter writer(out, capacity);
+    writer.name(name);
+    return writer.result();
+}
+
+size_t writeMdnsQuestion(uint8_t *out, size_t capacity, const char *name, uint16_t type, bool unicastResponse) {
+    MdnsWriter writer(out, capacity);
+    writer.name(name);
+    writer.u16(type);
+    writer.u16(DNS_CLASS_IN | (unicastResponse ? MDNS_CLASS_TOP_BIT : 0));
+    return writer.result();
+}
+
+size_t writeMdnsPtr(uint8_t *out, size_t capacity, const char *name, const char *target, uint32_t ttl) {
+    MdnsWriter writer(out, capacity);
+    // shared, many responders answer for the same service type
+    size_t dataLengthAt = writer.record(name, DNS_TYPE_PTR, false, ttl);
+    writer.name(target);
+    writer.endRecord(dataLengthAt);
+    return writer.result();
+}
+
+size_t writeMdnsSrv(uint8_t *out, size_t capacity, const char *name, const char *host, uint16_t port, uint32_t ttl) {
+    MdnsWriter writer(out, capacity);
+    size_t dataLengthAt = writer.record(name, DNS_TYPE_SRV, true, ttl);
+    // priority, weight
+    writer.u16(0);
+    writer.u16(0);
+    writer.u16(port);
+    writer.name(host);
+    writer.endRecord(dataLengthAt);
+    return writer.result();
+}
+
+size_t writeMdnsTxt(uint8_t *out, size_t capacity, const char *name, const char *const *items, uint8_t itemCount,
+                    uint32_t ttl) {
+    MdnsWriter writer(out, capacity);
+    size_t dataLengthAt = writer.record(name, DNS_TYPE_TXT, true, ttl);
+    for (uint8_t i = 0; i < itemCount; i++) {
+        size_t itemLength = strlen(items[i]);
+        if (itemLength > 255) {
+            return 0;
+        }
+        writer.u8(itemLength);
+        for (size_t j = 0; j < itemLength; j++) {
+            writer.u8(items[i][j]);
+        }
+    }
+    // RFC 6763 6.1, no items is a single empty string
+    if (itemCount == 0) {
+        writer.u8(0);
+    }
+    writer.endRecord(dataLengthAt);
+    return writer.result();
+}
+
+size_t writeMdnsA(uint8_t *out, size_t capacity, const char *name, uint32_t address, uint32_t ttl) {
+    MdnsWriter writer(out, capacity);
+    size_t dataLengthAt = writer.record(name, DNS_TYPE_A, true, ttl);
+    writer.u32(address);
+    writer.endRecord(dataLengthAt);
+    return writer.result();
+}
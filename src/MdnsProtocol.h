@@ -0,0 +1,119 @@
+#ifndef ESP32_LIGHT_MDNSPROTOCOL_H
+#define ESP32_LIGHT_MDNSPROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Multicast DNS (RFC 6762) messages, without any networking so it is shared by `MdnsDiscovery` on the device and the
+ * host tools.  Names are dotted strings, a dot or backslash within a label (e.g. in a service instance name) is escaped
+ * with a backslash as in RFC 6763 4.3.  Names are written without compression, so records can be copied between
+ * messages as they are.
+ */
+
+#define MDNS_PORT 5353
+// 224.0.0.251, in host byte order
+#define MDNS_GROUP ((224u << 24) | 251u)
+
+#define MDNS_HEADER_SIZE 12
+// longest dotted name kept, including the terminating 0, longer ones are never ours
+#define MDNS_NAME_LENGTH 96
+#define MDNS_MAX_QUESTIONS 4
+// about as many as fit in one message, a responder only needs to find its own among them
+#define MDNS_MAX_KNOWN_ANSWERS 48
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_TXT 16
+#define DNS_TYPE_SRV 33
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+// the top bit of the class, in a question: a unicast response is accepted, in a record: flush the cached ones
+#define MDNS_CLASS_TOP_BIT 0x8000
+
+#define DNS_FLAG_RESPONSE 0x8000
+#define DNS_FLAG_AUTHORITATIVE 0x0400
+// in a query: more known answers follow in the next messages (RFC 6762 7.2)
+#define DNS_FLAG_TRUNCATED 0x0200
+
+struct MdnsQuestion {
+    char name[MDNS_NAME_LENGTH];
+    uint16_t type;
+    // QU, the querier accepts a unicast response
+    bool unicastResponse;
+};
+
+// a resource record, the rdata of PTR (target), SRV (target and port) and A records is decoded
+struct MdnsRecord {
+    char name[MDNS_NAME_LENGTH];
+    uint16_t type;
+    bool cacheFlush;
+    uint32_t ttl;
+    char target[MDNS_NAME_LENGTH];
+    uint16_t port;
+    uint32_t address;
+    // the raw rdata, pointing into the message
+    const uint8_t *data;
+    uint16_t dataLength;
+};
+
+// a record the querier already has (RFC 6762 7.1), with the names hashed by mdnsNameHash()
+struct MdnsKnownAnswer {
+    uint32_t nameHash;
+    uint16_t type;
+    uint32_t ttl;
+    // PTR and SRV target, SRV port
+    uint32_t targetHash;
+    uint16_t port;
+    // the raw rdata, pointing into the message
+    const uint8_t *data;
+    uint16_t dataLength;
+};
+
+struct MdnsQuery {
+    uint16_t id;
+    uint8_t questionCount;
+    MdnsQuestion questions[MDNS_MAX_QUESTIONS];
+    uint8_t knownAnswerCount;
+    MdnsKnownAnswer knownAnswers[MDNS_MAX_KNOWN_ANSWERS];
+    // questions or known answers that did not fit or had names longer than MDNS_NAME_LENGTH were left out, or the
+    // known answers go on in the next message
+    bool truncated;
+};
+
+enum MdnsParseResult : uint8_t {
+    MDNS_PARSE_QUERY,
+    // a response of another responder, or our own looped back
+    MDNS_PARSE_RESPONSE,
+    MDNS_PARSE_ERROR
+};
+
+MdnsParseResult parseMdnsQuery(const uint8_t *packet, size_t length, MdnsQuery &query);
+
+// the offset of the first record (past the questions), 0 when the message is malformed
+size_t skipMdnsQuestions(const uint8_t *packet, size_t length);
+// reads the record at `offset` and moves `offset` past it, false when the message is malformed or too short
+bool readMdnsRecord(const uint8_t *packet, size_t length, size_t &offset, MdnsRecord &record);
+
+// DNS names compare case insensitively
+bool mdnsNameEquals(const char *a, const char *b);
+// FNV-1a of the lower case name, equal names hash the same
+uint32_t mdnsNameHash(const char *name);
+
+// writing returns the bytes written, or 0 if it does not fit in `capacity`
+size_t writeMdnsHeader(uint8_t *out, size_t capacity, uint16_t id, uint16_t flags, uint16_t questions,
+                       uint16_t answers, uint16_t additionals);
+size_t writeMdnsName(uint8_t *out, size_t capacity, const char *name);
+size_t writeMdnsQuestion(uint8_t *out, size_t capacity, const char *name, uint16_t type, bool unicastResponse);
+// the cache flush bit is set on the SRV, TXT and A records, they are unique to the responder
+size_t writeMdnsPtr(uint8_t *out, size_t capacity, const char *name, const char *target, uint32_t ttl);
+size_t writeMdnsSrv(uint8_t *out, size_t capacity, const char *name, const char *host, uint16_t port, uint32_t ttl);
+size_t writeMdnsTxt(uint8_t *out, size_t capacity, const char *name, const char *const *items, uint8_t itemCount,
+                    uint32_t ttl);
+// `address` in host byte order
+size_t writeMdnsA(uint8_t *out, size_t capacity, const char *name, uint32_t address, uint32_t ttl);
+
+// a label of a dotted name, with dots and backslashes escaped, returns false if it does not fit
+bool escapeMdnsLabel(char *out, size_t capacity, const char *label);
+
+#endif //ESP32_LIGHT_MDNSPROTOCOL_H
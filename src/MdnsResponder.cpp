@@ -0,0 +1,374 @@
+#include "MdnsResponder.h"
+#include <stdio.h>
+#include <string.h>
+
+// the enumeration PTR, and PTR, SRV, TXT of every service and the A record
+#define MDNS_MAX_RECORDS (2 + 3 * MDNS_MAX_SERVICES)
+
+// what an answer has to match to be a known answer of the querier
+struct MdnsCandidate {
+    MdnsBlock *block;
+    uint32_t nameHash;
+    uint16_t type;
+    // PTR and SRV target, SRV port, the others are compared by their rdata
+    uint32_t targetHash;
+    uint16_t port;
+};
+
+// the length of an uncompressed name on the wire
+static uint16_t wireNameLength(const uint8_t *name) {
+    uint16_t length = 0;
+    while (name[length] != 0) {
+        length += name[length] + 1;
+    }
+    return length + 1;
+}
+
+static void finishBlock(MdnsBlock &block, size_t length, uint32_t ttl) {
+    block.length = length;
+    block.nameLength = length > 0 ? wireNameLength(block.data) : 0;
+    block.ttl = ttl;
+    // a new record, it may be multicast right away
+    block.multicast = false;
+}
+
+static void writeTtl(uint8_t *record, uint16_t nameLength, uint32_t ttl) {
+    uint8_t *at = record + nameLength + 4;
+    at[0] = ttl >> 24;
+    at[1] = (ttl >> 16) & 0xFF;
+    at[2] = (ttl >> 8) & 0xFF;
+    at[3] = ttl & 0xFF;
+}
+
+// copies a block to the message, for a legacy querier without the cache flush bit and with a short TTL
+static bool appendBlock(uint8_t *out, size_t capacity, size_t &length, const MdnsBlock &block, bool legacy) {
+    if (length + block.length > capacity) {
+        return false;
+    }
+    memcpy(out + length, block.data, block.length);
+    if (legacy) {
+        out[length + block.nameLength + 2] &= ~(MDNS_CLASS_TOP_BIT >> 8);
+        writeTtl(out + length, block.nameLength, block.ttl < MDNS_LEGACY_TTL ? block.ttl : MDNS_LEGACY_TTL);
+    }
+    length += block.length;
+    return true;
+}
+
+static bool isKnownAnswer(const MdnsQuery &query, const MdnsCandidate &candidate) {
+    const MdnsBlock &block = *candidate.block;
+    const uint8_t *data = block.data + block.nameLength + 10;
+    uint16_t dataLength = block.length - block.nameLength - 10;
+
+    for (uint8_t i = 0; i < query.knownAnswerCount; i++) {
+        const MdnsKnownAnswer &known = query.knownAnswers[i];
+        // RFC 6762 7.1, only if the querier keeps it for at least half the time we would
+        if (known.type != candidate.type || known.ttl < block.ttl / 2 || known.nameHash != candidate.nameHash) {
+            continue;
+        }
+        bool same;
+        if (candidate.type == DNS_TYPE_PTR) {
+            same = known.targetHash == candidate.targetHash;
+        } else if (candidate.type == DNS_TYPE_SRV) {
+            same = known.port == candidate.port && known.targetHash == candidate.targetHash;
+        } else {
+            same = known.dataLength == dataLength && memcmp(known.data, data, dataLength) == 0;
+        }
+        if (same) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a record asked for by several questions goes in once
+static void addCandidate(MdnsCandidate *list, uint8_t &count, const MdnsCandidate &candidate) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (list[i].block == candidate.block) {
+            return;
+        }
+    }
+    list[count++] = candidate;
+}
+
+static bool wasMulticastRecently(const MdnsBlock &block, uint32_t nowMs) {
+    return block.multicast && nowMs - block.multicastMs < MDNS_MULTICAST_INTERVAL_MS;
+}
+
+MdnsResponder::MdnsResponder() {
+    typeHash = mdnsNameHash(MDNS_SERVICE_TYPE);
+    enumerationHash = mdnsNameHash(MDNS_SERVICE_ENUMERATION);
+    finishBlock(enumeration, writeMdnsPtr(enumeration.data, sizeof(enumeration.data), MDNS_SERVICE_ENUMERATION,
+                                          MDNS_SERVICE_TYPE, MDNS_SERVICE_TTL), MDNS_SERVICE_TTL);
+}
+
+void MdnsResponder::rebuildHost() {
+    size_t length = address != 0 ? writeMdnsA(hostA.data, sizeof(hostA.data), hostName, address, MDNS_HOST_TTL) : 0;
+    finishBlock(hostA, length, MDNS_HOST_TTL);
+}
+
+void MdnsResponder::rebuildService(MdnsService &service) {
+    finishBlock(service.ptr, writeMdnsPtr(service.ptr.data, sizeof(service.ptr.data), MDNS_SERVICE_TYPE, service.name,
+                                          MDNS_SERVICE_TTL), MDNS_SERVICE_TTL);
+    finishBlock(service.srv, writeMdnsSrv(service.srv.data, sizeof(service.srv.data), service.name, hostName,
+                                          service.port, MDNS_HOST_TTL), MDNS_HOST_TTL);
+
+    // the TXT records the Elgato Control Center looks for
+    char id[24];
+    snprintf(id, sizeof(id), "id=%s", service.deviceId);
+    const char *items[] = {"mf=Elgato", "dt=200", id, "md=" MDNS_SERVICE_MODEL, "pv=1.0"};
+    finishBlock(service.txt, writeMdnsTxt(service.txt.data, sizeof(service.txt.data), service.name, items, 5,
+                                          MDNS_SERVICE_TTL), MDNS_SERVICE_TTL);
+}
+
+void MdnsResponder::announceChange() {
+    stats.rebuilds++;
+    announcementDue = true;
+}
+
+bool MdnsResponder::setHost(const char *label, uint32_t ipv4) {
+    bool renamed = strncmp(label, hostLabel, sizeof(hostLabel) - 1) != 0;
+    if (!renamed && ipv4 == address) {
+        return false;
+    }
+
+    if (renamed) {
+        char escaped[MDNS_NAME_LENGTH - 6];
+        strncpy(hostLabel, label, sizeof(hostLabel) - 1);
+        if (!escapeMdnsLabel(escaped, sizeof(escaped), hostLabel)) {
+            escaped[0] = '\0';
+        }
+        snprintf(hostName, sizeof(hostName), "%s.local", escaped);
+        hostNameHash = mdnsNameHash(hostName);
+        // the SRV records point to the host
+        for (MdnsService &service : services) {
+            if (service.used) {
+                rebuildService(service);
+            }
+        }
+    }
+    address = ipv4;
+    rebuildHost();
+    announceChange();
+    return true;
+}
+
+bool MdnsResponder::setService(uint8_t index, const char *instanceName, const char *deviceId, uint16_t port) {
+    if (index >= MDNS_MAX_SERVICES) {
+        return false;
+    }
+    MdnsService &service = services[index];
+    bool renamed = strncmp(instanceName, service.instanceName, sizeof(service.instanceName) - 1) != 0;
+    if (service.used && !renamed && strncmp(deviceId, service.deviceId, sizeof(service.deviceId) - 1) == 0
+        && port == service.port) {
+        return false;
+    }
+
+    // room for `.<type>` in the name
+    char escaped[MDNS_NAME_LENGTH - sizeof(MDNS_SERVICE_TYPE)];
+    char label[sizeof(service.instanceName)] = {};
+    strncpy(label, instanceName, sizeof(label) - 1);
+    if (!escapeMdnsLabel(escaped, sizeof(escaped), label)) {
+        return false;
+    }
+
+    // controllers drop the old instance once they get the goodbye, the other records flush their caches
+    if (service.used && renamed && service.ptr.length > 0) {
+        service.goodbye = service.ptr;
+        writeTtl(service.goodbye.data, service.goodbye.nameLength, 0);
+    }
+
+    service.used = true;
+    strcpy(service.instanceName, label);
+    snprintf(service.name, sizeof(service.name), "%s.%s", escaped, MDNS_SERVICE_TYPE);
+    service.nameHash = mdnsNameHash(service.name);
+    strncpy(service.deviceId, deviceId, sizeof(service.deviceId) - 1);
+    service.port = port;
+    rebuildService(service);
+    announceChange();
+    return true;
+}
+
+size_t MdnsResponder::respond(const MdnsQuery &query, bool legacy, uint32_t nowMs, uint8_t *out, size_t capacity,
+                              bool &unicast) {
+    stats.queries++;
+    unicast = legacy;
+
+    MdnsCandidate answers[MDNS_MAX_RECORDS];
+    MdnsCandidate additionals[MDNS_MAX_RECORDS];
+    uint8_t answerCount = 0;
+    uint8_t additionalCount = 0;
+    bool addHostA = false;
+
+    // nothing to answer with before the address is known
+    for (uint8_t i = 0; i < query.questionCount && hostA.length > 0; i++) {
+        const MdnsQuestion &question = query.questions[i];
+        bool any = question.type == DNS_TYPE_ANY;
+        uint8_t before = answerCount;
+
+        if ((any || question.type == DNS_TYPE_PTR) && mdnsNameEquals(question.name, MDNS_SERVICE_ENUMERATION)) {
+            addCandidate(answers, answerCount,
+                         {&enumeration, enumerationHash, DNS_TYPE_PTR, typeHash, 0});
+        }
+        if ((any || question.type == DNS_TYPE_A) && mdnsNameEquals(question.name, hostName)) {
+            addCandidate(answers, answerCount, {&hostA, hostNameHash, DNS_TYPE_A, 0, 0});
+        }
+        bool browsing = (any || question.type == DNS_TYPE_PTR) && mdnsNameEquals(question.name, MDNS_SERVICE_TYPE);
+        for (MdnsService &service : services) {
+            if (!service.used || service.ptr.length == 0) {
+                continue;
+            }
+            MdnsCandidate srv = {&service.srv, service.nameHash, DNS_TYPE_SRV, hostNameHash, service.port};
+            MdnsCandidate txt = {&service.txt, service.nameHash, DNS_TYPE_TXT, 0, 0};
+            if (browsing) {
+                // RFC 6763 12.1, what resolving the instance needs goes along
+                addCandidate(answers, answerCount, {&service.ptr, typeHash, DNS_TYPE_PTR, service.nameHash, 0});
+                addCandidate(additionals, additionalCount, srv);
+                addCandidate(additionals, additionalCount, txt);
+                addHostA = true;
+            } else if (mdnsNameEquals(question.name, service.name)) {
+                if (any || question.type == DNS_TYPE_SRV) {
+                    addCandidate(answers, answerCount, srv);
+                    addHostA = true;
+                }
+                if (any || question.type == DNS_TYPE_TXT) {
+                    addCandidate(answers, answerCount, txt);
+                }
+            }
+        }
+
+        if (answerCount > before && question.unicastResponse) {
+            unicast = true;
+        }
+    }
+
+    if (answerCount == 0) {
+        stats.notForUs++;
+        return 0;
+    }
+    if (addHostA) {
+        addCandidate(additionals, additionalCount, {&hostA, hostNameHash, DNS_TYPE_A, 0, 0});
+    }
+
+    // leave out what the querier has, and (multicast) what was just sent to everyone
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < answerCount; i++) {
+        if (isKnownAnswer(query, answers[i])) {
+            stats.suppressedKnown++;
+        } else if (!unicast && wasMulticastRecently(*answers[i].block, nowMs)) {
+            stats.suppressedRateLimit++;
+        } else {
+            answers[kept++] = answers[i];
+        }
+    }
+    answerCount = kept;
+    if (answerCount == 0 || capacity < MDNS_HEADER_SIZE) {
+        return 0;
+    }
+
+    kept = 0;
+    for (uint8_t i = 0; i < additionalCount; i++) {
+        bool duplicate = false;
+        for (uint8_t j = 0; j < answerCount && !duplicate; j++) {
+            duplicate = answers[j].block == additionals[i].block;
+        }
+        if (!duplicate && !isKnownAnswer(query, additionals[i])
+            && (unicast || !wasMulticastRecently(*additionals[i].block, nowMs))) {
+            additionals[kept++] = additionals[i];
+        }
+    }
+    additionalCount = kept;
+
+    // the header goes in last, with the records that fit
+    size_t length = MDNS_HEADER_SIZE;
+    uint8_t questionCount = 0;
+    for (uint8_t i = 0; legacy && i < query.questionCount; i++) {
+        // RFC 6762 6.7, a legacy response repeats the question
+        size_t written = writeMdnsQuestion(out + length, capacity - length, query.questions[i].name,
+                                           query.questions[i].type, false);
+        if (written == 0) {
+            return 0;
+        }
+        length += written;
+        questionCount++;
+    }
+
+    uint8_t answersWritten = 0;
+    for (uint8_t i = 0; i < answerCount && appendBlock(out, capacity, length, *answers[i].block, legacy); i++) {
+        answersWritten++;
+    }
+    uint8_t additionalsWritten = 0;
+    for (uint8_t i = 0; i < additionalCount && appendBlock(out, capacity, length, *additionals[i].block, legacy); i++) {
+        additionalsWritten++;
+    }
+    if (answersWritten == 0
+        || writeMdnsHeader(out, capacity, legacy ? query.id : 0, DNS_FLAG_RESPONSE | DNS_FLAG_AUTHORITATIVE,
+                           questionCount, answersWritten, additionalsWritten) == 0) {
+        return 0;
+    }
+
+    if (!unicast) {
+        for (uint8_t i = 0; i < answersWritten; i++) {
+            answers[i].block->multicast = true;
+            answers[i].block->multicastMs = nowMs;
+        }
+        for (uint8_t i = 0; i < additionalsWritten; i++) {
+            additionals[i].block->multicast = true;
+            additionals[i].block->multicastMs = nowMs;
+        }
+    }
+    stats.answers++;
+    stats.records += answersWritten + additionalsWritten;
+    return length;
+}
+
+size_t MdnsResponder::announce(uint32_t nowMs, uint8_t *out, size_t capacity) {
+    if (announcementDue) {
+        announcementDue = false;
+        announcementsLeft = MDNS_ANNOUNCEMENTS;
+        nextAnnouncementMs = nowMs;
+    }
+    if (announcementsLeft == 0 || (int32_t) (nowMs - nextAnnouncementMs) < 0 || hostA.length == 0) {
+        return 0;
+    }
+
+    MdnsBlock *records[MDNS_MAX_RECORDS + MDNS_MAX_SERVICES];
+    uint8_t recordCount = 0;
+    for (MdnsService &service : services) {
+        if (service.goodbye.length > 0) {
+            records[recordCount++] = &service.goodbye;
+        }
+    }
+    records[recordCount++] = &enumeration;
+    for (MdnsService &service : services) {
+        if (service.used && service.ptr.length > 0) {
+            records[recordCount++] = &service.ptr;
+            records[recordCount++] = &service.srv;
+            records[recordCount++] = &service.txt;
+        }
+    }
+    records[recordCount++] = &hostA;
+
+    size_t length = MDNS_HEADER_SIZE;
+    uint8_t written = 0;
+    for (uint8_t i = 0; i < recordCount && appendBlock(out, capacity, length, *records[i], false); i++) {
+        records[i]->multicast = true;
+        records[i]->multicastMs = nowMs;
+        written++;
+    }
+    if (written == 0
+        || writeMdnsHeader(out, capacity, 0, DNS_FLAG_RESPONSE | DNS_FLAG_AUTHORITATIVE, 0, written, 0) == 0) {
+        return 0;
+    }
+
+    announcementsLeft--;
+    nextAnnouncementMs = nowMs + MDNS_MULTICAST_INTERVAL_MS;
+    if (announcementsLeft == 0) {
+        for (MdnsService &service : services) {
+            service.goodbye.length = 0;
+        }
+    }
+    stats.announcements++;
+    stats.answers++;
+    stats.records += written;
+    return length;
+}
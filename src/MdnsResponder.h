@@ -0,0 +1,144 @@
+#ifndef ESP32_LIGHT_MDNSRESPONDER_H
+#define ESP32_LIGHT_MDNSRESPONDER_H
+
+#include "MdnsProtocol.h"
+
+// one service per emulated light
+#define MDNS_MAX_SERVICES 4
+#define MDNS_SERVICE_TYPE "_elg._tcp.local"
+// DNS-SD service type enumeration (RFC 6763 9)
+#define MDNS_SERVICE_ENUMERATION "_services._dns-sd._udp.local"
+#define MDNS_SERVICE_MODEL "Elgato Key Light Air 20LAB9901"
+
+// RFC 6762 10, records with a host name (SRV, A) and the others
+#define MDNS_HOST_TTL 120
+#define MDNS_SERVICE_TTL 4500
+// RFC 6762 6.7, for queriers that are not mDNS aware
+#define MDNS_LEGACY_TTL 10
+// RFC 6762 6, a record is multicast at most once a second
+#define MDNS_MULTICAST_INTERVAL_MS 1000
+// RFC 6762 8.3, announced twice a second apart
+#define MDNS_ANNOUNCEMENTS 2
+
+// a precomputed record fits this, the longest is the SRV of a 63 byte instance name
+#define MDNS_RECORD_SIZE 192
+// a response stays within one Ethernet frame, the additional records that don't fit are left out
+#define MDNS_PACKET_SIZE 1440
+
+// a record as it goes on the wire, rebuilt when what it holds changes
+struct MdnsBlock {
+    uint8_t data[MDNS_RECORD_SIZE];
+    uint16_t length = 0;
+    // the type, class and TTL follow the name
+    uint16_t nameLength = 0;
+    uint32_t ttl = 0;
+    // when the record was last multicast, see MDNS_MULTICAST_INTERVAL_MS
+    bool multicast = false;
+    uint32_t multicastMs = 0;
+};
+
+struct MdnsService {
+    bool used = false;
+    // the instance label as registered, and the escaped `<instance>._elg._tcp.local`
+    char instanceName[64] = {};
+    char name[MDNS_NAME_LENGTH] = {};
+    uint32_t nameHash = 0;
+    char deviceId[18] = {};
+    uint16_t port = 0;
+
+    MdnsBlock ptr;
+    MdnsBlock srv;
+    MdnsBlock txt;
+    // the PTR of the previous instance name with TTL 0, sent with the next announcements
+    MdnsBlock goodbye;
+};
+
+struct MdnsStats {
+    uint32_t queries = 0;
+    // queries without a question for one of our names
+    uint32_t notForUs = 0;
+    // response messages (and the records in them) sent, announcements included
+    uint32_t answers = 0;
+    uint32_t records = 0;
+    uint32_t announcements = 0;
+    // answer records left out because the querier listed them as known answers, or they were multicast less than
+    // MDNS_MULTICAST_INTERVAL_MS ago
+    uint32_t suppressedKnown = 0;
+    uint32_t suppressedRateLimit = 0;
+    // record blocks rebuilt after the host or a service changed
+    uint32_t rebuilds = 0;
+};
+
+/*
+ * Answers mDNS/DNS-SD queries for the `_elg._tcp` services of the lights and the A record of the host, without the
+ * networking (MdnsDiscovery on the device, the fleet and `mdns-storm` on the host).
+ *
+ * Every record is written once to an MdnsBlock and only rebuilt when the host name or address, or a service's instance
+ * name, device id or port changes, a response is assembled by copying the blocks.  To keep query storms cheap a
+ * record is left out when the query lists it as a known answer with at least half its TTL left (RFC 6762 7.1), and
+ * when it was multicast less than a second ago (RFC 6762 6), a query is not answered at all if nothing is left.
+ *
+ * Probing and conflict resolution are not done, the names are the ones configured.  A query whose known answers go on
+ * in further messages (TC) is answered right away, without waiting for them.  Only IPv4.
+ */
+class MdnsResponder {
+
+private:
+    char hostLabel[64] = {};
+    // `<host>.local`
+    char hostName[MDNS_NAME_LENGTH] = {};
+    uint32_t hostNameHash = 0;
+    uint32_t address = 0;
+    // known answers are matched by the hashes of the names
+    uint32_t typeHash;
+    uint32_t enumerationHash;
+    MdnsBlock hostA;
+    // `_services._dns-sd._udp.local` PTR `_elg._tcp.local`
+    MdnsBlock enumeration;
+    MdnsService services[MDNS_MAX_SERVICES];
+
+    uint8_t announcementsLeft = 0;
+    bool announcementDue = false;
+    uint32_t nextAnnouncementMs = 0;
+
+    MdnsStats stats;
+
+    void rebuildService(MdnsService &service);
+    void rebuildHost();
+    void announceChange();
+
+public:
+    MdnsResponder();
+
+    // `label` is the host name without `.local`, `ipv4` in host byte order, returns true if anything changed
+    bool setHost(const char *label, uint32_t ipv4);
+    // registers or updates the service of a light, returns true if anything changed
+    bool setService(uint8_t index, const char *instanceName, const char *deviceId, uint16_t port);
+
+    // writes the response to a parsed query to `out` and returns its length, 0 if there is nothing to send.  A query
+    // from a port other than MDNS_PORT is `legacy` (RFC 6762 6.7).  `unicast` is set when the response goes to the
+    // querier instead of the group.
+    size_t respond(const MdnsQuery &query, bool legacy, uint32_t nowMs, uint8_t *out, size_t capacity, bool &unicast);
+
+    // writes an unsolicited response announcing every record to `out` when one is due after starting or a change,
+    // to be multicast, and returns its length (0 if none is due)
+    size_t announce(uint32_t nowMs, uint8_t *out, size_t capacity);
+
+    const char *getHostName() const {
+        return hostName;
+    }
+
+    const char *getServiceName(uint8_t index) const {
+        return index < MDNS_MAX_SERVICES && services[index].used ? services[index].name : nullptr;
+    }
+
+    const MdnsStats &getStats() const {
+        return stats;
+    }
+
+    void resetStats() {
+        stats = MdnsStats();
+    }
+};
+
+#endif //ESP32_LIGHT_MDNSRESPONDER_H
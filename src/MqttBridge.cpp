@@ -0,0 +1,209 @@
+#include "MqttBridge.h"
+#include <Preferences.h>
+
+MqttBridge::MqttBridge(Lights &lights, Settings &settings, SemaphoreHandle_t stateLock)
+        : client(wifiClient), lights(lights), settings(settings), stateLock(stateLock) {}
+
+void MqttBridge::begin(const char *deviceId, const char *name, MqttCommandFunction commandFunction) {
+
+    Preferences prefs;
+    prefs.begin("mqtt", false);
+    host = prefs.getString("host", "");
+    port = prefs.getUShort("port", 1883);
+    user = prefs.getString("user", "");
+    pass = prefs.getString("pass", "");
+    topic = prefs.getString("topic", "elgato");
+    prefs.end();
+    Serial.flush(); // flush is required after getting preferences
+
+    if (host.isEmpty()) {
+        Serial.println("MQTT is NOT enabled, run `mqtt -host <broker>` to configure a broker");
+        return;
+    }
+
+    // topics use the device id without the colons, e.g. 3C6A9D13C1BD
+    id = deviceId;
+    id.replace(":", "");
+    strlcpy(displayName, name, sizeof(displayName));
+    onCommand = commandFunction;
+
+    client.setServer(host.c_str(), port);
+    // the Home Assistant discovery document is larger than the default 256 byte buffer
+    client.setBufferSize(1024);
+    client.setCallback([this](char *messageTopic, uint8_t *payload, unsigned int length) {
+        handleMessage(messageTopic, payload, length);
+    });
+
+    enabled = true;
+    Serial.print("MQTT broker: ");
+    Serial.print(host);
+    Serial.print(":");
+    Serial.println(port);
+}
+
+String MqttBridge::topicFor(const char *suffix) {
+    return topic + "/" + id + "/" + suffix;
+}
+
+bool MqttBridge::connect() {
+    String clientId = "fake-light-" + id;
+    String willTopic = topicFor("status");
+
+    bool connected = user.isEmpty()
+            ? client.connect(clientId.c_str(), willTopic.c_str(), 1, true, "offline")
+            : client.connect(clientId.c_str(), user.c_str(), pass.c_str(), willTopic.c_str(), 1, true, "offline");
+
+    if (!connected) {
+        return false;
+    }
+
+    client.publish(willTopic.c_str(), "online", true);
+    client.subscribe(topicFor("lights/set").c_str());
+    publishDiscovery();
+
+    // the broker may have lost the retained state, always publish after a (re)connect
+    publishState(true);
+    return true;
+}
+
+void MqttBridge::publishDiscovery() {
+    discoveryDirty = false;
+
+    // a consistent copy, the API may be renaming the light on the AsyncTCP task
+    char name[sizeof(displayName)];
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    strlcpy(name, displayName, sizeof(name));
+    xSemaphoreGive(stateLock);
+
+    // Home Assistant MQTT discovery, the templates translate to and from the Elgato JSON so commands from Home
+    // Assistant follow the same path as `PUT /elgato/lights`
+    DynamicJsonDocument doc(1024);
+    doc["name"] = name;
+    doc["unique_id"] = id;
+    doc["schema"] = "template";
+    doc["state_topic"] = topicFor("lights");
+    doc["command_topic"] = topicFor("lights/set");
+    doc["availability_topic"] = topicFor("status");
+    doc["command_on_template"] = "{\"lights\":[{\"on\":1"
+                                 "{%- if brightness is defined -%},\"brightness\":{{ (brightness / 2.55) | round | int }}{%- endif -%}"
+                                 "}]}";
+    doc["command_off_template"] = "{\"lights\":[{\"on\":0}]}";
+    doc["state_template"] = "{{ 'on' if value_json.lights[0].on == 1 else 'off' }}";
+    doc["brightness_template"] = "{{ (value_json.lights[0].brightness * 2.55) | round | int }}";
+
+    JsonObject device = doc.createNestedObject("device");
+    device["identifiers"] = id;
+    device["name"] = name;
+    device["manufacturer"] = "Elgato";
+    device["model"] = "Elgato Key Light Air";
+
+    String payload;
+    serializeJson(doc, payload);
+    String discoveryTopic = "homeassistant/light/" + id + "/config";
+    client.publish(discoveryTopic.c_str(), payload.c_str(), true);
+}
+
+void MqttBridge::publishState(bool force) {
+    stateDirty = false;
+    lastPublish = millis();
+
+    // a consistent copy, the API may be changing the state on the AsyncTCP task
+    xSemaphoreTake(stateLock, portMAX_DELAY);
+    Lights currentLights = lights;
+    Settings currentSettings = settings;
+    xSemaphoreGive(stateLock);
+
+    Light &light = currentLights.lights[0];
+    bool lightChanged = !published
+            || light.on != publishedLight.on
+            || light.brightness != publishedLight.brightness
+            || light.temperature != publishedLight.temperature;
+
+    bool settingsChanged = !published
+            || currentSettings.powerOnBehavior != publishedSettings.powerOnBehavior
+            || currentSettings.powerOnBrightness != publishedSettings.powerOnBrightness
+            || currentSettings.powerOnTemperature != publishedSettings.powerOnTemperature
+            || currentSettings.colorChangeDurationMs != publishedSettings.colorChangeDurationMs
+            || currentSettings.switchOffDurationMs != publishedSettings.switchOffDurationMs
+            || currentSettings.switchOnDurationMs != publishedSettings.switchOnDurationMs;
+
+    String payload;
+    if (force || lightChanged) {
+        DynamicJsonDocument doc(256);
+        JsonObject jsonObject = doc.to<JsonObject>();
+        currentLights.toJson(jsonObject);
+        serializeJson(doc, payload);
+        client.publish(topicFor("lights").c_str(), payload.c_str(), true);
+        publishedLight = light;
+    }
+
+    if (force || settingsChanged) {
+        DynamicJsonDocument doc(256);
+        JsonObject jsonObject = doc.to<JsonObject>();
+        currentSettings.toJson(jsonObject);
+        payload = "";
+        serializeJson(doc, payload);
+        client.publish(topicFor("settings").c_str(), payload.c_str(), true);
+        publishedSettings = currentSettings;
+    }
+
+    published = true;
+}
+
+void MqttBridge::handleMessage(char * /* messageTopic */, uint8_t *payload, unsigned int length) {
+    StaticJsonDocument<256> doc;
+    DeserializationError error = deserializeJson(doc, payload, length);
+    if (error) {
+        Serial.print("MQTT ignoring invalid command: ");
+        Serial.println(error.c_str());
+        return;
+    }
+
+    JsonObject jsonObj = doc.as<JsonObject>();
+    onCommand(jsonObj);
+}
+
+void MqttBridge::displayNameChanged(const char *name) {
+    strlcpy(displayName, name, sizeof(displayName));
+    discoveryDirty = true;
+}
+
+void MqttBridge::loop() {
+    if (!enabled || WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+
+    if (!client.connected()) {
+        unsigned long now = millis();
+        if ((long) (now - nextReconnect) < 0) {
+            return;
+        }
+
+        if (connect()) {
+            Serial.println("MQTT connected");
+            reconnectDelay = MQTT_RECONNECT_MIN_MS;
+        } else {
+            Serial.print("MQTT connection failed, state: ");
+            Serial.print(client.state());
+            Serial.print(", retrying in ");
+            Serial.print(reconnectDelay);
+            Serial.println("ms");
+
+            // exponential backoff so an unreachable broker doesn't keep the radio busy
+            nextReconnect = now + reconnectDelay;
+            reconnectDelay = min(reconnectDelay * 2, (unsigned long) MQTT_RECONNECT_MAX_MS);
+            return;
+        }
+    }
+
+    client.loop();
+
+    if (discoveryDirty) {
+        publishDiscovery();
+    }
+
+    // coalesce bursts (e.g. slider drags in Control Center) into at most one publish per interval
+    if (stateDirty && millis() - lastPublish >= MQTT_PUBLISH_INTERVAL_MS) {
+        publishState(false);
+    }
+}
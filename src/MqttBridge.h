@@ -0,0 +1,82 @@
+#ifndef ESP32_LIGHT_MQTTBRIDGE_H
+#define ESP32_LIGHT_MQTTBRIDGE_H
+
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <ArduinoJson.h>
+#include "AccessoryInfo.h"
+#include "Lights.h"
+#include "Settings.h"
+
+// minimum time between two state publishes, bursts of changes within this window are coalesced into one message
+#define MQTT_PUBLISH_INTERVAL_MS 250
+#define MQTT_RECONNECT_MIN_MS 1000
+#define MQTT_RECONNECT_MAX_MS 60000
+
+typedef std::function<void(JsonObject &)> MqttCommandFunction;
+
+/*
+ * Optional MQTT client, publishes the light and settings state as retained messages and accepts commands in the same
+ * format as `PUT /elgato/lights`, which the command function applies under the light's lock.  Disabled unless a broker
+ * host has been configured with the `mqtt` command.
+ *
+ * Topics (<topic> defaults to "elgato", <id> is the device id without colons):
+ *   <topic>/<id>/lights       - retained, same body as `GET /elgato/lights`
+ *   <topic>/<id>/settings     - retained, same body as `GET /elgato/lights/settings`
+ *   <topic>/<id>/lights/set   - commands, same body as `PUT /elgato/lights`
+ *   <topic>/<id>/status       - retained, "online" / "offline" (last will)
+ */
+class MqttBridge {
+
+private:
+    WiFiClient wifiClient;
+    PubSubClient client;
+    Lights &lights;
+    Settings &settings;
+    // held by the light while its state changes, see LightInstance::lockState()
+    SemaphoreHandle_t stateLock;
+    MqttCommandFunction onCommand;
+
+    String host;
+    uint16_t port = 1883;
+    String user;
+    String pass;
+    String topic;
+    String id;
+    // written from the web server task under the state lock, so keep it off the heap
+    char displayName[MAX_DISPLAY_NAME_LENGTH + 1] = "";
+
+    bool enabled = false;
+    volatile bool stateDirty = false;
+    volatile bool discoveryDirty = false;
+
+    unsigned long lastPublish = 0;
+    unsigned long nextReconnect = 0;
+    unsigned long reconnectDelay = MQTT_RECONNECT_MIN_MS;
+
+    // last state that was published, used to skip retained messages that would not change anything
+    bool published = false;
+    Light publishedLight;
+    Settings publishedSettings;
+
+    bool connect();
+    void publishDiscovery();
+    void publishState(bool force);
+    void handleMessage(char *messageTopic, uint8_t *payload, unsigned int length);
+    String topicFor(const char *suffix);
+
+public:
+    MqttBridge(Lights &lights, Settings &settings, SemaphoreHandle_t stateLock);
+
+    void begin(const char *deviceId, const char *name, MqttCommandFunction commandFunction);
+
+    // marks the state as changed, the actual publish happens from `loop()`
+    void stateChanged() { stateDirty = true; }
+
+    // call with the state locked, the API handlers are
+    void displayNameChanged(const char *name);
+
+    void loop();
+};
+
+#endif //ESP32_LIGHT_MQTTBRIDGE_H
@@ -0,0 +1,22 @@
+#include "PartitionFlash.h"
+
+bool PartitionFlash::begin(const char *name, uint8_t subtype) {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) subtype, name);
+    return partition != nullptr;
+}
+
+size_t PartitionFlash::size() const {
+    return partition != nullptr ? partition->size - partition->size % FLASH_SECTOR_SIZE : 0;
+}
+
+bool PartitionFlash::read(size_t offset, void *data, size_t length) {
+    return partition != nullptr && esp_partition_read(partition, offset, data, length) == ESP_OK;
+}
+
+bool PartitionFlash::write(size_t offset, const void *data, size_t length) {
+    return partition != nullptr && esp_partition_write(partition, offset, data, length) == ESP_OK;
+}
+
+bool PartitionFlash::eraseSector(size_t offset) {
+    return partition != nullptr && esp_partition_erase_range(partition, offset, FLASH_SECTOR_SIZE) == ESP_OK;
+}
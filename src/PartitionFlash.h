@@ -0,0 +1,29 @@
+#ifndef ESP32_LIGHT_PARTITIONFLASH_H
+#define ESP32_LIGHT_PARTITIONFLASH_H
+
+#include <esp_partition.h>
+#include "FlashBackend.h"
+
+// the data partition of the journal in partitions.csv
+#define JOURNAL_PARTITION_NAME "journal"
+#define JOURNAL_PARTITION_SUBTYPE 0x40
+
+/*
+ * A raw data partition, through the esp_partition API (which bounds checks every access).
+ */
+class PartitionFlash : public FlashBackend {
+
+private:
+    const esp_partition_t *partition = nullptr;
+
+public:
+    // returns false when the partition table has no such partition (e.g. a board flashed with the default table)
+    bool begin(const char *name, uint8_t subtype);
+
+    size_t size() const override;
+    bool read(size_t offset, void *data, size_t length) override;
+    bool write(size_t offset, const void *data, size_t length) override;
+    bool eraseSector(size_t offset) override;
+};
+
+#endif //ESP32_LIGHT_PARTITIONFLASH_H
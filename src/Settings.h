@@ -2,6 +2,7 @@
 #define ESP32_LIGHT_SETTINGS_H
 
 #include <ArduinoJson.h>
+#include "JsonValidation.h"
 
 struct Settings {
     int colorChangeDurationMs = 100;
@@ -24,14 +25,25 @@ struct Settings {
         doc["switchOnDurationMs"] = switchOnDurationMs;
     }
 
+    // checks a `PUT /elgato/lights/settings` body without applying it
+    static bool isValidJson(JsonObject &doc) {
+        return isValidJsonInteger(doc["colorChangeDurationMs"], 0, UINT16_MAX)
+               && isValidJsonInteger(doc["powerOnBehavior"], 0, UINT8_MAX)
+               && isValidJsonInteger(doc["powerOnBrightness"], 0, 100)
+               && isValidJsonInteger(doc["powerOnTemperature"], 0, UINT8_MAX)
+               && isValidJsonInteger(doc["switchOffDurationMs"], 0, UINT16_MAX)
+               && isValidJsonInteger(doc["switchOnDurationMs"], 0, UINT16_MAX);
+    }
+
+    // only the keys in `doc` are changed, so a partial body (or batch section) keeps the other settings
     void fromJson(JsonObject &doc) {
 
-        colorChangeDurationMs = doc["colorChangeDurationMs"];
-        powerOnBehavior = doc["powerOnBehavior"];
-        powerOnBrightness = doc["powerOnBrightness"];
-        powerOnTemperature = doc["powerOnTemperature"];
-        switchOffDurationMs = doc["switchOffDurationMs"];
-        switchOnDurationMs = doc["switchOnDurationMs"];
+        colorChangeDurationMs = doc["colorChangeDurationMs"] | colorChangeDurationMs;
+        powerOnBehavior = doc["powerOnBehavior"] | powerOnBehavior;
+        powerOnBrightness = doc["powerOnBrightness"] | powerOnBrightness;
+        powerOnTemperature = doc["powerOnTemperature"] | powerOnTemperature;
+        switchOffDurationMs = doc["switchOffDurationMs"] | switchOffDurationMs;
+        switchOnDurationMs = doc["switchOnDurationMs"] | switchOnDurationMs;
     }
 };
 
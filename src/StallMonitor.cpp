@@ -0,0 +1,426 @@
+#include "StallMonitor.h"
+#include <AsyncJson.h>
+#include <Preferences.h>
+#include <soc/soc_memory_layout.h>
+#include "Tasks.h"
+
+#define STALL_LOG_MAGIC 0x534C4F47
+
+// the snapshots, in memory that is not cleared by a soft reboot (only valid if the checksum matches)
+struct StallLog {
+    uint32_t magic;
+    uint32_t nextId;
+    uint32_t next;
+    StallSnapshot snapshots[STALL_SNAPSHOTS];
+    uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR static StallLog stallLog;
+static portMUX_TYPE logLock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *categoryNames[STALL_CATEGORIES] = {"http", "output", "persist"};
+
+// FNV-1a of everything but the checksum
+static uint32_t logChecksum() {
+    auto *bytes = (const uint8_t *) &stallLog;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(StallLog, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// has to be called with the log lock held
+static void validateLog() {
+    if (stallLog.magic != STALL_LOG_MAGIC || stallLog.next >= STALL_SNAPSHOTS || stallLog.checksum != logChecksum()) {
+        memset(&stallLog, 0, sizeof(stallLog));
+        stallLog.magic = STALL_LOG_MAGIC;
+        stallLog.nextId = 1;
+        stallLog.checksum = logChecksum();
+    }
+}
+
+static StallLog copyLog() {
+    StallLog log;
+    portENTER_CRITICAL(&logLock);
+    validateLog();
+    log = stallLog;
+    portEXIT_CRITICAL(&logLock);
+    return log;
+}
+
+static void updateSnapshot(int8_t index, uint32_t id, uint32_t elapsedMs, bool finished, bool rebooted) {
+    portENTER_CRITICAL(&logLock);
+    validateLog();
+    StallSnapshot &snapshot = stallLog.snapshots[index];
+    // it may have been replaced by a newer one
+    if (snapshot.id == id) {
+        snapshot.elapsedMs = elapsedMs;
+        snapshot.finished = finished;
+        snapshot.rebooted = rebooted;
+        stallLog.checksum = logChecksum();
+    }
+    portEXIT_CRITICAL(&logLock);
+}
+
+// code addresses on the saved part of a task's stack, the windowed ABI keeps the call size in the top two bits of a
+// return address so those are mapped back to the code region
+static uint8_t scanStack(TaskHandle_t task, uint32_t *backtrace) {
+    // pxTopOfStack is the first member of the task control block
+    const uint32_t *stack = *(uint32_t **) task;
+    if (!esp_ptr_internal(stack) || !esp_ptr_internal(stack + STALL_STACK_SCAN_WORDS)) {
+        return 0;
+    }
+
+    uint8_t length = 0;
+    for (uint32_t i = 0; i < STALL_STACK_SCAN_WORDS && length < STALL_BACKTRACE_DEPTH; i++) {
+        uint32_t value = stack[i];
+        uint32_t address = (value & 0x3FFFFFFF) | 0x40000000;
+        if ((value & 0xC0000000) != 0 && esp_ptr_executable((void *) address)) {
+            backtrace[length++] = address;
+        }
+    }
+    return length;
+}
+
+uint8_t StallMonitor::addPath(const char *name, StallCategory category) {
+    if (pathCount == MAX_STALL_PATHS) {
+        // the last path is shared by everything that does not fit
+        return MAX_STALL_PATHS - 1;
+    }
+    Path &path = paths[pathCount];
+    strncpy(path.name, name, sizeof(path.name) - 1);
+    path.name[sizeof(path.name) - 1] = '\0';
+    path.category = category;
+    path.calls = 0;
+    path.violations = 0;
+    path.maxUs = 0;
+    return pathCount++;
+}
+
+void StallMonitor::watchApi(ElgatoApi &api) {
+    if (routeBase < 0) {
+        routeBase = pathCount;
+        for (size_t i = 0; i < ElgatoApi::routeCount; i++) {
+            const ElgatoApi::Route &route = ElgatoApi::routes[i];
+            const char *method = route.method == API_GET ? "GET" : (route.method == API_PUT ? "PUT" : "POST");
+            char name[STALL_PATH_NAME_LENGTH];
+            snprintf(name, sizeof(name), "%s %s", method, route.uri);
+            addPath(name, STALL_HTTP);
+        }
+    }
+
+    api.hooks.handlerStarted = [this](size_t route) {
+        enter(routeBase + route);
+    };
+    api.hooks.handlerFinished = [this](size_t route) {
+        exitCurrent(routeBase + route);
+    };
+}
+
+void StallMonitor::begin() {
+    Preferences preferences;
+    preferences.begin("monitor", true);
+    for (uint8_t i = 0; i < STALL_CATEGORIES; i++) {
+        budgetsMs[i] = preferences.getUInt(categoryNames[i], budgetsMs[i]);
+    }
+    rebootAfterS = preferences.getUInt("reboot", rebootAfterS);
+    preferences.end();
+    Serial.flush(); // flush is required after getting preferences
+
+    StallLog log = copyLog();
+    uint8_t kept = 0;
+    for (const StallSnapshot &snapshot : log.snapshots) {
+        kept += snapshot.id != 0;
+    }
+    if (kept > 0) {
+        Serial.printf("%u stall snapshots kept from before the restart, run `stalls` to print them\n", kept);
+    }
+
+    xTaskCreatePinnedToCore(
+            monitorTask, /* Task function. */
+            "Stall monitor", /* name of task. */
+            STALL_MONITOR_TASK_STACK_SIZE, /* Stack size of task */
+            this, /* parameter of the task */
+            STALL_MONITOR_TASK_PRIORITY, /* priority of the task */
+            &task, /* Task handle to keep track of created task */
+            STALL_MONITOR_CORE); /* pin task to the output core */
+}
+
+void StallMonitor::addRoutes(AsyncWebServer &server) {
+    server.on("/stalls", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        auto *response = new AsyncJsonResponse(false, STALL_JSON_SIZE);
+        JsonObject root = response->getRoot();
+        toJson(root);
+        response->setLength();
+        request->send(response);
+    });
+}
+
+int8_t StallMonitor::enter(uint8_t path) {
+    if (path >= pathCount) {
+        return -1;
+    }
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    int64_t now = esp_timer_get_time();
+
+    int8_t watch = -1;
+    portENTER_CRITICAL(&lock);
+    paths[path].calls++;
+    for (int8_t i = 0; i < MAX_STALL_WATCHES; i++) {
+        if (!watches[i].active && !watches[i].pending) {
+            watches[i] = {true, false, false, path, -1, 0, current, now, 0};
+            watch = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return watch;
+}
+
+void StallMonitor::exit(int8_t watch) {
+    if (watch < 0) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&lock);
+    Watch &finished = watches[watch];
+    Path &path = paths[finished.path];
+    auto elapsedUs = (uint32_t) (now - finished.startUs);
+    bool over = elapsedUs > budgetsMs[path.category] * 1000;
+    path.maxUs = max(path.maxUs, elapsedUs);
+    if (over) {
+        path.violations++;
+    }
+    // the snapshot is taken (or updated) by the monitor task, this runs on the watched paths
+    finished.active = false;
+    finished.pending = over || finished.reported;
+    finished.elapsedUs = elapsedUs;
+    portEXIT_CRITICAL(&lock);
+}
+
+void StallMonitor::exitCurrent(uint8_t path) {
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+
+    int8_t watch = -1;
+    portENTER_CRITICAL(&lock);
+    for (int8_t i = 0; i < MAX_STALL_WATCHES && watch < 0; i++) {
+        if (watches[i].active && watches[i].task == current && watches[i].path == path) {
+            watch = i;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    exit(watch);
+}
+
+void StallMonitor::monitorTask(void *pvParameters) {
+    auto *monitor = static_cast<StallMonitor *>(pvParameters);
+    TickType_t lastWake = xTaskGetTickCount();
+
+    while (true) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(STALL_MONITOR_PERIOD_MS));
+        monitor->check();
+    }
+}
+
+void StallMonitor::check() {
+    for (uint8_t i = 0; i < MAX_STALL_WATCHES; i++) {
+        portENTER_CRITICAL(&lock);
+        Watch watch = watches[i];
+        uint32_t budgetMs = budgetsMs[paths[watch.path].category];
+        portEXIT_CRITICAL(&lock);
+
+        if (watch.pending) {
+            uint32_t id;
+            if (watch.reported) {
+                updateSnapshot(watch.snapshot, watch.snapshotId, watch.elapsedUs / 1000, true, false);
+            } else {
+                takeSnapshot(watch, watch.elapsedUs / 1000, true, id);
+            }
+            portENTER_CRITICAL(&lock);
+            watches[i].pending = false;
+            portEXIT_CRITICAL(&lock);
+            continue;
+        }
+        if (!watch.active) {
+            continue;
+        }
+
+        auto elapsedMs = (uint32_t) ((esp_timer_get_time() - watch.startUs) / 1000);
+        if (!watch.reported && elapsedMs > budgetMs) {
+            watch.snapshot = takeSnapshot(watch, elapsedMs, false, watch.snapshotId);
+            watch.reported = true;
+
+            // when it finished in the meantime, the snapshot is updated with the final time
+            portENTER_CRITICAL(&lock);
+            if (watches[i].startUs == watch.startUs && (watches[i].active || watches[i].pending)) {
+                watches[i].reported = true;
+                watches[i].snapshot = watch.snapshot;
+                watches[i].snapshotId = watch.snapshotId;
+            }
+            portEXIT_CRITICAL(&lock);
+        }
+
+        if (rebootAfterS > 0 && elapsedMs > rebootAfterS * 1000) {
+            // it never finishes, so count it here
+            portENTER_CRITICAL(&lock);
+            paths[watch.path].violations++;
+            portEXIT_CRITICAL(&lock);
+            if (watch.reported) {
+                updateSnapshot(watch.snapshot, watch.snapshotId, elapsedMs, false, true);
+            }
+            Serial.printf("%s stalled for %ums, restarting\n", paths[watch.path].name, elapsedMs);
+            Serial.flush();
+            ESP.restart();
+        }
+    }
+}
+
+int8_t StallMonitor::takeSnapshot(const Watch &watch, uint32_t elapsedMs, bool finished, uint32_t &id) {
+    StallSnapshot snapshot = {};
+    snapshot.uptimeMs = millis();
+    strncpy(snapshot.task, pcTaskGetTaskName(watch.task), sizeof(snapshot.task) - 1);
+    strncpy(snapshot.path, paths[watch.path].name, sizeof(snapshot.path) - 1);
+    snapshot.budgetMs = budgetsMs[paths[watch.path].category];
+    snapshot.elapsedMs = elapsedMs;
+    snapshot.finished = finished;
+    snapshot.freeHeap = ESP.getFreeHeap();
+    snapshot.minFreeHeap = ESP.getMinFreeHeap();
+    snapshot.largestFreeBlock = ESP.getMaxAllocHeap();
+    snapshot.stackUnused = uxTaskGetStackHighWaterMark(watch.task);
+    // a finished task has moved on, its stack no longer shows the stall
+    if (!finished) {
+        snapshot.backtraceLength = scanStack(watch.task, snapshot.backtrace);
+    }
+
+    portENTER_CRITICAL(&logLock);
+    validateLog();
+    auto index = (int8_t) stallLog.next;
+    snapshot.id = stallLog.nextId++;
+    stallLog.snapshots[index] = snapshot;
+    stallLog.next = (stallLog.next + 1) % STALL_SNAPSHOTS;
+    stallLog.checksum = logChecksum();
+    portEXIT_CRITICAL(&logLock);
+
+    id = snapshot.id;
+    return index;
+}
+
+void StallMonitor::setBudget(StallCategory category, uint32_t budgetMs) {
+    budgetsMs[category] = budgetMs;
+
+    Preferences preferences;
+    preferences.begin("monitor", false);
+    preferences.putUInt(categoryNames[category], budgetMs);
+    preferences.end();
+}
+
+void StallMonitor::setRebootAfter(uint32_t seconds) {
+    rebootAfterS = seconds;
+
+    Preferences preferences;
+    preferences.begin("monitor", false);
+    preferences.putUInt("reboot", seconds);
+    preferences.end();
+}
+
+void StallMonitor::printStats() {
+    Serial.printf("\tBudgets: http %ums, output %ums, persist %ums, restart after %us stalled\n",
+                  budgetsMs[STALL_HTTP], budgetsMs[STALL_OUTPUT], budgetsMs[STALL_PERSIST], rebootAfterS);
+
+    for (uint8_t i = 0; i < pathCount; i++) {
+        portENTER_CRITICAL(&lock);
+        Path path = paths[i];
+        portEXIT_CRITICAL(&lock);
+
+        Serial.printf("\t%s: %u calls, %u over budget, max %u.%03ums\n", path.name, path.calls, path.violations,
+                      path.maxUs / 1000, path.maxUs % 1000);
+    }
+
+    // oldest first
+    StallLog log = copyLog();
+    for (uint8_t i = 0; i < STALL_SNAPSHOTS; i++) {
+        const StallSnapshot &snapshot = log.snapshots[(log.next + i) % STALL_SNAPSHOTS];
+        if (snapshot.id == 0) {
+            continue;
+        }
+        Serial.printf("\n\tStall %u at %ums: %s in %s, %ums (budget %ums), %s\n", snapshot.id, snapshot.uptimeMs,
+                      snapshot.task, snapshot.path, snapshot.elapsedMs, snapshot.budgetMs,
+                      snapshot.rebooted ? "restarted" : (snapshot.finished ? "finished" : "still running"));
+        Serial.printf("\t\theap %u free, %u minimum, %u largest block, %u bytes of stack unused\n", snapshot.freeHeap,
+                      snapshot.minFreeHeap, snapshot.largestFreeBlock, snapshot.stackUnused);
+        if (snapshot.backtraceLength > 0) {
+            Serial.print("\t\tbacktrace");
+            for (uint8_t j = 0; j < snapshot.backtraceLength; j++) {
+                Serial.printf(" 0x%08x", snapshot.backtrace[j]);
+            }
+            Serial.println();
+        }
+    }
+}
+
+void StallMonitor::toJson(JsonObject &doc) {
+    JsonObject budgets = doc.createNestedObject("budgets");
+    for (uint8_t i = 0; i < STALL_CATEGORIES; i++) {
+        budgets[categoryNames[i]] = budgetsMs[i];
+    }
+    doc["rebootAfterS"] = rebootAfterS;
+
+    JsonArray pathArray = doc.createNestedArray("paths");
+    for (uint8_t i = 0; i < pathCount; i++) {
+        portENTER_CRITICAL(&lock);
+        Path path = paths[i];
+        portEXIT_CRITICAL(&lock);
+
+        JsonObject item = pathArray.createNestedObject();
+        item["name"] = path.name;
+        item["calls"] = path.calls;
+        item["violations"] = path.violations;
+        item["maxUs"] = path.maxUs;
+    }
+
+    StallLog log = copyLog();
+    JsonArray snapshots = doc.createNestedArray("snapshots");
+    for (uint8_t i = 0; i < STALL_SNAPSHOTS; i++) {
+        StallSnapshot &snapshot = log.snapshots[(log.next + i) % STALL_SNAPSHOTS];
+        if (snapshot.id == 0) {
+            continue;
+        }
+        JsonObject item = snapshots.createNestedObject();
+        item["id"] = snapshot.id;
+        item["uptimeMs"] = snapshot.uptimeMs;
+        item["task"] = snapshot.task;
+        item["path"] = snapshot.path;
+        item["budgetMs"] = snapshot.budgetMs;
+        item["elapsedMs"] = snapshot.elapsedMs;
+        item["finished"] = snapshot.finished;
+        item["rebooted"] = snapshot.rebooted;
+        item["freeHeap"] = snapshot.freeHeap;
+        item["minFreeHeap"] = snapshot.minFreeHeap;
+        item["largestFreeBlock"] = snapshot.largestFreeBlock;
+        item["stackUnused"] = snapshot.stackUnused;
+
+        JsonArray backtrace = item.createNestedArray("backtrace");
+        for (uint8_t j = 0; j < snapshot.backtraceLength; j++) {
+            char address[11];
+            snprintf(address, sizeof(address), "0x%08x", snapshot.backtrace[j]);
+            backtrace.add(address);
+        }
+    }
+}
+
+void StallMonitor::clear() {
+    portENTER_CRITICAL(&lock);
+    for (uint8_t i = 0; i < pathCount; i++) {
+        paths[i].calls = 0;
+        paths[i].violations = 0;
+        paths[i].maxUs = 0;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    portENTER_CRITICAL(&logLock);
+    stallLog.magic = 0;
+    validateLog();
+    portEXIT_CRITICAL(&logLock);
+}
@@ -0,0 +1,143 @@
+#ifndef ESP32_LIGHT_STALLMONITOR_H
+#define ESP32_LIGHT_STALLMONITOR_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "ElgatoApi.h"
+
+// the routes of ElgatoApi, the light output and persisting settings
+#define MAX_STALL_PATHS 16
+// paths running at the same time, about one per task
+#define MAX_STALL_WATCHES 6
+// kept in RTC memory, the oldest is replaced
+#define STALL_SNAPSHOTS 4
+#define STALL_BACKTRACE_DEPTH 8
+#define STALL_PATH_NAME_LENGTH 40
+
+#define STALL_MONITOR_PERIOD_MS 10
+// stack words searched for code addresses
+#define STALL_STACK_SCAN_WORDS 256
+#define STALL_JSON_SIZE 6144
+
+// default budgets, change them with the `stalls` command
+#define DEFAULT_HTTP_BUDGET_MS 100
+#define DEFAULT_OUTPUT_BUDGET_MS 5
+#define DEFAULT_PERSIST_BUDGET_MS 200
+// a path stalled this long restarts the device, 0 never does
+#define DEFAULT_STALL_REBOOT_S 30
+
+enum StallCategory : uint8_t {
+    STALL_HTTP,
+    STALL_OUTPUT,
+    STALL_PERSIST,
+    STALL_CATEGORIES
+};
+
+// what was going on when a path went over its budget, survives a soft reboot
+struct StallSnapshot {
+    // counts up across reboots, 0 is an empty entry
+    uint32_t id;
+    uint32_t uptimeMs;
+    char task[16];
+    char path[STALL_PATH_NAME_LENGTH];
+    uint32_t budgetMs;
+    // updated when the path finishes
+    uint32_t elapsedMs;
+    bool finished;
+    // the monitor restarted the device because of this stall
+    bool rebooted;
+    uint32_t freeHeap;
+    uint32_t minFreeHeap;
+    uint32_t largestFreeBlock;
+    uint32_t stackUnused;
+    // code addresses found on the stalled task's stack, innermost first (none when it finished before the monitor saw
+    // it), resolve them with xtensa-esp32-elf-addr2line -e .pio/build/esp32dev/firmware.elf
+    uint32_t backtrace[STALL_BACKTRACE_DEPTH];
+    uint8_t backtraceLength;
+};
+
+/*
+ * Software watchdog for the paths that should never block for long: the HTTP handlers (through the ElgatoApi hooks),
+ * the light output period and persisting settings.  Each path is timed from `enter()` to `exit()`.  A monitor task on
+ * the output core looks at the running paths every STALL_MONITOR_PERIOD_MS, and when one is over its budget it takes a
+ * snapshot: the task, the path, the elapsed time, the heap and the code addresses on the task's stack.  The snapshots
+ * are kept in RTC memory so they survive the restart after a stall of more than `rebootAfterS`.
+ *
+ * Every path counts its calls and how many of them were over budget, print them with the `stalls` command or
+ * `GET /stalls`.
+ */
+class StallMonitor {
+
+public:
+    struct Path {
+        char name[STALL_PATH_NAME_LENGTH];
+        StallCategory category;
+        uint32_t calls;
+        uint32_t violations;
+        uint32_t maxUs;
+    };
+
+private:
+    struct Watch {
+        bool active;
+        // finished, the monitor still has to take or update its snapshot
+        bool pending;
+        // a snapshot was taken while it was running
+        bool reported;
+        uint8_t path;
+        int8_t snapshot;
+        uint32_t snapshotId;
+        TaskHandle_t task;
+        int64_t startUs;
+        uint32_t elapsedUs;
+    };
+
+    Path paths[MAX_STALL_PATHS];
+    uint8_t pathCount = 0;
+    // ElgatoApi::routes are the paths from here on
+    int16_t routeBase = -1;
+    Watch watches[MAX_STALL_WATCHES] = {};
+
+    uint32_t budgetsMs[STALL_CATEGORIES] = {DEFAULT_HTTP_BUDGET_MS, DEFAULT_OUTPUT_BUDGET_MS, DEFAULT_PERSIST_BUDGET_MS};
+    uint32_t rebootAfterS = DEFAULT_STALL_REBOOT_S;
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    TaskHandle_t task = nullptr;
+
+    static void monitorTask(void *pvParameters);
+    void check();
+    int8_t takeSnapshot(const Watch &watch, uint32_t elapsedMs, bool finished, uint32_t &id);
+    void exitCurrent(uint8_t path);
+
+public:
+    // paths have to be added before `begin()`, returns the path to pass to `enter()`
+    uint8_t addPath(const char *name, StallCategory category);
+
+    // watches the handlers of `api`, the routes are shared by all the lights
+    void watchApi(ElgatoApi &api);
+
+    // loads the budgets and starts the monitor task
+    void begin();
+
+    // `GET /stalls`, the paths and snapshots as JSON
+    void addRoutes(AsyncWebServer &server);
+
+    // starts timing `path` on the calling task, returns the watch to pass to `exit()` (-1 when there is none free)
+    int8_t enter(uint8_t path);
+    void exit(int8_t watch);
+
+    // changes and saves a budget, 0 for `rebootAfter` never restarts
+    void setBudget(StallCategory category, uint32_t budgetMs);
+    void setRebootAfter(uint32_t seconds);
+
+    TaskHandle_t getTask() const {
+        return task;
+    }
+
+    void printStats();
+    void toJson(JsonObject &doc);
+    // clears the counters and the snapshots
+    void clear();
+};
+
+#endif //ESP32_LIGHT_STALLMONITOR_H
@@ -0,0 +1,211 @@
+#include "StateJournal.h"
+#include <string.h>
+
+#define JOURNAL_ERASED 0xFFFFFFFFu
+#define JOURNAL_SLOTS_PER_SECTOR (FLASH_SECTOR_SIZE / JOURNAL_RECORD_SIZE)
+
+uint32_t journalCrc32(const void *data, size_t length) {
+    // a nibble at a time, the 16 entry table is small enough for the stack of any task
+    static const uint32_t table[16] = {
+            0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+            0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    const uint8_t *bytes = (const uint8_t *) data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (bytes[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+static bool isValid(const JournalRecord &record) {
+    return record.sequence != JOURNAL_ERASED && record.sequence != 0
+           && record.crc == journalCrc32(&record, offsetof(JournalRecord, crc));
+}
+
+bool StateJournal::begin(FlashBackend &backend) {
+    flash = &backend;
+    sectorCount = flash->size() / FLASH_SECTOR_SIZE;
+    slotCount = sectorCount * JOURNAL_SLOTS_PER_SECTOR;
+    latest = {};
+    stats = {};
+
+    ready = sectorCount >= JOURNAL_MIN_SECTORS;
+    if (ready) {
+        recover();
+    }
+    return ready;
+}
+
+bool StateJournal::readRecord(uint32_t slot, JournalRecord &record) {
+    stats.recoveryReads++;
+    return flash->read((size_t) slot * JOURNAL_RECORD_SIZE, &record, sizeof(record));
+}
+
+uint32_t StateJournal::readSequence(uint32_t slot) {
+    uint32_t sequence;
+    stats.recoveryReads++;
+    return flash->read((size_t) slot * JOURNAL_RECORD_SIZE, &sequence, sizeof(sequence)) ? sequence : JOURNAL_ERASED;
+}
+
+uint32_t StateJournal::readFirstSequence(uint32_t sector) {
+    // the whole record, a sector whose erase or first write was torn must not look newer than it is
+    JournalRecord record;
+    return readRecord(sector * JOURNAL_SLOTS_PER_SECTOR, record) && isValid(record) ? record.sequence : JOURNAL_ERASED;
+}
+
+bool StateJournal::isClean(uint32_t slot) {
+    uint8_t bytes[JOURNAL_RECORD_SIZE];
+    stats.recoveryReads++;
+    if (!flash->read((size_t) slot * JOURNAL_RECORD_SIZE, bytes, sizeof(bytes))) {
+        return false;
+    }
+    for (uint8_t byte : bytes) {
+        if (byte != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StateJournal::erase(uint32_t sector) {
+    stats.erases++;
+    if (!flash->eraseSector((size_t) sector * FLASH_SECTOR_SIZE)) {
+        stats.failures++;
+        return false;
+    }
+    return true;
+}
+
+void StateJournal::recover() {
+    // sectors are written in order around the ring, so the ones from the oldest up to the newest start with increasing
+    // sequence numbers and the ones after the newest are from the previous lap (lower) or erased
+    uint32_t base = 0;
+    uint32_t first = readFirstSequence(0);
+    if (first == JOURNAL_ERASED) {
+        // sector 0 was erased ahead of the wrap around (or this is a new partition), the oldest records are in sector 1
+        base = 1;
+        first = readFirstSequence(1);
+    }
+
+    if (first == JOURNAL_ERASED) {
+        // nothing was ever written (or kept), sector 0 is erased before the first commit
+        head = 0;
+        headErased = false;
+        nextErased = false;
+        return;
+    }
+
+    uint32_t low = base;
+    uint32_t high = sectorCount - 1;
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        uint32_t sequence = readFirstSequence(middle);
+        if (sequence != JOURNAL_ERASED && sequence >= first) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    uint32_t sector = low;
+
+    // the slots of a sector are written in order, find the last one that is not erased
+    uint32_t start = sector * JOURNAL_SLOTS_PER_SECTOR;
+    low = 0;
+    high = JOURNAL_SLOTS_PER_SECTOR - 1;
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        if (readSequence(start + middle) != JOURNAL_ERASED) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    uint32_t newest = start + low;
+
+    // the newest record can be torn by a power loss, fall back to the ones before it
+    JournalRecord record;
+    for (uint32_t step = 0; step < JOURNAL_MAX_RECOVERY_STEPS; step++) {
+        uint32_t slot = (newest + slotCount - step) % slotCount;
+        if (readRecord(slot, record) && isValid(record)) {
+            latest = record;
+            break;
+        }
+        stats.recoverySkipped++;
+    }
+    if (latest.sequence == 0 && readRecord(start, record)) {
+        // the first record of the sector passed its check in the search, sequence numbers have to keep counting up
+        latest = record;
+    }
+
+    head = (newest + 1) % slotCount;
+    headErased = false;
+    if (!isFirstSlot(head) && !isClean(head)) {
+        // a torn write left the slot after the newest record partially programmed, continue in the next sector
+        head = (sectorOf(head) + 1) % sectorCount * JOURNAL_SLOTS_PER_SECTOR;
+    }
+    // not known after a restart, prepare() erases it again
+    nextErased = false;
+}
+
+const JournalLight *StateJournal::getLight(uint8_t index) const {
+    if (index >= JOURNAL_LIGHTS || (latest.lights[index].flags & JOURNAL_LIGHT_VALID) == 0) {
+        return nullptr;
+    }
+    return &latest.lights[index];
+}
+
+void StateJournal::setLight(uint8_t index, const JournalLight &light) {
+    if (index >= JOURNAL_LIGHTS) {
+        return;
+    }
+    latest.lights[index] = light;
+    latest.lights[index].flags |= JOURNAL_LIGHT_VALID;
+}
+
+bool StateJournal::commit() {
+    if (!ready) {
+        return false;
+    }
+
+    if (isFirstSlot(head) && !headErased) {
+        stats.inlineErases++;
+        if (!erase(sectorOf(head))) {
+            return false;
+        }
+    }
+
+    latest.sequence++;
+    latest.crc = journalCrc32(&latest, offsetof(JournalRecord, crc));
+
+    bool written = flash->write((size_t) head * JOURNAL_RECORD_SIZE, &latest, sizeof(latest));
+    stats.commits++;
+    if (!written) {
+        stats.failures++;
+    }
+
+    // the slot is used even if the write failed, recovery skips it
+    head = (head + 1) % slotCount;
+    if (isFirstSlot(head)) {
+        headErased = nextErased;
+        nextErased = false;
+    }
+    return written;
+}
+
+bool StateJournal::prepare() {
+    if (!ready) {
+        return false;
+    }
+    if (isFirstSlot(head) && !headErased) {
+        headErased = erase(sectorOf(head));
+        return true;
+    }
+    // not before the sector of `head` has a record, two erased sectors in a row would hide the oldest ones from recover()
+    if (!nextErased && !isFirstSlot(head)) {
+        nextErased = erase((sectorOf(head) + 1) % sectorCount);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,128 @@
+#ifndef ESP32_LIGHT_STATEJOURNAL_H
+#define ESP32_LIGHT_STATEJOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "FlashBackend.h"
+
+// lights in a record, MAX_LIGHT_INSTANCES on the device
+#define JOURNAL_LIGHTS 4
+#define JOURNAL_RECORD_SIZE 64
+// a sector is erased ahead of the one being written, the oldest records are kept in at least one more
+#define JOURNAL_MIN_SECTORS 3
+// records looked at, newest first, past torn or corrupt ones before the journal is considered empty
+#define JOURNAL_MAX_RECOVERY_STEPS 8
+// typical NOR flash endurance (erase cycles per sector)
+#define FLASH_ENDURANCE_CYCLES 100000
+
+// JournalLight::flags
+#define JOURNAL_LIGHT_VALID 0x01
+
+struct JournalLight {
+    uint8_t on;
+    uint8_t brightness;
+    uint8_t temperature;
+    uint8_t flags;
+    // usage counters
+    uint32_t onSeconds;
+    uint32_t switchCycles;
+};
+
+// the state of every light, each record replaces the previous one
+struct JournalRecord {
+    // counts up from 1 over the lifetime of the partition, 0xFFFFFFFF is an erased slot
+    uint32_t sequence;
+    uint8_t reserved[4];
+    JournalLight lights[JOURNAL_LIGHTS];
+    uint8_t padding[4];
+    // CRC-32 of everything before it
+    uint32_t crc;
+};
+
+static_assert(sizeof(JournalRecord) == JOURNAL_RECORD_SIZE, "a record has to fit the slots of a sector exactly");
+
+struct JournalStats {
+    uint32_t commits;
+    uint32_t erases;
+    // erases done by commit() because prepare() had not run yet
+    uint32_t inlineErases;
+    uint32_t failures;
+    // flash reads of the last recovery
+    uint32_t recoveryReads;
+    // torn or corrupt records skipped by the last recovery
+    uint32_t recoverySkipped;
+};
+
+/*
+ * Append only journal of the light state (on, brightness, temperature) and usage counters, for the writes that are too
+ * frequent for NVS.  Fixed size records with a sequence number and CRC are written one after the other into a raw
+ * flash partition, which is used as a ring of sectors: every sector is erased once per lap, so the wear is spread
+ * evenly and nothing is ever rewritten in place.
+ *
+ * On boot the newest record is found with two binary searches, over the first record of each sector and then over the
+ * slots of the newest sector, so recovery reads O(log sectors + log records per sector) records instead of the whole
+ * partition.  A record torn by a power loss fails its CRC and the one before it is used.
+ *
+ * Erasing takes tens of milliseconds, call `prepare()` when idle so the next sector is erased before `commit()` needs
+ * it.  Not thread safe, all calls have to come from the same task (housekeeping on the device).
+ */
+class StateJournal {
+
+private:
+    FlashBackend *flash = nullptr;
+    uint32_t sectorCount = 0;
+    uint32_t slotCount = 0;
+    bool ready = false;
+
+    // slot of the next commit
+    uint32_t head = 0;
+    // the sector of `head` is erased, only meaningful when `head` is the first slot of a sector
+    bool headErased = false;
+    // the sector after the one of `head` is erased
+    bool nextErased = false;
+
+    // the newest record, the lights are updated in place until `commit()`
+    JournalRecord latest = {};
+    JournalStats stats = {};
+
+    bool readRecord(uint32_t slot, JournalRecord &record);
+    // the sequence number of a slot, 0xFFFFFFFF when it is erased
+    uint32_t readSequence(uint32_t slot);
+    // the sequence number of the first record of a sector, 0xFFFFFFFF when it is erased or corrupt
+    uint32_t readFirstSequence(uint32_t sector);
+    bool isClean(uint32_t slot);
+    bool erase(uint32_t sector);
+    void recover();
+
+    uint32_t sectorOf(uint32_t slot) const { return slot / (FLASH_SECTOR_SIZE / JOURNAL_RECORD_SIZE); }
+    bool isFirstSlot(uint32_t slot) const { return slot % (FLASH_SECTOR_SIZE / JOURNAL_RECORD_SIZE) == 0; }
+
+public:
+    // finds the newest record, returns false when `flash` is too small for a journal
+    bool begin(FlashBackend &flash);
+    bool isReady() const { return ready; }
+
+    // the journaled state of a light, nullptr when it never was
+    const JournalLight *getLight(uint8_t index) const;
+    // changes a light in the next record, the other lights keep their state
+    void setLight(uint8_t index, const JournalLight &light);
+
+    // appends a record with the state of all lights
+    bool commit();
+
+    // erases the sector the next commits go to ahead of time, returns whether it did
+    bool prepare();
+
+    // records ever written, the sequence number of the newest one
+    uint32_t getSequence() const { return latest.sequence; }
+    uint32_t getSectorCount() const { return sectorCount; }
+    uint32_t getSlotCount() const { return slotCount; }
+    // erase cycles each sector has been through (every sector is erased once per lap)
+    uint32_t getEraseCycles() const { return slotCount > 0 ? latest.sequence / slotCount : 0; }
+    const JournalStats &getStats() const { return stats; }
+};
+
+// CRC-32 (IEEE 802.3), as in zlib
+uint32_t journalCrc32(const void *data, size_t length);
+
+#endif //ESP32_LIGHT_STATEJOURNAL_H
@@ -0,0 +1,45 @@
+#ifndef ESP32_LIGHT_TASKS_H
+#define ESP32_LIGHT_TASKS_H
+
+/*
+ * Task layout, stack sizes are in bytes.  Use the `tasks` command to print the stack high water marks and the output
+ * timing, and adjust the stack sizes from those numbers.  The peaks noted next to the sizes are worked out from the
+ * deepest call chain of each task (frame sizes from -fstack-usage for the code shared with the host, the local buffers
+ * of the libraries for the rest), they still have to be replaced with `tasks` numbers from a device that went through
+ * an OTA update, MQTT commands and a settings save.  Until then the sizes are about twice the estimated peaks, after
+ * that leave about 1KB above the measured peak.
+ *
+ * core 0 - network: WiFi/lwIP, AsyncTCP (priority 3, see CONFIG_ASYNC_TCP_RUNNING_CORE in platformio.ini), AsyncUDP
+ *          (Art-Net/sACN frames, see DmxReceiver, and mDNS queries, see MdnsDiscovery)
+ *        - housekeeping: CLI, ArduinoOTA, persisting settings (and erasing the journal ahead), MQTT and mDNS
+ *          announcements, at the lowest priority
+ * core 1 - light output and transitions, and taking the streamed DMX frames
+ *        - stall monitor, below the output so it can watch the tasks on core 0 (the Arduino loop task is deleted)
+ *
+ * The state of a light is changed by AsyncTCP, housekeeping and the output task, see LightInstance::lockState().
+ */
+
+#define NETWORK_CORE 0
+
+#define OUTPUT_CORE 1
+#define OUTPUT_TASK_PRIORITY 5
+// peak about 1.1KB: stepping the transitions, applyStream() with the DMX updates of a frame and ledcWrite()
+#define OUTPUT_TASK_STACK_SIZE 2048
+// the output is updated at a fixed rate, transitions are stepped once per period
+#define OUTPUT_PERIOD_MS 10
+
+// looks for stalled handlers, see StallMonitor
+#define STALL_MONITOR_CORE 1
+#define STALL_MONITOR_TASK_PRIORITY 4
+// peak about 1.5KB: a snapshot (backtrace and heap figures) and the Serial.printf() before restarting
+#define STALL_MONITOR_TASK_STACK_SIZE 3072
+
+#define HOUSEKEEPING_CORE 0
+#define HOUSEKEEPING_TASK_PRIORITY 1
+// peak about 4KB: ArduinoOTA receiving a 1460 byte chunk on the stack while writing the flash, next an MQTT command
+// (a 256 byte JsonDocument, applying it and printing the light) at about 3KB, mDNS announcements use the responder's
+// buffer
+#define HOUSEKEEPING_TASK_STACK_SIZE 8192
+#define HOUSEKEEPING_PERIOD_MS 5
+
+#endif //ESP32_LIGHT_TASKS_H
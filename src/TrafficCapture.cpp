@@ -0,0 +1,154 @@
+#include "TrafficCapture.h"
+#include "ElgatoApi.h"
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void writeUInt16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static void writeUInt32(uint8_t *out, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint16_t readUInt16(const uint8_t *in) {
+    return in[0] | (in[1] << 8);
+}
+
+static uint32_t readUInt32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+TrafficCapture::~TrafficCapture() {
+    free(buffer);
+}
+
+bool TrafficCapture::start(ElgatoApi &api, size_t size) {
+    active = false;
+    free(buffer);
+
+    size = size < CAPTURE_MIN_SIZE ? CAPTURE_MIN_SIZE : (size > CAPTURE_MAX_SIZE ? CAPTURE_MAX_SIZE : size);
+    buffer = (uint8_t *) malloc(size);
+    capacity = buffer != nullptr ? size : 0;
+    length = 0;
+    requests = 0;
+    dropped = 0;
+    if (buffer == nullptr) {
+        return false;
+    }
+
+    memcpy(buffer, CAPTURE_MAGIC, 4);
+    buffer[4] = CAPTURE_VERSION;
+    length = CAPTURE_HEADER_SIZE;
+
+    appendState(api, CAPTURE_STATE_INITIAL);
+    startUs = micros();
+    active = true;
+    return true;
+}
+
+void TrafficCapture::stop(ElgatoApi &api) {
+    if (!active) {
+        return;
+    }
+    active = false;
+    appendState(api, CAPTURE_STATE_FINAL);
+}
+
+void TrafficCapture::record(uint8_t route, int status, uint32_t latencyUs, JsonVariantConst body) {
+    if (!active) {
+        return;
+    }
+
+    uint8_t fields[CAPTURE_REQUEST_FIELDS_SIZE];
+    writeUInt32(fields, micros() - startUs - latencyUs);
+    fields[4] = route;
+    writeUInt16(fields + 5, status);
+    writeUInt32(fields + 7, latencyUs);
+
+    if (append(CAPTURE_REQUEST, fields, sizeof(fields), body, CAPTURE_STATE_RESERVE)) {
+        requests++;
+    } else {
+        dropped++;
+    }
+}
+
+bool TrafficCapture::append(uint8_t type, const uint8_t *fields, size_t fieldsLength, JsonVariantConst msgPack,
+                            size_t reserve) {
+    size_t bodyLength = msgPack.isNull() ? 0 : measureMsgPack(msgPack);
+    size_t payloadLength = fieldsLength + bodyLength;
+
+    if (payloadLength > UINT16_MAX || length + 3 + payloadLength + reserve > capacity) {
+        return false;
+    }
+
+    uint8_t *out = buffer + length;
+    out[0] = type;
+    writeUInt16(out + 1, payloadLength);
+    if (fieldsLength > 0) {
+        memcpy(out + 3, fields, fieldsLength);
+    }
+    if (bodyLength > 0) {
+        serializeMsgPack(msgPack, out + 3 + fieldsLength, bodyLength);
+    }
+
+    length += 3 + payloadLength;
+    return true;
+}
+
+void TrafficCapture::appendState(ElgatoApi &api, uint8_t type) {
+    StaticJsonDocument<1024> doc;
+    JsonObject state = doc.to<JsonObject>();
+    stateToJson(api, state);
+
+    // requests leave CAPTURE_STATE_RESERVE bytes free, so the final state fits unless the display name is very long
+    append(type, nullptr, 0, state, 0);
+}
+
+void TrafficCapture::stateToJson(ElgatoApi &api, JsonObject &doc) {
+    api.lights.toJson(doc);
+    doc.remove("numberOfLights");
+
+    JsonObject settings = doc.createNestedObject("settings");
+    api.settings.toJson(settings);
+
+    JsonObject info = doc.createNestedObject("accessory-info");
+    api.info.toJson(info);
+}
+
+bool TrafficCapture::isCapture(const uint8_t *data, size_t length) {
+    return length >= CAPTURE_HEADER_SIZE && memcmp(data, CAPTURE_MAGIC, 4) == 0 && data[4] == CAPTURE_VERSION;
+}
+
+size_t TrafficCapture::readRecord(const uint8_t *data, size_t length, CaptureRecord &record) {
+    if (length < 3) {
+        return 0;
+    }
+
+    size_t payloadLength = readUInt16(data + 1);
+    if (length < 3 + payloadLength) {
+        return 0;
+    }
+
+    record = CaptureRecord();
+    record.type = data[0];
+    record.body = data + 3;
+    record.bodyLength = payloadLength;
+
+    if (record.type == CAPTURE_REQUEST) {
+        if (payloadLength < CAPTURE_REQUEST_FIELDS_SIZE) {
+            return 0;
+        }
+        record.offsetUs = readUInt32(data + 3);
+        record.route = data[7];
+        record.status = readUInt16(data + 8);
+        record.latencyUs = readUInt32(data + 10);
+        record.body = data + 3 + CAPTURE_REQUEST_FIELDS_SIZE;
+        record.bodyLength = payloadLength - CAPTURE_REQUEST_FIELDS_SIZE;
+    }
+    return 3 + payloadLength;
+}
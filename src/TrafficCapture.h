@@ -0,0 +1,91 @@
+#ifndef ESP32_LIGHT_TRAFFICCAPTURE_H
+#define ESP32_LIGHT_TRAFFICCAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+#define CAPTURE_MAGIC "ELGC"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 5
+#define CAPTURE_DEFAULT_SIZE 16384
+#define CAPTURE_MAX_SIZE 65536
+// kept free while recording requests, so the final state still fits
+#define CAPTURE_STATE_RESERVE 384
+#define CAPTURE_MIN_SIZE 1024
+// the request fields that come before the body of a CAPTURE_REQUEST record
+#define CAPTURE_REQUEST_FIELDS_SIZE 11
+// no matching entry in ElgatoApi::routes
+#define CAPTURE_NO_ROUTE 0xFF
+
+class ElgatoApi;
+
+enum CaptureRecordType {
+    // the accessory info, lights and settings when the capture started / stopped, as a `PUT /elgato/batch` body
+    CAPTURE_STATE_INITIAL = 1,
+    CAPTURE_STATE_FINAL = 2,
+    CAPTURE_REQUEST = 3
+};
+
+/*
+ * A capture is the file header (CAPTURE_MAGIC, CAPTURE_VERSION) followed by records, all integers little endian:
+ *
+ *   type (1), payload length (2), payload
+ *
+ * The payload of a request record is the time since the capture started in us (4), the index of the route in
+ * `ElgatoApi::routes` (1), the status (2), the time spent in the handler in us (4), and the request body as MessagePack
+ * (empty without a body).  The state records hold MessagePack only.
+ */
+struct CaptureRecord {
+    uint8_t type;
+    uint32_t offsetUs;
+    uint8_t route;
+    uint16_t status;
+    uint32_t latencyUs;
+    const uint8_t *body;
+    size_t bodyLength;
+};
+
+/*
+ * Records the requests handled by an `ElgatoApi`, with their timing and bodies, into a memory buffer that can be
+ * downloaded (`GET /capture`) or written to a file by the host tools, and replayed with `replay`.
+ */
+class TrafficCapture {
+
+private:
+    uint8_t *buffer = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+    bool active = false;
+    unsigned long startUs = 0;
+    uint32_t requests = 0;
+    uint32_t dropped = 0;
+
+    bool append(uint8_t type, const uint8_t *fields, size_t fieldsLength, JsonVariantConst msgPack, size_t reserve);
+    void appendState(ElgatoApi &api, uint8_t type);
+
+public:
+    ~TrafficCapture();
+
+    // starts a new capture of at most `size` bytes, returns false if the buffer could not be allocated
+    bool start(ElgatoApi &api, size_t size);
+    void stop(ElgatoApi &api);
+    void record(uint8_t route, int status, uint32_t latencyUs, JsonVariantConst body);
+
+    bool isActive() const { return active; }
+    const uint8_t *data() const { return buffer; }
+    size_t size() const { return length; }
+    uint32_t requestCount() const { return requests; }
+    // requests that did not fit in the buffer
+    uint32_t droppedCount() const { return dropped; }
+
+    // writes the accessory info, lights and settings as a `PUT /elgato/batch` body
+    static void stateToJson(ElgatoApi &api, JsonObject &doc);
+
+    // true if `data` starts with a capture header of a supported version
+    static bool isCapture(const uint8_t *data, size_t length);
+    // reads the record at `data`, returns its size or 0 at the end or when the record is truncated
+    static size_t readRecord(const uint8_t *data, size_t length, CaptureRecord &record);
+};
+
+#endif //ESP32_LIGHT_TRAFFICCAPTURE_H
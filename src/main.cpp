@@ -2,16 +2,17 @@
 #include <WiFi.h>
 #include <ESPAsyncWebServer.h>
 #include <ArduinoJson.h>
-#include <AsyncJson.h>
-#include "JsonCallbackHandler.h"
-#include "AccessoryInfo.h"
-#include "Settings.h"
-#include "Lights.h"
 #include "FakeLight.h"
 #include <SimpleCLI.h>
 #include <Preferences.h>
-#include <ESPmDNS.h>
 #include "Esp32WebApp.h"
+#include "MqttBridge.h"
+#include "LightInstance.h"
+#include "DmxReceiver.h"
+#include "StallMonitor.h"
+#include "PartitionFlash.h"
+#include "StateJournal.h"
+#include "MdnsDiscovery.h"
 
 #define ONBOARD_LED  2
 #define CONTROL_PIN 23
@@ -21,282 +22,91 @@ const uint16_t freq = 5000;
 const uint8_t ledChannel = 0;
 const uint8_t resolution = 8;
 
-const int port = 9123;
-AsyncWebServer server(port);
-AccessoryInfo info;
-Lights lights;
-Settings settings;
-Esp32WebApp app(server);
-
-
-typedef std::function<void(JsonObject &)> WriteJsonFunction;
-
-void loadSettings() {
-
-    Preferences preferences;
-    preferences.begin("fake-light");
-    uint8_t on = preferences.getUChar("light-0-on", 1);
-    uint8_t temp = preferences.getUChar("light-0-temp", 100); // TODO this doesn't do anything
-    uint8_t brightness = preferences.getUChar("light-0-bright", 100);
-    Serial.flush();
-
-    lights.lights[0].on = on;
-    lights.lights[0].temperature = temp;
-    lights.lights[0].brightness = brightness;
-
-    // TODO this _should_ be separate, but they are coupled for now
-    settings.powerOnBehavior = on;
-    settings.powerOnTemperature = temp;
-    settings.powerOnBrightness = brightness;
-
-    Serial.print("Loaded settings - on: ");
-    Serial.println(on);
-
-    Serial.print("Loaded settings - temp: ");
-    Serial.println(temp);
-
-    Serial.print("Loaded settings - brightness: ");
-    Serial.println(brightness);
-}
-
-void writeSettings() {
-    Preferences preferences;
-    preferences.begin("fake-light", false);
-    preferences.putUChar("light-0-on", lights.lights[0].on);
-    preferences.putUChar("light-0-temp", lights.lights[0].temperature);
-    preferences.putUChar("light-0-bright", lights.lights[0].brightness);
-    preferences.end();
-}
-
-void changeLight(bool on, uint8_t &brightness) {
-
-    // board LED on
-    digitalWrite(ONBOARD_LED, on ? HIGH : LOW);
-    // LED strip PWM
-
-    // brightness is a percentage, convert to 0-255
-    int pwmValue = 255 * brightness / 100;
-
-    Serial.print("Setting light PWM to: ");
-    Serial.println(pwmValue);
-
-    ledcWrite(ledChannel, pwmValue);
-}
-
-void lightOn() {
-    changeLight(true, lights.lights[0].brightness);
-}
-
-void lightOff() {
-    uint8_t off = 0;
-    changeLight(false, off);
-}
-
-void lightsChanges(Light &light) {
-
-    Serial.print("PowerOn: ");
-    Serial.println(light.on);
-
-    Serial.print("Temperature: ");
-    Serial.println(light.temperature);
-
-    Serial.print("Brightness: ");
-    Serial.println(light.brightness);
-
-    if (light.on == 1) {
-        changeLight(true, light.brightness);
-    } else {
-        lightOff();
+// LED strip pins of the emulated lights, light n uses LEDC channel ledChannel + n
+const uint8_t controlPins[MAX_LIGHT_INSTANCES] = {CONTROL_PIN, 22, 21, 19};
+
+// the first light is always there, it shares its HTTP server with the firmware update and is bridged to MQTT
+LightInstance primary(0, CONTROL_PIN, ledChannel, ONBOARD_LED);
+LightInstance *instances[MAX_LIGHT_INSTANCES] = {&primary};
+uint8_t instanceCount = 1;
+
+Esp32WebApp app(primary.server);
+MqttBridge mqtt(primary.lights, primary.settings, primary.getStateLock());
+DmxReceiver dmx;
+StallMonitor monitor;
+PartitionFlash journalFlash;
+StateJournal journal;
+unsigned long journalRecoveryUs = 0;
+MdnsDiscovery discovery;
+
+// the light selected with the `-light` argument of a command, nullptr (and an error printed) if there is no such light
+LightInstance *selectedInstance(Command &cmd) {
+    int index = cmd.getArg("light").getValue().toInt();
+    if (index < 0 || index >= instanceCount) {
+        Serial.printf("No light %d, there are %u lights\n", index, instanceCount);
+        return nullptr;
     }
-
-    // update settings with current info
-    settings.powerOnBehavior = light.on;
-    settings.powerOnTemperature = light.temperature;
-    settings.powerOnBrightness = light.brightness;
-
-    // persist the changes
-    writeSettings();
-}
-
-void initLEDs() {
-    pinMode(ONBOARD_LED, OUTPUT);
-
-    // configure PWM on CONTROL_PIN
-    ledcSetup(ledChannel, freq, resolution);
-
-    // attach the channel to the GPIO to be controlled
-    ledcAttachPin(CONTROL_PIN, ledChannel);
-
-    // set the initial state of LEDs
-    lightsChanges(lights.lights[0]);
-}
-
-void sendJson(AsyncWebServerRequest *request, WriteJsonFunction jsonFunction) {
-    auto * response = new AsyncJsonResponse();
-    JsonObject jsonObject = response->getRoot();
-    jsonFunction(jsonObject);
-    response->setLength();
-    request->send(response);
-}
-
-void getAccessoryInfo(AsyncWebServerRequest *request) {
-    sendJson(request, [](JsonObject & jsonObject){
-        info.toJson(jsonObject);
-    });
-}
-
-void putAccessoryInfo(AsyncWebServerRequest *request, JsonVariant &json) {
-
-    JsonObject jsonObj = json.as<JsonObject>();
-    info.fromJson(jsonObj);
-
-    Preferences preferences;
-    preferences.begin("fake-light", false);
-    preferences.putString("displayName", info.displayName);
-    preferences.end();
-    getAccessoryInfo(request);
-}
-
-void getSettings(AsyncWebServerRequest *request) {
-    sendJson(request, [](JsonObject & jsonObject){
-        settings.toJson(jsonObject);
-    });
-}
-
-void putSettings(AsyncWebServerRequest *request, JsonVariant &json) {
-    JsonObject jsonObj = json.as<JsonObject>();
-    settings.fromJson(jsonObj);
-    getSettings(request);
-}
-
-void getLights(AsyncWebServerRequest *request) {
-    sendJson(request, [](JsonObject & jsonObject){
-        lights.toJson(jsonObject);
-    });
-}
-
-void putLights(AsyncWebServerRequest *request, JsonVariant &json) {
-    JsonObject jsonObj = json.as<JsonObject>();
-    lights.fromJson(jsonObj);
-
-    // handle the lights changed
-    lightsChanges(lights.lights[0]);
-
-    // return the GET lights json
-    getLights(request);
-}
-
-void identify(AsyncWebServerRequest * request) {
-    // on off on off
-    lightOn();
-    delay(500);
-
-    lightOff();
-    delay(500);
-
-    lightOn();
-    delay(500);
-
-    lightOff();
-    delay(500);
-
-    request->send(200);
-}
-
-void notFound(AsyncWebServerRequest * request) {
-    request->send(404);
-}
-
-// Define routing
-void restServerRouting() {
-    server.on("/", HTTP_GET, [](AsyncWebServerRequest * request) {
-        request->send(200, "text/html", "Welcome to the REST Web Server");
-    });
-
-    // GET - /elgato/accessory-info
-    server.on("/elgato/accessory-info", HTTP_GET, getAccessoryInfo);
-    // PUT - /elgato/accessory-info
-    auto* accessoryHandler = new JsonCallbackHandler("/elgato/accessory-info", putAccessoryInfo);
-    accessoryHandler->setMethod(HTTP_PUT);
-    server.addHandler(accessoryHandler);
-
-    // GET - elgato/lights/settings
-    server.on("/elgato/lights/settings", HTTP_GET, getSettings);
-    // PUT - elgato/lights/settings
-    auto* settingsHandler = new JsonCallbackHandler("/elgato/lights/settings", putSettings);
-    settingsHandler->setMethod(HTTP_PUT);
-    server.addHandler(settingsHandler);
-
-    // GET - /elgato/lights
-    server.on("/elgato/lights", HTTP_GET, getLights);
-    // PUT - /elgato/lights
-    auto* lightsHandler = new JsonCallbackHandler("/elgato/lights", putLights);
-    lightsHandler->setMethod(HTTP_PUT);
-    server.addHandler(lightsHandler);
-
-    // POST - /elgato/identify
-    server.on("/elgato/identify", HTTP_POST, identify);
-
-    // GET = /elgato/battery-info - force empty 404
-    server.on("/elgato/battery-info", HTTP_GET, notFound);
-}
-
-void setupMDNS(const char* serviceName, const char* deviceId) {
-    // Activate mDNS this is used to be able to connect to the server
-    if (MDNS.begin(WiFi.getHostname())) {
-        Serial.println("MDNS responder started");
-    }
-
-    MDNS.setInstanceName(serviceName);
-    MDNS.addService("elg", "tcp", port);
-    MDNS.addServiceTxt("elg", "tcp", "mf", "Elgato");
-    MDNS.addServiceTxt("elg", "tcp", "dt", "200");
-    MDNS.addServiceTxt("elg", "tcp", "id", deviceId);
-    MDNS.addServiceTxt("elg", "tcp", "md", "Elgato Key Light Air 20LAB9901");
-    MDNS.addServiceTxt("elg", "tcp", "pv", "1.0");
-
-    Serial.print("\tService Name: ");
-    Serial.println(serviceName);
-    Serial.print("\tDevice ID: ");
-    Serial.println(deviceId);
+    return instances[index];
 }
 
 void registerCliCommands() {
 
     Command onCommand = app.addCommand("light-on", [](cmd *c) {
         Command cmd(c);
-        String on = cmd.getArg("on").getValue();
-        lights.lights[0].on = on.toInt();
-        lightsChanges(lights.lights[0]);
+        LightInstance *instance = selectedInstance(cmd);
+        if (instance != nullptr) {
+            String on = cmd.getArg("on").getValue();
+            instance->lockState();
+            instance->lights.lights[0].on = on.toInt();
+            instance->lightsChanges(instance->lights.lights[0]);
+            instance->unlockState();
+        }
     });
     onCommand.setDescription("Enables or disables light");
     onCommand.addPositionalArgument("on", "1");
+    onCommand.addArg("light", "0");
 
     Command tempCommand = app.addCommand("light-temperature", [](cmd * c) {
         Command cmd(c);
-        String temp = cmd.getArg("temp").getValue();
-        lights.lights[0].temperature = temp.toInt();
-        lightsChanges(lights.lights[0]);
+        LightInstance *instance = selectedInstance(cmd);
+        if (instance != nullptr) {
+            String temp = cmd.getArg("temp").getValue();
+            instance->lockState();
+            instance->lights.lights[0].temperature = temp.toInt();
+            instance->lightsChanges(instance->lights.lights[0]);
+            instance->unlockState();
+        }
     });
     tempCommand.setDescription("Not Implemented");
     tempCommand.addPositionalArgument("temp", "1");
+    tempCommand.addArg("light", "0");
 
     Command brightCommand = app.addCommand("light-brightness", [](cmd * c) {
         Command cmd(c);
-        String brightness = cmd.getArg("brightness").getValue();
-        lights.lights[0].brightness = brightness.toInt();
-        lightsChanges(lights.lights[0]);
+        LightInstance *instance = selectedInstance(cmd);
+        if (instance != nullptr) {
+            String brightness = cmd.getArg("brightness").getValue();
+            instance->lockState();
+            instance->lights.lights[0].brightness = brightness.toInt();
+            instance->lightsChanges(instance->lights.lights[0]);
+            instance->unlockState();
+        }
     });
     brightCommand.setDescription("Sets light brightness as a percentage 0-100");
     brightCommand.addPositionalArgument("brightness", "1");
+    brightCommand.addArg("light", "0");
 
     Command mdnsCommand = app.addCommand("mdns", [](cmd * c) {
         Command cmd(c);
+        LightInstance *instance = selectedInstance(cmd);
+        if (instance == nullptr) {
+            return;
+        }
         String serviceName = cmd.getArg("service_name").getValue();
         String deviceId = cmd.getArg("device_id").getValue();
 
         Preferences preferences;
-        preferences.begin("fake-light", false);
+        preferences.begin(instance->getPreferencesName(), false);
         preferences.putString("service_name", serviceName);
         preferences.putString("device_id", deviceId);
         preferences.end();
@@ -306,6 +116,201 @@ void registerCliCommands() {
     mdnsCommand.setDescription("Sets the mDNS service name and device id, and restarts device");
     mdnsCommand.addArg("service_name", DEFAULT_SERVICE_NAME);
     mdnsCommand.addArg("device_id", DEFAULT_DEVICE_ID);
+    mdnsCommand.addArg("light", "0");
+
+    Command mqttCommand = app.addCommand("mqtt", [](cmd * c) {
+        Command cmd(c);
+        String host = cmd.getArg("host").getValue();
+        int mqttPort = cmd.getArg("port").getValue().toInt();
+        String user = cmd.getArg("user").getValue();
+        String pass = cmd.getArg("pass").getValue();
+        String topic = cmd.getArg("topic").getValue();
+
+        Preferences preferences;
+        preferences.begin("mqtt", false);
+        preferences.putString("host", host);
+        preferences.putUShort("port", mqttPort);
+        preferences.putString("user", user);
+        preferences.putString("pass", pass);
+        preferences.putString("topic", topic);
+        preferences.end();
+
+        Serial.println("Updated MQTT settings");
+        ESP.restart();
+    });
+    mqttCommand.setDescription("Sets the MQTT broker (an empty host disables MQTT), and restarts device");
+    mqttCommand.addArg("host", "");
+    mqttCommand.addArg("port", "1883");
+    mqttCommand.addArg("user", "");
+    mqttCommand.addArg("pass", "");
+    mqttCommand.addArg("topic", "elgato");
+
+    Command tasksCommand = app.addCommand("tasks", [](cmd * c) {
+        Command cmd(c);
+
+        Serial.println();
+        Serial.printf("\tHousekeeping: %u bytes of stack unused\n", uxTaskGetStackHighWaterMark(Esp32App::getHousekeepingTask()));
+        if (LightOutput::getTask() != nullptr) {
+            Serial.printf("\tLight output: %u bytes of stack unused\n", uxTaskGetStackHighWaterMark(LightOutput::getTask()));
+        }
+        if (monitor.getTask() != nullptr) {
+            Serial.printf("\tStall monitor: %u bytes of stack unused\n", uxTaskGetStackHighWaterMark(monitor.getTask()));
+        }
+        Serial.printf("\tFree heap: %u bytes (minimum %u bytes)\n", ESP.getFreeHeap(), ESP.getMinFreeHeap());
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            instances[i]->output.printStats();
+            if (cmd.getArg("reset").isSet()) {
+                instances[i]->output.resetStats();
+            }
+        }
+    });
+    tasksCommand.setDescription("Prints task stack high water marks and light output timing");
+    tasksCommand.addFlagArgument("reset");
+
+    Command keepAliveCommand = app.addCommand("keep-alive", [](cmd * c) {
+        Command cmd(c);
+        bool advertise = cmd.getArg("advertise").getValue().toInt() == 1;
+
+        Preferences preferences;
+        preferences.begin("fake-light", false);
+        preferences.putBool("keep_alive", advertise);
+        preferences.end();
+
+        ESP.restart();
+    });
+    keepAliveCommand.setDescription("Advertises the keep-alive port (1) or the default port (0) via mDNS, and restarts device");
+    keepAliveCommand.addPositionalArgument("advertise", "1");
+
+    Command httpStatsCommand = app.addCommand("http-stats", [](cmd * c) {
+        Command cmd(c);
+
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            Serial.printf("\nLight %u\n", i);
+            instances[i]->keepAliveServer.printStats();
+            if (cmd.getArg("reset").isSet()) {
+                instances[i]->keepAliveServer.resetStats();
+            }
+        }
+    });
+    httpStatsCommand.setDescription("Prints connection reuse and latency of the keep-alive server");
+    httpStatsCommand.addFlagArgument("reset");
+
+    Command captureCommand = app.addCommand("capture", [](cmd * /* c */) {
+        Serial.println();
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            TrafficCapture &capture = instances[i]->capture;
+            Serial.printf("\tCapture of light %u: %s, %u requests, %u dropped, %u bytes\n", i,
+                          capture.isActive() ? "recording" : "stopped", capture.requestCount(), capture.droppedCount(),
+                          capture.size());
+        }
+    });
+    captureCommand.setDescription("Prints the state of the traffic capture, see POST /capture/start and GET /capture");
+
+    Command lightsCommand = app.addCommand("lights", [](cmd * c) {
+        Command cmd(c);
+        int count = cmd.getArg("count").getValue().toInt();
+
+        if (count > 0) {
+            Preferences preferences;
+            preferences.begin("fake-light", false);
+            preferences.putUChar("lights", constrain(count, 1, MAX_LIGHT_INSTANCES));
+            preferences.end();
+
+            ESP.restart();
+        }
+
+        Serial.println();
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            instances[i]->printStatus();
+        }
+        Serial.printf("\tFree heap: %u bytes\n", ESP.getFreeHeap());
+    });
+    lightsCommand.setDescription("Prints the emulated lights and their memory use, or sets how many to emulate and restarts device");
+    lightsCommand.addArg("count", "0");
+
+    Command dmxCommand = app.addCommand("dmx", [](cmd * c) {
+        Command cmd(c);
+        LightInstance *instance = selectedInstance(cmd);
+        if (instance == nullptr) {
+            return;
+        }
+
+        if (cmd.getArg("channel").isSet()) {
+            int universe = cmd.getArg("universe").getValue().toInt();
+            int channel = cmd.getArg("channel").getValue().toInt();
+            if (universe < 0 || channel < 0 || !dmx.patch(instance->index, universe, channel)) {
+                Serial.printf("Invalid patch, the channels %d-%d have to be within 1-%u\n", channel,
+                              channel + DMX_LIGHT_CHANNELS - 1, DMX_UNIVERSE_SIZE);
+                return;
+            }
+        }
+
+        Serial.println();
+        dmx.printStats();
+        if (cmd.getArg("reset").isSet()) {
+            dmx.resetStats();
+        }
+    });
+    dmxCommand.setDescription("Patches a light to 3 DMX channels (on, brightness, temperature) of an Art-Net/sACN universe, channel 0 unpatches it, and prints the frame statistics");
+    dmxCommand.addArg("light", "0");
+    dmxCommand.addArg("universe", "1");
+    dmxCommand.addArg("channel", "0");
+    dmxCommand.addFlagArgument("reset");
+
+    Command stallsCommand = app.addCommand("stalls", [](cmd * c) {
+        Command cmd(c);
+
+        const char *budgets[STALL_CATEGORIES] = {"http", "output", "persist"};
+        for (uint8_t i = 0; i < STALL_CATEGORIES; i++) {
+            if (cmd.getArg(budgets[i]).isSet()) {
+                monitor.setBudget((StallCategory) i, max(cmd.getArg(budgets[i]).getValue().toInt(), 1L));
+            }
+        }
+        if (cmd.getArg("reboot").isSet()) {
+            monitor.setRebootAfter(max(cmd.getArg("reboot").getValue().toInt(), 0L));
+        }
+
+        Serial.println();
+        monitor.printStats();
+        if (cmd.getArg("clear").isSet()) {
+            monitor.clear();
+        }
+    });
+    stallsCommand.setDescription("Prints the calls over budget per route and the stall snapshots, or sets the budgets in ms (and the stall that restarts the device in s, 0 never does)");
+    stallsCommand.addArg("http", "100");
+    stallsCommand.addArg("output", "5");
+    stallsCommand.addArg("persist", "200");
+    stallsCommand.addArg("reboot", "30");
+    stallsCommand.addFlagArgument("clear");
+
+    Command journalCommand = app.addCommand("journal", [](cmd * /* c */) {
+        Serial.println();
+        if (!journal.isReady()) {
+            Serial.println("\tNo journal partition, the light state is saved to the preferences");
+            return;
+        }
+        const JournalStats &stats = journal.getStats();
+        Serial.printf("\t%u sectors, %u records, the newest is %u\n", journal.getSectorCount(), journal.getSlotCount(),
+                      journal.getSequence());
+        Serial.printf("\trecovered in %lu us with %u reads, %u torn records skipped\n", journalRecoveryUs,
+                      stats.recoveryReads, stats.recoverySkipped);
+        Serial.printf("\tsince boot: %u commits, %u erases (%u inline), %u failures\n", stats.commits, stats.erases,
+                      stats.inlineErases, stats.failures);
+        Serial.printf("\twear: %u of %u erase cycles per sector\n", journal.getEraseCycles(), FLASH_ENDURANCE_CYCLES);
+    });
+    journalCommand.setDescription("Prints the state journal: records, recovery time and flash wear");
+
+    Command discoveryCommand = app.addCommand("discovery", [](cmd * c) {
+        Command cmd(c);
+
+        Serial.println();
+        discovery.printStats();
+        if (cmd.getArg("reset").isSet()) {
+            discovery.resetStats();
+        }
+    });
+    discoveryCommand.setDescription("Prints the mDNS queries seen, the answers sent and the answers suppressed");
+    discoveryCommand.addFlagArgument("reset");
 }
 
 void setup() {
@@ -314,29 +319,97 @@ void setup() {
 
     Preferences preferences;
     preferences.begin("fake-light", false);
-    String serviceName = preferences.getString("service_name", DEFAULT_SERVICE_NAME);
-    String deviceId = preferences.getString("device_id", DEFAULT_DEVICE_ID);
-    info.displayName = preferences.getString("displayName", DEFAULT_DISPLAY_NAME);
+    bool advertiseKeepAlive = preferences.getBool("keep_alive", false);
+    uint8_t lightCount = constrain(preferences.getUChar("lights", 1), 1, MAX_LIGHT_INSTANCES);
     preferences.end();
     Serial.flush(); // flush is required after getting preferences
 
+    primary.loadIdentity();
+    primary.mqtt = &mqtt;
+    for (uint8_t i = 1; i < lightCount; i++) {
+        instances[i] = new LightInstance(i, controlPins[i], ledChannel + i, NO_INDICATOR_PIN);
+        instances[i]->loadIdentity();
+    }
+    instanceCount = lightCount;
+
+    // time the handlers, the light output and the flash writes, see StallMonitor
+    for (uint8_t i = 0; i < instanceCount; i++) {
+        monitor.watchApi(instances[i]->api);
+    }
+    uint8_t persistPath = monitor.addPath("persist settings", STALL_PERSIST);
+    for (uint8_t i = 0; i < instanceCount; i++) {
+        instances[i]->monitor = &monitor;
+        instances[i]->persistPath = persistPath;
+    }
+    LightOutput::setStallMonitor(&monitor, monitor.addPath("light output", STALL_OUTPUT));
+    monitor.begin();
+
+    // the light state goes to the journal partition, a board flashed with another partition table keeps using NVS
+    unsigned long recoveryStart = micros();
+    if (journalFlash.begin(JOURNAL_PARTITION_NAME, JOURNAL_PARTITION_SUBTYPE) && journal.begin(journalFlash)) {
+        journalRecoveryUs = micros() - recoveryStart;
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            instances[i]->journal = &journal;
+        }
+        Serial.printf("Journal recovered record %u in %lu us\n", journal.getSequence(), journalRecoveryUs);
+    } else {
+        Serial.println("No journal partition, the light state is saved to the preferences");
+    }
+
     registerCliCommands();
+
+    // housekeeping runs on the network core at the lowest priority, see Tasks.h
+    app.addHousekeeping([]() {
+        bool streaming = false;
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            instances[i]->persistSettings();
+            streaming |= instances[i]->isStreaming();
+        }
+        // erase the journal's next sector ahead of the writes, not while an erase would stall a stream's output
+        if (!streaming) {
+            journal.prepare();
+        }
+    });
+    app.addHousekeeping([]() {
+        mqtt.loop();
+    });
+    app.addHousekeeping([]() {
+        discovery.loop();
+    });
     app.begin();
 
     if (WiFi.status() == WL_CONNECTED) {
 
-        // get the initial configuration
-        loadSettings();
+        // the stall snapshots, next to `/update` on the first light
+        monitor.addRoutes(primary.server);
+
+        // restore the light outputs and set up the http servers
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            instances[i]->begin(freq, resolution);
+        }
+
+        // Art-Net/sACN input for the lights patched with the `dmx` command
+        dmx.begin(instances, instanceCount);
 
-        // enable LEDs
-        initLEDs();
+        // after everything is configured broadcast, one responder for all the lights
+        if (discovery.begin(WiFi.getHostname())) {
+            Serial.println("MDNS responder started");
+        }
+        for (uint8_t i = 0; i < instanceCount; i++) {
+            instances[i]->advertise(discovery, advertiseKeepAlive);
+        }
 
-        // setup http server
-        restServerRouting();
+        // HTTP is up and the light output restored, accept a newly updated firmware
+        app.markHealthy();
 
-        // after everything is configured broadcast
-        setupMDNS(serviceName.c_str(), deviceId.c_str());
+        // optional MQTT bridge, commands follow the same path as `PUT /elgato/lights`
+        mqtt.begin(primary.getDeviceId().c_str(), primary.info.displayName.c_str(), [](JsonObject &jsonObj) {
+            primary.applyLights(jsonObj);
+        });
     }
 }
 
-void loop() {}
\ No newline at end of file
+void loop() {
+    // everything runs in the tasks described in Tasks.h, the Arduino loop task is not needed
+    vTaskDelete(nullptr);
+}
\ No newline at end of file
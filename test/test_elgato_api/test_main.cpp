@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include "ElgatoApi.h"
+#include "HttpProtocol.h"
+
+// run with `pio test -e native`
+
+static AccessoryInfo info;
+static Lights lights;
+static Settings settings;
+static ElgatoApi api(info, lights, settings);
+
+static StaticJsonDocument<1024> requestDoc;
+static StaticJsonDocument<1024> responseDoc;
+
+void setUp() {
+    info = AccessoryInfo();
+    lights = Lights();
+    settings = Settings();
+    settings.colorChangeDurationMs = 150;
+    settings.powerOnBehavior = 0;
+    settings.powerOnTemperature = 200;
+    settings.switchOffDurationMs = 400;
+    settings.switchOnDurationMs = 250;
+}
+
+void tearDown() {}
+
+static int send(const char *method, const char *uri, const char *body) {
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s %s HTTP/1.1\r\nContent-Length: %u\r\n\r\n%s", method, uri,
+             (unsigned int) strlen(body), body);
+
+    HttpRequest request;
+    TEST_ASSERT_EQUAL(HTTP_PARSE_OK, parseHttpRequest(buffer, strlen(buffer), sizeof(buffer), request));
+    return handleHttpRequest(api, request, requestDoc, responseDoc);
+}
+
+static void assertOnlyBrightnessChanged() {
+    TEST_ASSERT_EQUAL(50, settings.powerOnBrightness);
+    TEST_ASSERT_EQUAL(150, settings.colorChangeDurationMs);
+    TEST_ASSERT_EQUAL(0, settings.powerOnBehavior);
+    TEST_ASSERT_EQUAL(200, settings.powerOnTemperature);
+    TEST_ASSERT_EQUAL(400, settings.switchOffDurationMs);
+    TEST_ASSERT_EQUAL(250, settings.switchOnDurationMs);
+}
+
+void test_batch_with_partial_settings_keeps_the_others() {
+    TEST_ASSERT_EQUAL(200, send("PUT", "/elgato/batch", "{\"settings\":{\"powerOnBrightness\":50}}"));
+    assertOnlyBrightnessChanged();
+    TEST_ASSERT_EQUAL(150, responseDoc["settings"]["colorChangeDurationMs"].as<int>());
+}
+
+void test_put_partial_settings_keeps_the_others() {
+    TEST_ASSERT_EQUAL(200, send("PUT", "/elgato/lights/settings", "{\"powerOnBrightness\":50}"));
+    assertOnlyBrightnessChanged();
+}
+
+void test_batch_with_on_false_switches_off() {
+    lights.lights[0].on = 1;
+    lights.lights[0].brightness = 40;
+
+    TEST_ASSERT_EQUAL(200, send("PUT", "/elgato/batch", "{\"lights\":[{\"on\":false}]}"));
+    TEST_ASSERT_EQUAL(0, lights.lights[0].on);
+    TEST_ASSERT_EQUAL(40, lights.lights[0].brightness);
+}
+
+void test_put_over_long_display_name_is_rejected() {
+    char body[128];
+    snprintf(body, sizeof(body), "{\"displayName\":\"%0*d\"}", MAX_DISPLAY_NAME_LENGTH + 1, 0);
+
+    TEST_ASSERT_EQUAL(400, send("PUT", "/elgato/accessory-info", body));
+    TEST_ASSERT_EQUAL_STRING(DEFAULT_DISPLAY_NAME, info.displayName.c_str());
+}
+
+void test_put_without_body_is_rejected() {
+    TEST_ASSERT_EQUAL(400, send("PUT", "/elgato/lights", ""));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_batch_with_partial_settings_keeps_the_others);
+    RUN_TEST(test_put_partial_settings_keeps_the_others);
+    RUN_TEST(test_batch_with_on_false_switches_off);
+    RUN_TEST(test_put_over_long_display_name_is_rejected);
+    RUN_TEST(test_put_without_body_is_rejected);
+    return UNITY_END();
+}